@@ -0,0 +1,382 @@
+// Compares the acceleration structures in raytracer/accelerator.h, and the per-shape bounding
+// spheres the renderer uses without one, on synthetic scenes, as one JSON line per layout,
+// structure and query:
+//     accel_benchmark
+//     accel_benchmark --shapes 1000000 --layouts voxels --structures bvh,grid
+//
+// Layouts:
+//   voxels     a dense lattice of equal cubes and spheres, like a voxel building kit
+//   clustered  most shapes packed into a few small clusters of varied sizes, the rest spread out
+//   random     shapes of varied sizes and rotations spread evenly through a box
+// Queries are closest hits of rays from outside the scene towards points inside it, and
+// occlusion tests of segments between two points inside it. Each structure reports its build
+// time, size and SAH cost (BVHs only), and rays per second, shapes tested and nodes (or cells)
+// visited per ray. Builds run on all cores unless --serial-build is given. The linear loop and
+// the bounding spheres visit every shape, so they only trace the first --linear-rays rays; the
+// other results on those rays are checked against the linear loop's, apart from hits the float
+// kernels report outside a shape (kernel_false_hits). With --animate F, a fraction F of the
+// shapes then moves, as in one frame of an animation, and every structure is refitted to them
+// (or rebuilt, where it cannot be refitted) before the rays are traced, timing the update.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "raytracer/accelerator.h"
+#include "raytracer/boundingspheres.h"
+#include "raytracer/intersect.h"
+#include "utils/renderstats.h"
+
+namespace {
+
+const PrimitiveType kTypes[] = {PrimitiveType::PRIMITIVE_CUBE, PrimitiveType::PRIMITIVE_SPHERE,
+                                PrimitiveType::PRIMITIVE_CYLINDER, PrimitiveType::PRIMITIVE_CONE};
+
+RenderShapeData makeShape(PrimitiveType type, const glm::mat4 &ctm) {
+    RenderShapeData shape{};
+    shape.type = type;
+    shape.ctm = ctm;
+    return shape;
+}
+
+glm::mat4 randomRotation(std::mt19937 &rng) {
+    std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    std::normal_distribution<float> normal;
+    glm::vec3 axis(normal(rng), normal(rng), normal(rng));
+    return glm::rotate(angle(rng), glm::length(axis) > 1e-6f ? glm::normalize(axis) : glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+// `count` shapes in one of the layouts described above
+std::vector<RenderShapeData> makeScene(const QString &layout, int count, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<RenderShapeData> shapes;
+    shapes.reserve(count);
+    int side = std::max(1, int(std::ceil(std::cbrt(double(count)))));
+    if (layout == "voxels") {
+        for (int i = 0; i < count; i++) {
+            glm::vec3 cell(i % side, (i / side) % side, i / (side * side));
+            PrimitiveType type = (i * 7) % 5 == 0 ? PrimitiveType::PRIMITIVE_SPHERE : PrimitiveType::PRIMITIVE_CUBE;
+            shapes.push_back(makeShape(type, glm::translate(cell) * glm::scale(glm::vec3(0.9f))));
+        }
+    } else if (layout == "clustered") {
+        std::vector<glm::vec3> centres(8);
+        for (glm::vec3 &centre : centres) {
+            centre = 4.0f * side * glm::vec3(unit(rng), unit(rng), unit(rng));
+        }
+        std::normal_distribution<float> spread(0.0f, 0.05f * side);
+        for (int i = 0; i < count; i++) {
+            glm::vec3 position;
+            if (unit(rng) < 0.9f) {
+                position = centres[i % centres.size()] + glm::vec3(spread(rng), spread(rng), spread(rng));
+            } else {
+                position = 4.0f * side * glm::vec3(unit(rng), unit(rng), unit(rng));
+            }
+            float size = 0.05f + 0.3f * unit(rng) * unit(rng);
+            shapes.push_back(makeShape(kTypes[i % 4], glm::translate(position) * randomRotation(rng) * glm::scale(glm::vec3(size))));
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            glm::vec3 position = 2.0f * side * glm::vec3(unit(rng), unit(rng), unit(rng));
+            glm::vec3 size = glm::vec3(0.3f) + 1.7f * glm::vec3(unit(rng), unit(rng), unit(rng));
+            shapes.push_back(makeShape(kTypes[i % 4], glm::translate(position) * randomRotation(rng) * glm::scale(size)));
+        }
+    }
+    return shapes;
+}
+
+// Moves a `fraction` of the shapes by up to 2% of the scene's size along each axis
+std::vector<int> moveShapes(std::vector<RenderShapeData> &shapes, const Bounds &scene, float fraction, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::uniform_real_distribution<float> offset(-0.02f, 0.02f);
+    std::vector<int> moved;
+    for (int s = 0; s < int(shapes.size()); s++) {
+        if (unit(rng) < fraction) {
+            glm::vec3 step = scene.extent() * glm::vec3(offset(rng), offset(rng), offset(rng));
+            shapes[s].ctm = glm::translate(step) * shapes[s].ctm;
+            moved.push_back(s);
+        }
+    }
+    return moved;
+}
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 dir;
+    float tMax;
+};
+
+// Closest-hit rays from a sphere around the scene, or occlusion segments inside it
+std::vector<Ray> makeRays(const Bounds &bounds, int count, bool occlusion, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto inside = [&]() {
+        return bounds.min + bounds.extent() * glm::vec3(unit(rng), unit(rng), unit(rng));
+    };
+    glm::vec3 centre = 0.5f * (bounds.min + bounds.max);
+    float radius = glm::length(bounds.extent());
+    std::normal_distribution<float> normal;
+    std::vector<Ray> rays(count);
+    for (Ray &ray : rays) {
+        if (occlusion) {
+            ray.origin = inside();
+            ray.dir = inside() - ray.origin;
+            ray.tMax = 1.0f;
+        } else {
+            glm::vec3 offset(normal(rng), normal(rng), normal(rng));
+            ray.origin = centre + radius * glm::normalize(offset + glm::vec3(1e-6f));
+            ray.dir = glm::normalize(inside() - ray.origin);
+            ray.tMax = std::numeric_limits<float>::max();
+        }
+    }
+    return rays;
+}
+
+// Tests shapes the way the renderer does, in object space; keeps the closest hit, or with
+// `anyHit` stops at the first hit before tMax
+class BenchmarkVisitor : public ShapeVisitor {
+public:
+    BenchmarkVisitor(const std::vector<RenderShapeData> &shapes, const std::vector<glm::mat4> &inverses, bool anyHit)
+        : m_shapes(shapes), m_inverses(inverses), m_anyHit(anyHit) {}
+
+    void begin(const Ray &ray) {
+        m_eye = glm::vec4(ray.origin, 1.0f);
+        m_d = glm::vec4(ray.dir, 0.0f);
+        shape = -1;
+    }
+
+    float visit(int s, float tMax) override {
+        Intersect intersect;
+        glm::vec4 eye = m_inverses[s] * m_eye;
+        glm::vec4 d = m_inverses[s] * m_d;
+        float t;
+        glm::vec4 hitPoint;
+        bool hit = false;
+        tests++;
+        switch (m_shapes[s].type) {
+        case PrimitiveType::PRIMITIVE_CUBE:
+            hit = intersect.intersect_cube(eye, d, t, hitPoint);
+            break;
+        case PrimitiveType::PRIMITIVE_CONE:
+            hit = intersect.intersect_cone(eye, d, t, hitPoint);
+            break;
+        case PrimitiveType::PRIMITIVE_CYLINDER:
+            hit = intersect.intersect_cylinder(eye, d, t, hitPoint);
+            break;
+        case PrimitiveType::PRIMITIVE_SPHERE:
+            hit = intersect.intersect_sphere(eye, d, t, hitPoint);
+            break;
+        default:
+            break;
+        }
+        // Occlusion is strict like Illuminate::occludes(); closest-hit ties go to the lower index
+        if (!hit || !(t < tMax || (!m_anyHit && t == tMax && s < shape))) {
+            return tMax;
+        }
+        shape = s;
+        point = hitPoint;
+        return m_anyHit ? -1.0f : t;
+    }
+
+    int shape = -1;              // The hit shape of the current ray, or -1
+    glm::vec4 point;             // Where the ray hit it, in its object space
+    std::uint64_t tests = 0;
+
+private:
+    const std::vector<RenderShapeData> &m_shapes;
+    const std::vector<glm::mat4> &m_inverses;
+    bool m_anyHit;
+    glm::vec4 m_eye;
+    glm::vec4 m_d;
+};
+
+// Whether the kernel's hit of `shape` lies inside the shape's unit cube, where every
+// primitive fits
+bool hitInsideShape(const std::vector<RenderShapeData> &shapes, const std::vector<glm::mat4> &inverses, const Ray &ray, int shape) {
+    BenchmarkVisitor visitor(shapes, inverses, false);
+    visitor.begin(ray);
+    visitor.visit(shape, std::numeric_limits<float>::max());
+    glm::vec3 extent = glm::abs(glm::vec3(visitor.point));
+    return std::max(extent.x, std::max(extent.y, extent.z)) <= 0.5f + 1e-3f;
+}
+
+// Visits every shape in index order, like the renderer without acceleration
+class LinearScan : public Accelerator {
+public:
+    explicit LinearScan(const std::vector<RenderShapeData> &shapes) : m_count(int(shapes.size())) {}
+
+    void traverse(const glm::vec3 &, const glm::vec3 &, float tMax, ShapeVisitor &visitor) const override {
+        for (int s = 0; s < m_count && tMax >= 0.0f; s++) {
+            tMax = visitor.visit(s, tMax);
+        }
+    }
+
+private:
+    int m_count;
+};
+
+struct Structure {
+    QString name;
+    std::unique_ptr<Accelerator> accelerator;
+    bool exhaustive; // Visits every shape, or every shape's bounding sphere, so traces --linear-rays only
+};
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("shapes", "Shapes per scene.", "count", "100000"));
+    parser.addOption(QCommandLineOption("rays", "Rays per query.", "count", "200000"));
+    parser.addOption(QCommandLineOption("linear-rays", "Rays traced by the linear loop.", "count", "2000"));
+    parser.addOption(QCommandLineOption("layouts", "Comma-separated scene layouts.", "layouts", "voxels,clustered,random"));
+    parser.addOption(QCommandLineOption("structures", "Comma-separated structures besides the linear loop.", "names",
+                                        "bvh,bvh4,lbvh,grid,two-level-grid"));
+    parser.addOption(QCommandLineOption("serial-build", "Build every structure on one thread."));
+    parser.addOption(QCommandLineOption("repeats", "Passes over the rays; the fastest is reported.", "count", "3"));
+    parser.addOption(QCommandLineOption("animate", "Fraction of shapes to move and refit before tracing.", "fraction", "0"));
+    parser.process(a);
+
+    int shapeCount = parser.value("shapes").toInt();
+    int rayCount = parser.value("rays").toInt();
+    int linearRays = std::min(rayCount, parser.value("linear-rays").toInt());
+    int repeats = std::max(1, parser.value("repeats").toInt());
+    bool parallelBuild = !parser.isSet("serial-build");
+    float animate = parser.value("animate").toFloat();
+    if (shapeCount <= 0 || rayCount <= 0 || linearRays <= 0) {
+        std::cerr << "--shapes, --rays and --linear-rays must be positive" << std::endl;
+        return 1;
+    }
+    std::vector<AccelerationStructure> structures;
+    QStringList structureNames = parser.value("structures").split(",");
+    for (const QString &name : structureNames) {
+        AccelerationStructure structure;
+        if (!parseAccelerationStructure(name.toStdString(), structure)) {
+            std::cerr << "unknown structure \"" << name.toStdString() << "\" (expected bvh, bvh4, lbvh, grid or two-level-grid)" << std::endl;
+            return 1;
+        }
+        structures.push_back(structure);
+    }
+
+    bool success = true;
+    std::mt19937 rng(1230);
+    for (const QString &layout : parser.value("layouts").split(",")) {
+        if (layout != "voxels" && layout != "clustered" && layout != "random") {
+            std::cerr << "unknown layout \"" << layout.toStdString() << "\"" << std::endl;
+            return 1;
+        }
+        std::vector<RenderShapeData> shapes = makeScene(layout, shapeCount, rng);
+        std::vector<glm::mat4> inverses(shapes.size());
+        for (size_t s = 0; s < shapes.size(); s++) {
+            inverses[s] = glm::inverse(shapes[s].ctm);
+        }
+        std::vector<Bounds> bounds;
+        std::vector<int> indices;
+        Bounds sceneBounds = collectShapeBounds(shapes, bounds, indices);
+
+        std::vector<Structure> built;
+        built.push_back(Structure{"linear", std::make_unique<LinearScan>(shapes), true});
+        built.push_back(Structure{"spheres", std::make_unique<BoundingSpheres>(shapes), true});
+        for (size_t i = 0; i < structures.size(); i++) {
+            built.push_back(Structure{structureNames[i], Accelerator::build(structures[i], shapes, parallelBuild), false});
+        }
+
+        std::vector<double> updateSeconds(built.size(), 0.0);
+        std::vector<bool> rebuilt(built.size(), false);
+        if (animate > 0.0f) {
+            std::vector<int> moved = moveShapes(shapes, sceneBounds, animate, rng);
+            for (int s : moved) {
+                inverses[s] = glm::inverse(shapes[s].ctm);
+            }
+            for (size_t i = 1; i < built.size(); i++) {
+                QElapsedTimer timer;
+                timer.start();
+                if (!built[i].accelerator->refit(shapes, moved)) {
+                    built[i].accelerator = Accelerator::build(structures[i - 2], shapes, parallelBuild);
+                    rebuilt[i] = true;
+                }
+                updateSeconds[i] = timer.nsecsElapsed() * 1e-9;
+            }
+            bounds.clear();
+            indices.clear();
+            sceneBounds = collectShapeBounds(shapes, bounds, indices);
+        }
+
+        for (bool occlusion : {false, true}) {
+            std::vector<Ray> rays = makeRays(sceneBounds, rayCount, occlusion, rng);
+            std::vector<int> reference;
+            for (size_t b = 0; b < built.size(); b++) {
+                const Structure &structure = built[b];
+                bool linear = reference.empty();
+                int count = structure.exhaustive ? linearRays : rayCount;
+                BenchmarkVisitor visitor(shapes, inverses, occlusion);
+                std::vector<int> results(count);
+                double best = std::numeric_limits<double>::max();
+                std::uint64_t nodes = 0;
+                for (int r = 0; r < repeats; r++) {
+                    visitor.tests = 0;
+                    threadCounters() = RenderCounters{};
+                    QElapsedTimer timer;
+                    timer.start();
+                    for (int i = 0; i < count; i++) {
+                        visitor.begin(rays[i]);
+                        structure.accelerator->traverse(rays[i].origin, rays[i].dir, rays[i].tMax, visitor);
+                        results[i] = visitor.shape;
+                    }
+                    best = std::min(best, timer.nsecsElapsed() * 1e-9);
+                    nodes = threadCounters().accelerationNodes;
+                }
+
+                // Occlusion only needs to agree on whether something was hit. Far from a small
+                // shape, the float kernels can report a hit outside it, which the structures'
+                // bounds may skip; those rays are counted apart instead of as mismatches.
+                int mismatches = 0, falseHits = 0;
+                if (linear) {
+                    reference = results;
+                } else {
+                    for (int i = 0; i < linearRays; i++) {
+                        bool agree = occlusion ? (results[i] >= 0) == (reference[i] >= 0) : results[i] == reference[i];
+                        bool falseHit = !agree && reference[i] >= 0 && !hitInsideShape(shapes, inverses, rays[i], reference[i]);
+                        mismatches += !agree && !falseHit;
+                        falseHits += falseHit;
+                    }
+                }
+                const AccelerationStats &stats = structure.accelerator->stats();
+                int hits = int(std::count_if(results.begin(), results.end(), [](int shape) { return shape >= 0; }));
+                success = success && mismatches == 0;
+
+                std::cout << "{\"layout\": \"" << layout.toStdString() << "\""
+                          << ", \"shapes\": " << shapes.size()
+                          << ", \"structure\": \"" << structure.name.toStdString() << "\""
+                          << ", \"query\": \"" << (occlusion ? "occlusion" : "closest_hit") << "\""
+                          << ", \"build_seconds\": " << stats.buildSeconds;
+                if (animate > 0.0f && !linear) {
+                    std::cout << ", \"update_seconds\": " << updateSeconds[b]
+                              << ", \"rebuilt\": " << (rebuilt[b] ? "true" : "false");
+                }
+                std::cout << ", \"nodes\": " << stats.nodes
+                          << ", \"references\": " << stats.references
+                          << ", \"sah_cost\": " << stats.sahCost
+                          << ", \"rays\": " << count
+                          << ", \"hit_rate\": " << double(hits) / count
+                          << ", \"rays_per_second\": " << count / best
+                          << ", \"tests_per_ray\": " << double(visitor.tests) / count
+                          << ", \"nodes_per_ray\": " << double(nodes) / count
+                          << ", \"mismatches\": " << mismatches
+                          << ", \"kernel_false_hits\": " << falseHits << "}" << std::endl;
+            }
+        }
+    }
+    return success ? 0 : 1;
+}
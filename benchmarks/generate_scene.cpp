@@ -0,0 +1,39 @@
+// Writes a procedurally generated scene file, for benchmarking scenes of any size:
+//     generate_scene --shapes 100000 --lights 16 --mix cube=1,sphere=3 --reflective 0.2 out/scene.json
+// With --instancing-depth, the shapes are instanced through template groups, so the file stays
+// small while the flattened scene is large.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include <iostream>
+
+#include "scenegenerator.h"
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addPositionalArgument("scene", "Path of the scene file to write.");
+    parser.addOption(QCommandLineOption("shapes", "Number of shapes.", "count", "1000"));
+    addGeneratorOptions(parser);
+    parser.process(a);
+
+    const QStringList paths = parser.positionalArguments();
+    SceneGeneratorOptions options;
+    options.shapes = parser.value("shapes").toInt();
+    if (paths.size() != 1 || options.shapes <= 0 || !readGeneratorOptions(parser, options)) {
+        std::cerr << "usage: generate_scene [--shapes N] [options] scene.json" << std::endl;
+        return 1;
+    }
+
+    int shapes = 0;
+    if (!generateScene(options, paths[0].toStdString(), shapes)) {
+        std::cerr << "could not write " << paths[0].toStdString() << std::endl;
+        return 1;
+    }
+    std::cout << "{\"scene\": \"" << paths[0].toStdString() << "\", \"shapes\": " << shapes
+              << ", \"lights\": " << options.lights << "}" << std::endl;
+    return 0;
+}
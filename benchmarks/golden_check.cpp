@@ -0,0 +1,233 @@
+// Renders every config under template_inis, checks each image against the reference named by
+// the config's IO/output, and checks its time against a stored baseline:
+//     golden_check --renderer build/projects_ray --baseline golden_baseline.json
+//     golden_check --renderer build/projects_ray --baseline golden_baseline.json --update-baseline
+//
+// The references are never overwritten; each config is rendered to a temporary copy with its
+// output redirected. An image fails below --min-psnr. A render regresses when its fastest wall
+// time over --repeats runs exceeds the baseline by more than --tolerance. Prints one JSON line
+// per config and a summary, and fails if any image failed or any render regressed. Configs
+// whose scene file is missing are reported and skipped.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSettings>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "imagecompare.h"
+
+namespace {
+
+struct Options {
+    QString renderer;
+    QDir root;
+    double minPsnr;
+    double tolerance;
+    int repeats;
+};
+
+struct Timing {
+    double seconds = std::numeric_limits<double>::max(); // Fastest wall time of the renderer process
+    double renderSeconds = 0.0;
+    double raysPerSecond = 0.0;
+};
+
+// Every .ini file under the given files and directories, sorted, relative to the root
+QStringList findConfigs(const QStringList &paths, const QDir &root) {
+    QStringList configs;
+    for (const QString &path : paths) {
+        QFileInfo info(root.filePath(path));
+        if (info.isDir()) {
+            QDirIterator it(info.filePath(), {"*.ini"}, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                configs << root.relativeFilePath(it.next());
+            }
+        } else {
+            configs << root.relativeFilePath(info.filePath());
+        }
+    }
+    configs.sort();
+    return configs;
+}
+
+// Copies `config` to `copyPath`, rendering to `outputPath` and printing statistics as JSON
+void writeConfigCopy(const QSettings &config, const QString &copyPath, const QString &outputPath) {
+    QSettings copy(copyPath, QSettings::IniFormat);
+    for (const QString &key : config.allKeys()) {
+        copy.setValue(key, config.value(key));
+    }
+    copy.setValue("IO/output", outputPath);
+    copy.setValue("Settings/print-stats", true);
+    copy.setValue("Settings/stats-format", "json");
+    copy.sync();
+}
+
+// Runs the renderer on `configPath`, and keeps the fastest run in `timing`.
+// @return False, after printing why, if the renderer failed.
+bool runRenderer(const Options &options, const QString &configPath, Timing &timing) {
+    QProcess render;
+    render.setWorkingDirectory(options.root.path());
+    render.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    QElapsedTimer timer;
+    timer.start();
+    render.start(options.renderer, {configPath});
+    if (!render.waitForFinished(-1) || render.exitStatus() != QProcess::NormalExit || render.exitCode() != 0) {
+        std::cerr << "the renderer failed on " << configPath.toStdString() << std::endl;
+        return false;
+    }
+    double seconds = timer.nsecsElapsed() * 1e-9;
+    if (seconds >= timing.seconds) {
+        return true;
+    }
+    timing.seconds = seconds;
+
+    // The statistics are the only line of output that is a JSON object
+    for (const QByteArray &line : render.readAllStandardOutput().split('\n')) {
+        QJsonObject stats = QJsonDocument::fromJson(line).object();
+        if (stats.contains("rays")) {
+            QJsonObject rays = stats["rays"].toObject();
+            timing.renderSeconds = stats["seconds"].toObject()["render"].toDouble();
+            double count = rays["primary"].toDouble() + rays["reflection"].toDouble() + rays["shadow"].toDouble();
+            timing.raysPerSecond = timing.renderSeconds > 0.0 ? count / timing.renderSeconds : 0.0;
+        }
+    }
+    return true;
+}
+
+std::string jsonNumber(double value) {
+    return std::isinf(value) ? std::string("\"inf\"") : std::to_string(value);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addPositionalArgument("configs", "Config files or directories of them, relative to --root.", "[configs...]");
+    parser.addOption(QCommandLineOption("renderer", "The projects_ray executable.", "path",
+                                        QDir(QCoreApplication::applicationDirPath()).filePath("projects_ray")));
+    parser.addOption(QCommandLineOption("root", "Directory the configs' paths are relative to.", "directory", "."));
+    parser.addOption(QCommandLineOption("min-psnr", "Lowest acceptable PSNR against the reference, in dB.", "dB", "40"));
+    parser.addOption(QCommandLineOption("baseline", "JSON file of baseline times per config.", "path"));
+    parser.addOption(QCommandLineOption("update-baseline", "Write this run's times to --baseline instead of checking them."));
+    parser.addOption(QCommandLineOption("tolerance", "Allowed slowdown against the baseline, as a fraction.", "fraction", "0.1"));
+    parser.addOption(QCommandLineOption("repeats", "Renders per config; the fastest is kept.", "count", "3"));
+    parser.process(a);
+
+    Options options;
+    options.renderer = QFileInfo(parser.value("renderer")).absoluteFilePath();
+    options.root = QDir(QFileInfo(parser.value("root")).absoluteFilePath());
+    options.minPsnr = parser.value("min-psnr").toDouble();
+    options.tolerance = parser.value("tolerance").toDouble();
+    options.repeats = std::max(1, parser.value("repeats").toInt());
+
+    QString baselinePath = parser.value("baseline");
+    bool updateBaseline = parser.isSet("update-baseline");
+    if (updateBaseline && baselinePath.isEmpty()) {
+        std::cerr << "--update-baseline needs --baseline" << std::endl;
+        return 1;
+    }
+    QJsonObject baseline;
+    QFile baselineFile(baselinePath);
+    if (!baselinePath.isEmpty() && !updateBaseline && baselineFile.open(QFile::ReadOnly)) {
+        baseline = QJsonDocument::fromJson(baselineFile.readAll()).object();
+        baselineFile.close();
+    }
+
+    QStringList paths = parser.positionalArguments();
+    if (paths.isEmpty()) {
+        paths << "template_inis";
+    }
+    QTemporaryDir tempDir;
+    QJsonObject newBaseline;
+    int passed = 0, failed = 0, regressed = 0, skipped = 0;
+
+    for (const QString &configPath : findConfigs(paths, options.root)) {
+        QSettings config(options.root.filePath(configPath), QSettings::IniFormat);
+        QString scenePath = config.value("IO/scene").toString();
+        QString referencePath = options.root.filePath(config.value("IO/output").toString());
+        if (!QFileInfo(options.root.filePath(scenePath)).exists()) {
+            std::cout << "{\"config\": \"" << configPath.toStdString() << "\", \"skipped\": \"missing scene "
+                      << scenePath.toStdString() << "\"}" << std::endl;
+            skipped++;
+            continue;
+        }
+
+        QString outputPath = tempDir.filePath(QString("render_%1.png").arg(passed + failed + skipped));
+        QString copyPath = tempDir.filePath("config.ini");
+        QFile::remove(copyPath);
+        writeConfigCopy(config, copyPath, outputPath);
+
+        Timing timing;
+        bool rendered = true;
+        for (int r = 0; r < options.repeats && rendered; r++) {
+            rendered = runRenderer(options, copyPath, timing);
+        }
+
+        ImageDifference difference;
+        QImage reference(referencePath);
+        bool hasReference = !reference.isNull();
+        bool imagePass = rendered && hasReference && compareImages(reference, QImage(outputPath), difference) &&
+                         difference.psnr >= options.minPsnr;
+
+        double baselineSeconds = baseline[configPath].toObject()["seconds"].toDouble();
+        bool regression = imagePass && baselineSeconds > 0.0 && timing.seconds > baselineSeconds * (1.0 + options.tolerance);
+        if (imagePass) {
+            QJsonObject entry;
+            entry["seconds"] = timing.seconds;
+            entry["rays_per_second"] = timing.raysPerSecond;
+            newBaseline[configPath] = entry;
+        }
+        passed += imagePass;
+        failed += !imagePass;
+        regressed += regression;
+
+        std::cout << "{\"config\": \"" << configPath.toStdString() << "\""
+                  << ", \"image_pass\": " << (imagePass ? "true" : "false");
+        if (!rendered) {
+            std::cout << ", \"error\": \"render failed\"";
+        } else if (!hasReference) {
+            std::cout << ", \"error\": \"missing reference " << referencePath.toStdString() << "\"";
+        } else {
+            std::cout << ", \"psnr\": " << jsonNumber(difference.psnr)
+                      << ", \"max_difference\": " << difference.maxDifference
+                      << ", \"seconds\": " << timing.seconds
+                      << ", \"render_seconds\": " << timing.renderSeconds
+                      << ", \"rays_per_second\": " << timing.raysPerSecond;
+        }
+        if (baselineSeconds > 0.0) {
+            std::cout << ", \"baseline_seconds\": " << baselineSeconds
+                      << ", \"speedup\": " << baselineSeconds / timing.seconds
+                      << ", \"regression\": " << (regression ? "true" : "false");
+        }
+        std::cout << "}" << std::endl;
+    }
+
+    if (updateBaseline) {
+        if (!baselineFile.open(QFile::WriteOnly | QFile::Truncate)) {
+            std::cerr << "could not write " << baselinePath.toStdString() << std::endl;
+            return 1;
+        }
+        baselineFile.write(QJsonDocument(newBaseline).toJson());
+    }
+    std::cout << "{\"passed\": " << passed << ", \"failed\": " << failed << ", \"regressed\": " << regressed
+              << ", \"skipped\": " << skipped << "}" << std::endl;
+    return failed == 0 && regressed == 0 ? 0 : 1;
+}
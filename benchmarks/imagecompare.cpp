@@ -0,0 +1,33 @@
+#include "imagecompare.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+bool compareImages(const QImage &a, const QImage &b, ImageDifference &difference) {
+    if (a.width() != b.width() || a.height() != b.height()) {
+        return false;
+    }
+    QImage first = a.convertToFormat(QImage::Format_RGBX8888);
+    QImage second = b.convertToFormat(QImage::Format_RGBX8888);
+
+    difference = ImageDifference{};
+    double squaredError = 0.0;
+    for (int y = 0; y < first.height(); y++) {
+        const uchar *p = first.constScanLine(y);
+        const uchar *q = second.constScanLine(y);
+        for (int x = 0; x < first.width(); x++) {
+            bool differs = false;
+            for (int c = 0; c < 3; c++) {
+                int channel = std::abs(int(p[4 * x + c]) - int(q[4 * x + c]));
+                difference.maxDifference = std::max(difference.maxDifference, channel);
+                squaredError += channel * channel;
+                differs |= channel != 0;
+            }
+            difference.differingPixels += differs;
+        }
+    }
+    double mse = squaredError / (3.0 * first.width() * first.height());
+    difference.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : std::numeric_limits<double>::infinity();
+    return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <QImage>
+
+// How far apart two renders of the same size are, over their RGB channels
+struct ImageDifference {
+    int maxDifference = 0;       // Largest difference of one channel, out of 255
+    long long differingPixels = 0;
+    double psnr = 0.0;           // In dB; infinite for identical images
+};
+
+// Compares `a` with `b`.
+// @return False if the images differ in size.
+bool compareImages(const QImage &a, const QImage &b, ImageDifference &difference);
@@ -0,0 +1,199 @@
+// Measures rays per second for the ray-shape kernels in raytracer/intersect.h, and calls per
+// second for the normal kernels, as one JSON line per kernel and hit rate:
+//     intersect_benchmark
+//     intersect_benchmark --rays 4000000 --hit-rates 0,0.25,1
+//
+// Rays start 3 units from the shape. A hit ray passes through a point inside the shape; a miss
+// ray passes no closer than 0.9 to its centre, outside every unit shape. The plane is the
+// y = 0 plane, which each ray hits or misses depending on which way it crosses it, so its
+// measured hit rate is reported rather than chosen. Compare new kernels against these numbers
+// before replacing the current ones.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "raytracer/intersect.h"
+
+namespace {
+
+struct Ray {
+    glm::vec4 eye;
+    glm::vec4 d;
+};
+
+glm::vec3 randomDirection(std::mt19937 &rng) {
+    std::normal_distribution<float> normal;
+    glm::vec3 v;
+    do {
+        v = glm::vec3(normal(rng), normal(rng), normal(rng));
+    } while (glm::dot(v, v) < 1e-6f);
+    return glm::normalize(v);
+}
+
+// `count` rays, a fraction `hitRate` of which pass through a point inside every unit shape
+std::vector<Ray> makeRays(int count, double hitRate, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Ray> rays(count);
+    for (Ray &ray : rays) {
+        glm::vec3 d = randomDirection(rng);
+        glm::vec3 through;
+        if (unit(rng) < hitRate) {
+            // Inside the cube, sphere and cylinder, and inside the cone, whose radius is 0.375 at y = -0.25
+            through = glm::vec3(0.0f, -0.25f, 0.0f) + 0.1f * unit(rng) * randomDirection(rng);
+        } else {
+            // The closest point of the ray to the centre, at least 0.9 away; every unit shape fits in a radius of 0.87
+            glm::vec3 side = glm::normalize(glm::cross(d, randomDirection(rng)));
+            through = (0.9f + 0.6f * unit(rng)) * side;
+        }
+        ray.eye = glm::vec4(through - 3.0f * d, 1.0f);
+        ray.d = glm::vec4(d, 0.0f);
+    }
+    return rays;
+}
+
+// Runs `kernel` over every ray `repeats` times and keeps the fastest pass.
+// @return Nanoseconds per ray; `hits` is set to the number of rays that hit
+template <typename Kernel>
+double nanosecondsPerRay(Kernel kernel, const std::vector<Ray> &rays, int repeats, int &hits) {
+    double best = std::numeric_limits<double>::max();
+    float sum = 0.0f;
+    for (int r = 0; r < repeats; r++) {
+        hits = 0;
+        QElapsedTimer timer;
+        timer.start();
+        for (const Ray &ray : rays) {
+            float t = 0.0f;
+            glm::vec4 intersection;
+            if (kernel(ray, t, intersection)) {
+                hits++;
+                sum += t;
+            }
+        }
+        best = std::min(best, double(timer.nsecsElapsed()) / rays.size());
+    }
+    volatile float sink = sum; // Keeps the loop from being optimized away
+    (void)sink;
+    return best;
+}
+
+void printResult(const char *kernel, double hitRate, double measuredHitRate, size_t count, double nanoseconds) {
+    std::cout << "{\"kernel\": \"" << kernel << "\""
+              << ", \"hit_rate\": " << hitRate
+              << ", \"measured_hit_rate\": " << measuredHitRate
+              << ", \"rays\": " << count
+              << ", \"ns_per_ray\": " << nanoseconds
+              << ", \"rays_per_second\": " << 1e9 / nanoseconds << "}" << std::endl;
+}
+
+void benchmarkIntersections(const std::vector<Ray> &rays, double hitRate, int repeats) {
+    Intersect intersect;
+    glm::vec3 planePoint(0.0f, 0.0f, 0.0f);
+    glm::vec3 planeNormal(0.0f, 1.0f, 0.0f);
+    auto run = [&](const char *name, auto kernel) {
+        int hits = 0;
+        double nanoseconds = nanosecondsPerRay(kernel, rays, repeats, hits);
+        printResult(name, hitRate, double(hits) / rays.size(), rays.size(), nanoseconds);
+    };
+    run("intersect_sphere", [&](const Ray &ray, float &t, glm::vec4 &p) { return intersect.intersect_sphere(ray.eye, ray.d, t, p); });
+    run("intersect_cube", [&](const Ray &ray, float &t, glm::vec4 &p) { return intersect.intersect_cube(ray.eye, ray.d, t, p); });
+    run("intersect_cone", [&](const Ray &ray, float &t, glm::vec4 &p) { return intersect.intersect_cone(ray.eye, ray.d, t, p); });
+    run("intersect_cylinder", [&](const Ray &ray, float &t, glm::vec4 &p) { return intersect.intersect_cylinder(ray.eye, ray.d, t, p); });
+    run("intersect_plane", [&](const Ray &ray, float &t, glm::vec4 &p) {
+        return intersect.intersect_plane(ray.eye, ray.d, planePoint, planeNormal, t, p);
+    });
+}
+
+// Times a normal kernel on the hit points of `rays` on its shape, under a rotated and scaled CTM
+template <typename Intersection, typename Normal>
+void benchmarkNormal(const char *name, const std::vector<Ray> &rays, int repeats, Intersection intersection, Normal normal) {
+    std::vector<glm::vec4> points;
+    for (const Ray &ray : rays) {
+        float t;
+        glm::vec4 point;
+        if (intersection(ray, t, point)) {
+            points.push_back(point);
+        }
+    }
+    if (points.empty()) {
+        return;
+    }
+    glm::mat4 ctm = glm::rotate(0.7f, glm::vec3(1.0f, 2.0f, 3.0f)) * glm::scale(glm::vec3(1.0f, 2.0f, 0.5f));
+
+    double best = std::numeric_limits<double>::max();
+    glm::vec3 sum(0.0f);
+    for (int r = 0; r < repeats; r++) {
+        QElapsedTimer timer;
+        timer.start();
+        for (glm::vec4 &point : points) {
+            sum += normal(point, ctm);
+        }
+        best = std::min(best, double(timer.nsecsElapsed()) / points.size());
+    }
+    volatile float sink = sum.x + sum.y + sum.z;
+    (void)sink;
+
+    std::cout << "{\"kernel\": \"" << name << "\""
+              << ", \"calls\": " << points.size()
+              << ", \"ns_per_call\": " << best
+              << ", \"calls_per_second\": " << 1e9 / best << "}" << std::endl;
+}
+
+void benchmarkNormals(const std::vector<Ray> &rays, int repeats) {
+    Intersect intersect;
+    benchmarkNormal("normal_sphere", rays, repeats,
+        [&](const Ray &ray, float &t, glm::vec4 &p) { return intersect.intersect_sphere(ray.eye, ray.d, t, p); },
+        [&](glm::vec4 &p, glm::mat4 &ctm) { return intersect.normal_sphere(p, ctm); });
+    benchmarkNormal("normal_cube", rays, repeats,
+        [&](const Ray &ray, float &t, glm::vec4 &p) { return intersect.intersect_cube(ray.eye, ray.d, t, p); },
+        [&](glm::vec4 &p, glm::mat4 &ctm) { return intersect.normal_cube(p, ctm); });
+    benchmarkNormal("normal_cone", rays, repeats,
+        [&](const Ray &ray, float &t, glm::vec4 &p) { return intersect.intersect_cone(ray.eye, ray.d, t, p); },
+        [&](glm::vec4 &p, glm::mat4 &ctm) { return intersect.normal_cone(p, ctm); });
+    benchmarkNormal("normal_cylinder", rays, repeats,
+        [&](const Ray &ray, float &t, glm::vec4 &p) { return intersect.intersect_cylinder(ray.eye, ray.d, t, p); },
+        [&](glm::vec4 &p, glm::mat4 &ctm) { return intersect.normal_cylinder(p, ctm); });
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("rays", "Rays per kernel and hit rate.", "count", "1000000"));
+    parser.addOption(QCommandLineOption("hit-rates", "Comma-separated fractions of rays that hit.", "rates", "0,0.5,1"));
+    parser.addOption(QCommandLineOption("repeats", "Passes over the rays; the fastest is reported.", "count", "5"));
+    parser.process(a);
+
+    int count = parser.value("rays").toInt();
+    int repeats = std::max(1, parser.value("repeats").toInt());
+    if (count <= 0) {
+        std::cerr << "--rays must be positive" << std::endl;
+        return 1;
+    }
+
+    std::mt19937 rng(1230);
+    for (const QString &rate : parser.value("hit-rates").split(",")) {
+        bool ok = false;
+        double hitRate = rate.toDouble(&ok);
+        if (!ok || hitRate < 0.0 || hitRate > 1.0) {
+            std::cerr << "invalid hit rate \"" << rate.toStdString() << "\"" << std::endl;
+            return 1;
+        }
+        benchmarkIntersections(makeRays(count, hitRate, rng), hitRate, repeats);
+    }
+    // Every ray hits, so each shape's normal is timed on as many points as possible
+    benchmarkNormals(makeRays(count, 1.0, rng), repeats);
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Measures scene parse time and peak memory for the DOM and streaming scene readers.
+//
+// Peak RSS can only grow within a process, so compare the two readers in separate runs:
+//     parse_benchmark --primitives 1000000
+//     parse_benchmark --primitives 1000000 --streaming
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTemporaryDir>
+
+#include <fstream>
+#include <iostream>
+
+#include "peakrss.h"
+#include "utils/sceneparser.h"
+
+namespace {
+
+// Writes a scene with `primitives` primitives, each in its own translated group, in blocks of 1000.
+bool writeScene(const std::string &path, int primitives) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    const char *types[] = {"cube", "sphere", "cylinder", "cone"};
+    out << "{\n\"name\": \"parse benchmark\",\n"
+        << "\"globalData\": {\"ambientCoeff\": 0.5, \"diffuseCoeff\": 0.5, \"specularCoeff\": 0.5},\n"
+        << "\"cameraData\": {\"position\": [0, 0, 10], \"up\": [0, 1, 0], \"look\": [0, 0, -1], \"heightAngle\": 45},\n"
+        << "\"groups\": [\n";
+    int blocks = (primitives + 999) / 1000;
+    for (int b = 0, p = 0; b < blocks; b++) {
+        out << (b ? ",\n" : "") << "{\"translate\": [" << b % 100 << ", " << b / 100 << ", 0], \"groups\": [";
+        for (int i = 0; i < 1000 && p < primitives; i++, p++) {
+            out << (i ? "," : "") << "\n  {\"translate\": [" << (i % 10) * 0.1 << ", " << (i / 10 % 10) * 0.1 << ", " << (i / 100) * 0.1
+                << "], \"scale\": [0.05, 0.05, 0.05], \"primitives\": [{\"type\": \"" << types[p % 4]
+                << "\", \"diffuse\": [" << (p % 7) / 7.0 << ", 0.5, 0.5], \"specular\": [1, 1, 1], \"shininess\": 25}]}";
+        }
+        out << "]}";
+    }
+    out << "\n]\n}\n";
+    return bool(out);
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("streaming", "Use the streaming reader instead of the QJsonDocument reader."));
+    parser.addOption(QCommandLineOption("primitives", "Number of primitives in the generated scene.", "count", "1000000"));
+    parser.addOption(QCommandLineOption("scene", "Parse this scene file instead of generating one.", "path"));
+    parser.process(a);
+
+    bool streaming = parser.isSet("streaming");
+    QTemporaryDir tempDir;
+    std::string scenePath = parser.value("scene").toStdString();
+    int primitives = parser.value("primitives").toInt();
+    if (scenePath.empty()) {
+        scenePath = tempDir.filePath("parse_benchmark.json").toStdString();
+        if (!writeScene(scenePath, primitives)) {
+            std::cerr << "could not write " << scenePath << std::endl;
+            return 1;
+        }
+    }
+
+    double rssBefore = peakRssMegabytes();
+    QElapsedTimer timer;
+    timer.start();
+    RenderData renderData;
+    // Only the JSON line goes to stdout
+    bool success = SceneParser::parse(scenePath, renderData, streaming, std::cerr);
+    double seconds = timer.nsecsElapsed() * 1e-9;
+    double rssPeak = peakRssMegabytes();
+
+    if (!success) {
+        std::cerr << "could not parse " << scenePath << std::endl;
+        return 1;
+    }
+
+    std::cout << "{\"reader\": \"" << (streaming ? "streaming" : "dom") << "\""
+              << ", \"shapes\": " << renderData.shapes.size()
+              << ", \"file_mb\": " << QFileInfo(QString::fromStdString(scenePath)).size() / (1024.0 * 1024.0)
+              << ", \"parse_seconds\": " << seconds
+              << ", \"rss_before_mb\": " << rssBefore
+              << ", \"peak_rss_mb\": " << rssPeak << "}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Reads every scene file under the given files and directories with both scene readers, and
+// checks that they agree on whether the scene is valid, on every message they print, in order,
+// and on the size of the scene graph they build:
+//     reader_check benchmarks/reader_scenes scenefiles
+//
+// A JSON syntax error is reported by QJsonDocument on one side and JsonStreamReader on the
+// other, so only the presence of its message is compared, not the position or the wording.
+//
+// Prints one JSON line per scene and a summary, and fails if any scene differs. On a
+// difference, the messages of both readers are printed to stderr.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDirIterator>
+#include <QFileInfo>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "utils/scenefilereader.h"
+
+namespace {
+
+struct ReadResult {
+    bool success = false;
+    std::string messages;
+    size_t nodes = 0;
+    size_t primitives = 0;
+    size_t lights = 0;
+
+    bool operator==(const ReadResult &other) const {
+        return success == other.success && messages == other.messages && nodes == other.nodes &&
+               primitives == other.primitives && lights == other.lights;
+    }
+};
+
+// Counts every node of the graph under `node` as often as it is referenced, as SceneParser does
+void countNodes(const SceneNode *node, ReadResult &result) {
+    result.nodes++;
+    result.primitives += node->primitives.size();
+    result.lights += node->lights.size();
+    for (const SceneNode *child : node->children) {
+        countNodes(child, result);
+    }
+}
+
+ReadResult readScene(const std::string &path, bool streaming) {
+    ReadResult result;
+    std::ostringstream messages;
+    ScenefileReader reader(path, messages);
+    result.success = streaming ? reader.readJSONStream() : reader.readJSON();
+
+    std::istringstream lines(messages.str());
+    for (std::string line; std::getline(lines, line);) {
+        if (line.starts_with("parse error at ")) {
+            line = "parse error";
+        }
+        result.messages += line + "\n";
+    }
+    if (result.success) {
+        countNodes(reader.getRootNode(), result);
+    }
+    return result;
+}
+
+// Every .json file under the given files and directories, sorted
+QStringList findScenes(const QStringList &paths) {
+    QStringList scenes;
+    for (const QString &path : paths) {
+        QFileInfo info(path);
+        if (info.isDir()) {
+            QDirIterator it(info.filePath(), {"*.json"}, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                scenes << it.next();
+            }
+        } else {
+            scenes << info.filePath();
+        }
+    }
+    scenes.sort();
+    return scenes;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addPositionalArgument("scenes", "Scene files or directories of them.", "[scenes...]");
+    parser.process(a);
+
+    QStringList paths = parser.positionalArguments();
+    if (paths.isEmpty()) {
+        paths << "benchmarks/reader_scenes";
+    }
+
+    int matched = 0, differed = 0, valid = 0;
+    for (const QString &scene : findScenes(paths)) {
+        std::string path = scene.toStdString();
+        ReadResult dom = readScene(path, false);
+        ReadResult stream = readScene(path, true);
+        bool match = dom == stream;
+        matched += match;
+        differed += !match;
+        valid += match && dom.success;
+
+        std::cout << "{\"scene\": \"" << path << "\", \"valid\": " << (dom.success ? "true" : "false")
+                  << ", \"match\": " << (match ? "true" : "false") << "}" << std::endl;
+        if (!match) {
+            std::cerr << path << ": the readers differ\n"
+                      << "dom (" << (dom.success ? "valid" : "invalid") << ", " << dom.nodes << " nodes, "
+                      << dom.primitives << " primitives, " << dom.lights << " lights):\n" << dom.messages
+                      << "streaming (" << (stream.success ? "valid" : "invalid") << ", " << stream.nodes << " nodes, "
+                      << stream.primitives << " primitives, " << stream.lights << " lights):\n" << stream.messages
+                      << std::flush;
+        }
+    }
+
+    std::cout << "{\"matched\": " << matched << ", \"differed\": " << differed << ", \"valid\": " << valid << "}" << std::endl;
+    if (matched + differed == 0) {
+        std::cerr << "no scene files found" << std::endl;
+        return 1;
+    }
+    return differed == 0 ? 0 : 1;
+}
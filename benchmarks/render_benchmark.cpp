@@ -0,0 +1,200 @@
+// Renders generated scenes of increasing size at fixed resolutions, and reports the time and
+// peak memory of each render as one JSON line, giving a scaling curve:
+//     render_benchmark
+//     render_benchmark --shape-counts 10,1000,100000 --resolutions 320x240 --parallel --reflective 0.3
+//
+// Each scene is generated by scenegenerator.cpp (see generate_scene for its options) and each
+// render runs in a child process, so peak RSS is measured per render. A render that takes longer
+// than --max-seconds is stopped, and larger scenes are skipped at that resolution. With
+// --acceleration, shapes are found with that structure, whose build time and SAH cost are
+// reported; compile time then includes the build, which is most of the time to first pixel.
+// To time an existing scene instead:
+//     render_benchmark --render scene.json --width 320 --height 240
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include <iostream>
+#include <vector>
+
+#include "peakrss.h"
+#include "scenegenerator.h"
+#include "raytracer/raytracer.h"
+#include "raytracer/raytracescene.h"
+#include "utils/sceneparser.h"
+
+namespace {
+
+// Parses, compiles and renders one scene in this process, and prints its JSON line
+int renderScene(const QString &scenePath, int width, int height, bool parallel, const QString &acceleration) {
+    QElapsedTimer timer;
+    timer.start();
+    RenderData renderData;
+    if (!SceneParser::parse(scenePath.toStdString(), renderData)) {
+        std::cerr << "could not parse " << scenePath.toStdString() << std::endl;
+        return 1;
+    }
+    double parseSeconds = timer.nsecsElapsed() * 1e-9;
+
+    RayTracer::Config config{};
+    config.enableShadow = true;
+    config.enableReflection = true;
+    config.enableTextureMap = true;
+    config.enableParallelism = parallel;
+    if (!acceleration.isEmpty()) {
+        config.enableAcceleration = parseAccelerationStructure(acceleration.toStdString(), config.accelerationStructure);
+    }
+    RayTracer raytracer{config};
+    RayTraceScene scene{width, height, renderData};
+    std::vector<RGBA> image(size_t(width) * height);
+    raytracer.render(image.data(), scene);
+
+    const RenderCounters &counters = raytracer.counters();
+    const RenderTimings &timings = raytracer.timings();
+    std::uint64_t rays = counters.primaryRays + counters.reflectionRays + counters.shadowRays;
+    std::uint64_t tests = 0;
+    for (std::uint64_t count : counters.intersectionTests) {
+        tests += count;
+    }
+    std::cout << "{\"shapes\": " << renderData.shapes.size()
+              << ", \"lights\": " << renderData.lights.size()
+              << ", \"width\": " << width
+              << ", \"height\": " << height
+              << ", \"parallel\": " << (parallel ? "true" : "false")
+              << ", \"parse_seconds\": " << parseSeconds
+              << ", \"compile_seconds\": " << timings.compile
+              << ", \"render_seconds\": " << timings.render
+              << ", \"rays\": " << rays
+              << ", \"intersection_tests\": " << tests
+              << ", \"rays_per_second\": " << rays / timings.render;
+    const AccelerationStats &stats = raytracer.accelerationStats();
+    if (stats.structure != nullptr) {
+        std::cout << ", \"acceleration\": \"" << stats.structure << "\""
+                  << ", \"acceleration_build_seconds\": " << stats.buildSeconds
+                  << ", \"sah_cost\": " << stats.sahCost;
+    }
+    std::cout << ", \"peak_rss_mb\": " << peakRssMegabytes() << "}" << std::endl;
+    return 0;
+}
+
+struct Resolution {
+    int width;
+    int height;
+};
+
+bool parseResolutions(const QString &text, std::vector<Resolution> &resolutions) {
+    for (const QString &entry : text.split(",")) {
+        QStringList parts = entry.split("x");
+        bool okWidth = false, okHeight = false;
+        if (parts.size() == 2) {
+            resolutions.push_back(Resolution{parts[0].toInt(&okWidth), parts[1].toInt(&okHeight)});
+        }
+        if (!okWidth || !okHeight || resolutions.back().width <= 0 || resolutions.back().height <= 0) {
+            std::cerr << "invalid resolution \"" << entry.toStdString() << "\" (expected WIDTHxHEIGHT)" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("shape-counts", "Comma-separated numbers of shapes to generate.", "counts",
+                                        "10,100,1000,10000,100000,1000000"));
+    parser.addOption(QCommandLineOption("resolutions", "Comma-separated image sizes.", "WxH,...", "160x120,320x240"));
+    parser.addOption(QCommandLineOption("parallel", "Render on all cores."));
+    parser.addOption(QCommandLineOption("acceleration", "Acceleration structure: bvh, bvh4, lbvh, grid or two-level-grid.", "structure"));
+    parser.addOption(QCommandLineOption("max-seconds", "Time limit of each render.", "seconds", "600"));
+    parser.addOption(QCommandLineOption("keep", "Write the generated scenes to this directory and keep them.", "directory"));
+    parser.addOption(QCommandLineOption("render", "Render only this scene, in this process.", "scene"));
+    parser.addOption(QCommandLineOption("width", "Image width for --render.", "pixels", "320"));
+    parser.addOption(QCommandLineOption("height", "Image height for --render.", "pixels", "240"));
+    addGeneratorOptions(parser);
+    parser.process(a);
+
+    bool parallel = parser.isSet("parallel");
+    QString acceleration = parser.value("acceleration");
+    AccelerationStructure structure;
+    if (!acceleration.isEmpty() && !parseAccelerationStructure(acceleration.toStdString(), structure)) {
+        std::cerr << "unknown acceleration structure \"" << acceleration.toStdString() << "\"" << std::endl;
+        return 1;
+    }
+    if (parser.isSet("render")) {
+        return renderScene(parser.value("render"), parser.value("width").toInt(), parser.value("height").toInt(),
+                           parallel, acceleration);
+    }
+
+    SceneGeneratorOptions options;
+    std::vector<Resolution> resolutions;
+    if (!readGeneratorOptions(parser, options) || !parseResolutions(parser.value("resolutions"), resolutions)) {
+        return 1;
+    }
+    QTemporaryDir tempDir;
+    QString directory = parser.isSet("keep") ? parser.value("keep") : tempDir.path();
+    int maxMilliseconds = int(parser.value("max-seconds").toDouble() * 1000);
+
+    std::vector<bool> timedOut(resolutions.size(), false);
+    bool success = true;
+    for (const QString &count : parser.value("shape-counts").split(",")) {
+        options.shapes = count.toInt();
+        if (options.shapes <= 0) {
+            std::cerr << "invalid shape count \"" << count.toStdString() << "\"" << std::endl;
+            return 1;
+        }
+        QString scenePath = QDir(directory).filePath(QString("generated_%1.json").arg(options.shapes));
+        int shapes = 0;
+        if (!generateScene(options, scenePath.toStdString(), shapes)) {
+            std::cerr << "could not write " << scenePath.toStdString() << std::endl;
+            return 1;
+        }
+
+        for (size_t r = 0; r < resolutions.size(); r++) {
+            const Resolution &resolution = resolutions[r];
+            auto printUnfinished = [&](const char *reason) {
+                std::cout << "{\"shapes\": " << shapes << ", \"width\": " << resolution.width
+                          << ", \"height\": " << resolution.height << ", \"" << reason << "\": true}" << std::endl;
+            };
+            if (timedOut[r]) {
+                printUnfinished("skipped");
+                continue;
+            }
+            QStringList arguments = {"--render", scenePath,
+                                     "--width", QString::number(resolution.width),
+                                     "--height", QString::number(resolution.height)};
+            if (parallel) {
+                arguments << "--parallel";
+            }
+            if (!acceleration.isEmpty()) {
+                arguments << "--acceleration" << acceleration;
+            }
+            QProcess render;
+            render.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+            render.start(QCoreApplication::applicationFilePath(), arguments);
+            if (!render.waitForFinished(maxMilliseconds)) {
+                render.kill();
+                render.waitForFinished();
+                timedOut[r] = true;
+                printUnfinished("timed_out");
+                continue;
+            }
+            if (render.exitStatus() != QProcess::NormalExit || render.exitCode() != 0) {
+                success = false;
+                printUnfinished("failed");
+                continue;
+            }
+            // The parser and renderer print progress too; the JSON line is the child's last
+            QByteArray output = render.readAllStandardOutput().trimmed();
+            std::cout << output.mid(output.lastIndexOf('\n') + 1).toStdString() << std::endl;
+        }
+    }
+    return success ? 0 : 1;
+}
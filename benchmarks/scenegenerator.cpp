@@ -0,0 +1,190 @@
+#include "scenegenerator.h"
+
+#include <QImage>
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+namespace {
+
+const char *kTextureName = "generated_checker.png";
+
+// A black and white checkerboard, written next to the scene
+bool writeTexture(const std::filesystem::path &path) {
+    const int size = 64;
+    QImage image(size, size, QImage::Format_RGBX8888);
+    for (int y = 0; y < size; y++) {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < size; x++) {
+            uchar value = ((x / 8 + y / 8) % 2) ? 230 : 40;
+            line[4 * x] = line[4 * x + 1] = line[4 * x + 2] = value;
+            line[4 * x + 3] = 255;
+        }
+    }
+    return image.save(QString::fromStdString(path.string()), "PNG");
+}
+
+class Writer {
+public:
+    Writer(const SceneGeneratorOptions &options, std::ostream &out, const std::string &textureFile)
+        : m_options(options), m_out(out), m_textureFile(textureFile), m_rng(options.seed) {}
+
+    // `count` shapes, each in its own group, jittered within the cells of a grid over [-1, 1]^3
+    void shapes(int count) {
+        int cells = std::max(1, int(std::ceil(std::cbrt(double(count)))));
+        float cell = 2.0f / cells;
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::discrete_distribution<int> type({m_options.cubes, m_options.spheres, m_options.cylinders, m_options.cones});
+        const char *types[] = {"cube", "sphere", "cylinder", "cone"};
+        for (int i = 0; i < count; i++) {
+            int x = i % cells, y = i / cells % cells, z = i / (cells * cells);
+            float scale = cell * (0.4f + 0.4f * unit(m_rng));
+            float slack = cell - scale;
+            m_out << (i ? ",\n" : "\n") << "{\"translate\": ["
+                  << -1.0f + x * cell + scale / 2 + slack * unit(m_rng) << ", "
+                  << -1.0f + y * cell + scale / 2 + slack * unit(m_rng) << ", "
+                  << -1.0f + z * cell + scale / 2 + slack * unit(m_rng) << "], "
+                  << "\"rotate\": [" << unit(m_rng) << ", " << unit(m_rng) << ", " << 0.1f + unit(m_rng) << ", " << 360.0f * unit(m_rng) << "], "
+                  << "\"scale\": [" << scale << ", " << scale << ", " << scale << "], "
+                  << "\"primitives\": [{\"type\": \"" << types[type(m_rng)] << "\""
+                  << ", \"ambient\": [0.1, 0.1, 0.1]"
+                  << ", \"diffuse\": [" << 0.2f + 0.8f * unit(m_rng) << ", " << 0.2f + 0.8f * unit(m_rng) << ", " << 0.2f + 0.8f * unit(m_rng) << "]"
+                  << ", \"specular\": [0.5, 0.5, 0.5], \"shininess\": 20";
+            if (unit(m_rng) < m_options.reflective) {
+                m_out << ", \"reflective\": [0.5, 0.5, 0.5]";
+            }
+            if (unit(m_rng) < m_options.textured) {
+                m_out << ", \"textureFile\": \"" << m_textureFile << "\", \"textureU\": 2, \"textureV\": 2, \"blend\": 0.5";
+            }
+            m_out << "}]}";
+        }
+    }
+
+    void lights() {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float intensity = 1.5f / std::max(1, m_options.lights);
+        for (int i = 0; i < m_options.lights; i++) {
+            m_out << (i ? ",\n" : "\n");
+            if (i == 0) {
+                m_out << "{\"lights\": [{\"type\": \"directional\", \"color\": [" << intensity << ", " << intensity << ", " << intensity
+                      << "], \"direction\": [-0.3, -1, -0.5]}]}";
+            } else {
+                m_out << "{\"translate\": [" << 4.0f * unit(m_rng) - 2.0f << ", " << 1.5f + unit(m_rng) << ", " << 4.0f * unit(m_rng) - 2.0f
+                      << "], \"lights\": [{\"type\": \"point\", \"color\": [" << intensity << ", " << intensity << ", " << intensity
+                      << "], \"attenuationCoeff\": [1, 0.2, 0.1]}]}";
+            }
+        }
+    }
+
+    // Template "level<level>", made of eight half-size copies of the level below
+    void instanceLevel(int level) {
+        m_out << ",\n{\"name\": \"level" << level << "\", \"groups\": [";
+        for (int i = 0; i < 8; i++) {
+            m_out << (i ? ", " : "") << "{\"translate\": [" << (i & 1 ? 0.5 : -0.5) << ", " << (i & 2 ? 0.5 : -0.5) << ", " << (i & 4 ? 0.5 : -0.5)
+                  << "], \"scale\": [0.5, 0.5, 0.5], \"groups\": [{\"name\": \"level" << level - 1 << "\"}]}";
+        }
+        m_out << "]}";
+    }
+
+private:
+    const SceneGeneratorOptions &m_options;
+    std::ostream &m_out;
+    std::string m_textureFile;
+    std::mt19937 m_rng;
+};
+
+}
+
+bool generateScene(const SceneGeneratorOptions &options, const std::string &path, int &shapeCount) {
+    std::filesystem::path scenePath(path);
+    // Texture paths are resolved against the parent of the scene's directory
+    std::filesystem::path directory = scenePath.has_parent_path() ? scenePath.parent_path() : std::filesystem::path(".");
+    std::string textureFile = (std::filesystem::absolute(directory).filename() / kTextureName).generic_string();
+    if (options.textured > 0.0 && !writeTexture(directory / kTextureName)) {
+        return false;
+    }
+
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    Writer writer(options, out, textureFile);
+    int depth = std::max(0, options.instancingDepth);
+    int copies = 1 << (3 * depth);
+    int leafShapes = std::max(1, int(std::lround(double(options.shapes) / copies)));
+    shapeCount = leafShapes * copies;
+
+    out << "{\n\"name\": \"generated\",\n"
+        << "\"globalData\": {\"ambientCoeff\": 0.5, \"diffuseCoeff\": 0.5, \"specularCoeff\": 0.5},\n"
+        << "\"cameraData\": {\"position\": [0.5, 1.5, 4], \"up\": [0, 1, 0], \"focus\": [0, 0, 0], \"heightAngle\": 40},\n";
+    if (depth > 0) {
+        out << "\"templateGroups\": [\n{\"name\": \"level0\", \"groups\": [";
+        writer.shapes(leafShapes);
+        out << "]}";
+        for (int level = 1; level <= depth; level++) {
+            writer.instanceLevel(level);
+        }
+        out << "\n],\n\"groups\": [\n{\"name\": \"level" << depth << "\"}";
+    } else {
+        out << "\"groups\": [";
+        writer.shapes(leafShapes);
+    }
+    if (options.lights > 0) {
+        out << ",";
+        writer.lights();
+    }
+    out << "\n]\n}\n";
+    return bool(out);
+}
+
+void addGeneratorOptions(QCommandLineParser &parser) {
+    parser.addOption(QCommandLineOption("lights", "Number of lights.", "count", "4"));
+    parser.addOption(QCommandLineOption("mix", "Relative frequency of each primitive type.", "type=weight,...",
+                                        "cube=1,sphere=1,cylinder=1,cone=1"));
+    parser.addOption(QCommandLineOption("textured", "Fraction of shapes with a texture.", "fraction", "0"));
+    parser.addOption(QCommandLineOption("reflective", "Fraction of reflective shapes.", "fraction", "0"));
+    parser.addOption(QCommandLineOption("instancing-depth", "Levels of template groups.", "depth", "0"));
+    parser.addOption(QCommandLineOption("seed", "Random seed.", "seed", "1"));
+}
+
+bool readGeneratorOptions(const QCommandLineParser &parser, SceneGeneratorOptions &options) {
+    options.lights = parser.value("lights").toInt();
+    options.textured = parser.value("textured").toDouble();
+    options.reflective = parser.value("reflective").toDouble();
+    options.instancingDepth = parser.value("instancing-depth").toInt();
+    options.seed = parser.value("seed").toUInt();
+    if (options.lights < 0 || options.instancingDepth < 0 || options.instancingDepth > 6) {
+        std::cerr << "--lights must not be negative, and --instancing-depth must be between 0 and 6" << std::endl;
+        return false;
+    }
+
+    options.cubes = options.spheres = options.cylinders = options.cones = 0.0;
+    for (const QString &entry : parser.value("mix").split(",")) {
+        QStringList parts = entry.split("=");
+        bool ok = parts.size() == 2;
+        double weight = ok ? parts[1].toDouble(&ok) : 0.0;
+        double *field = nullptr;
+        if (ok && parts[0] == "cube") {
+            field = &options.cubes;
+        } else if (ok && parts[0] == "sphere") {
+            field = &options.spheres;
+        } else if (ok && parts[0] == "cylinder") {
+            field = &options.cylinders;
+        } else if (ok && parts[0] == "cone") {
+            field = &options.cones;
+        }
+        if (!field || weight < 0.0) {
+            std::cerr << "invalid --mix entry \"" << entry.toStdString() << "\"" << std::endl;
+            return false;
+        }
+        *field = weight;
+    }
+    if (options.cubes + options.spheres + options.cylinders + options.cones <= 0.0) {
+        std::cerr << "--mix must give some primitive type a positive weight" << std::endl;
+        return false;
+    }
+    return true;
+}
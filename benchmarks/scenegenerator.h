@@ -0,0 +1,36 @@
+#pragma once
+
+#include <QCommandLineParser>
+
+#include <string>
+
+// Options for generateScene(). Shapes fill the cube [-1, 1]^3, which the camera looks at.
+struct SceneGeneratorOptions {
+    int shapes = 1000;
+    int lights = 4;             // One directional light; the rest are point lights above the shapes
+    // Relative frequency of each primitive type
+    double cubes = 1.0;
+    double spheres = 1.0;
+    double cylinders = 1.0;
+    double cones = 1.0;
+    double textured = 0.0;      // Fraction of shapes with a checkerboard texture
+    double reflective = 0.0;    // Fraction of shapes with a reflective material
+    // Levels of template groups. At depth d, a leaf template of shapes / 8^d shapes is
+    // instanced through d levels of templates of eight scaled copies of the level below.
+    int instancingDepth = 0;
+    unsigned seed = 1;
+};
+
+// Writes a scene in the scene file format to `path`, and the texture it uses next to it.
+// The same options always produce the same scene.
+// @param shapeCount Set to the number of shapes in the flattened scene, which is rounded
+//                   to a multiple of 8^instancingDepth.
+// @return False if a file could not be written.
+bool generateScene(const SceneGeneratorOptions &options, const std::string &path, int &shapeCount);
+
+// Adds command-line options for every field of SceneGeneratorOptions except `shapes`:
+// --lights, --mix (e.g. "cube=2,sphere=1"), --textured, --reflective, --instancing-depth, --seed
+void addGeneratorOptions(QCommandLineParser &parser);
+// Reads the options added by addGeneratorOptions().
+// @return False, after printing why, if a value is invalid.
+bool readGeneratorOptions(const QCommandLineParser &parser, SceneGeneratorOptions &options);
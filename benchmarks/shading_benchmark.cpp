@@ -0,0 +1,160 @@
+// Checks and times the fast-math shading kernels, and compares renders made with and without them.
+//
+// Without arguments, every function in utils/fastmath.h is compared against libm over its
+// domain, and timed against the exact call the renderer makes otherwise. The process fails if
+// any function exceeds its documented error bound:
+//     shading_benchmark
+//
+// To check whole images, render the same config with a build configured with -DRAY_FAST_MATH=ON
+// and one without, then compare them. The process fails if the PSNR is below --min-psnr:
+//     shading_benchmark --compare exact.png fast.png --min-psnr 40
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QImage>
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "imagecompare.h"
+#include "utils/fastmath.h"
+
+namespace {
+
+// Time per call in nanoseconds, over inputs generated beforehand
+template <typename F>
+double nanosecondsPerCall(F f, const std::vector<float> &x, const std::vector<float> &y) {
+    QElapsedTimer timer;
+    timer.start();
+    float sum = 0.0f;
+    for (size_t i = 0; i < x.size(); i++) {
+        sum += f(x[i], y[i]);
+    }
+    double nanoseconds = double(timer.nsecsElapsed()) / x.size();
+    volatile float sink = sum; // Keeps the loop from being optimized away
+    (void)sink;
+    return nanoseconds;
+}
+
+// Measures the largest error of `fast` against `reference` on inputs drawn by `input`, and times
+// it against `exact`, the call the renderer makes without RAY_FAST_MATH. Prints one JSON line.
+// @param bound    The documented error bound, relative to the result if `relative` is set.
+// @return         Whether the error stays within the bound.
+template <typename Reference, typename Fast, typename Exact, typename Input>
+bool checkKernel(const char *name, double bound, bool relative, int samples,
+                 Reference reference, Fast fast, Exact exact, Input input) {
+    std::mt19937 rng(1230);
+    std::vector<float> x(samples), y(samples, 0.0f);
+    double maxError = 0.0;
+    for (int i = 0; i < samples; i++) {
+        input(rng, x[i], y[i]);
+        double expected = reference(x[i], y[i]);
+        double error = std::fabs(fast(x[i], y[i]) - expected);
+        if (relative) {
+            error /= std::fabs(expected);
+        }
+        maxError = std::max(maxError, error);
+    }
+    double exactNs = nanosecondsPerCall(exact, x, y);
+    double fastNs = nanosecondsPerCall(fast, x, y);
+    bool pass = maxError <= bound;
+
+    std::cout << "{\"kernel\": \"" << name << "\""
+              << ", \"max_" << (relative ? "relative" : "absolute") << "_error\": " << maxError
+              << ", \"bound\": " << bound
+              << ", \"pass\": " << (pass ? "true" : "false")
+              << ", \"exact_ns\": " << exactNs
+              << ", \"fast_ns\": " << fastNs
+              << ", \"speedup\": " << exactNs / fastNs << "}" << std::endl;
+    return pass;
+}
+
+int runKernels(int samples) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    bool pass = true;
+    // Specular terms: a cosine in [0, 1] raised to a shininess, kept to visible results
+    pass &= checkKernel("pow", 2e-6, true, samples,
+        [](float x, float y) { return std::pow(double(x), double(y)); },
+        [](float x, float y) { return fastmath::pow(x, y); },
+        [](float x, float y) { return float(pow(x, y)); },
+        [&](std::mt19937 &rng, float &x, float &y) {
+            do {
+                x = unit(rng);
+                y = 1.0f + 99.0f * unit(rng);
+            } while (x == 0.0f || std::fabs(y * std::log2(x)) > 8.0f);
+        });
+    pass &= checkKernel("acos", 5e-7, false, samples,
+        [](float x, float) { return std::acos(double(x)); },
+        [](float x, float) { return fastmath::acos(x); },
+        [](float x, float) { return float(acos(std::fmin(std::fmax(x, -1.0), 1.0))); },
+        [&](std::mt19937 &rng, float &x, float &) { x = 2.0f * unit(rng) - 1.0f; });
+    pass &= checkKernel("asin", 5e-7, false, samples,
+        [](float x, float) { return std::asin(double(x)); },
+        [](float x, float) { return fastmath::asin(x); },
+        [](float x, float) { return float(asin(x)); },
+        [&](std::mt19937 &rng, float &x, float &) { x = 2.0f * unit(rng) - 1.0f; });
+    pass &= checkKernel("atan2", 4e-7, false, samples,
+        [](float y, float x) { return std::atan2(double(y), double(x)); },
+        [](float y, float x) { return fastmath::atan2(y, x); },
+        [](float y, float x) { return float(atan2(y, x)); },
+        [&](std::mt19937 &rng, float &y, float &x) {
+            y = unit(rng) - 0.5f;
+            x = unit(rng) - 0.5f;
+        });
+    pass &= checkKernel("cos", 3e-7, false, samples,
+        [](float x, float) { return std::cos(double(x)); },
+        [](float x, float) { return fastmath::cos(x); },
+        [](float x, float) { return float(cos(x)); },
+        [&](std::mt19937 &rng, float &x, float &) { x = fastmath::kPi * (2.0f * unit(rng) - 1.0f); });
+    return pass ? 0 : 1;
+}
+
+int compareRenders(const QString &exactPath, const QString &fastPath, double minPsnr) {
+    QImage exact(exactPath);
+    QImage fast(fastPath);
+    if (exact.isNull() || fast.isNull()) {
+        std::cerr << "could not load " << (exact.isNull() ? exactPath : fastPath).toStdString() << std::endl;
+        return 1;
+    }
+    ImageDifference difference;
+    if (!compareImages(exact, fast, difference)) {
+        std::cerr << "images differ in size" << std::endl;
+        return 1;
+    }
+    bool pass = difference.psnr >= minPsnr;
+
+    std::cout << "{\"max_difference\": " << difference.maxDifference
+              << ", \"differing_pixels\": " << difference.differingPixels
+              << ", \"psnr\": " << (std::isinf(difference.psnr) ? std::string("\"inf\"") : std::to_string(difference.psnr))
+              << ", \"min_psnr\": " << minPsnr
+              << ", \"pass\": " << (pass ? "true" : "false") << "}" << std::endl;
+    return pass ? 0 : 1;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addPositionalArgument("images", "With --compare: the exact and the fast-math render.");
+    parser.addOption(QCommandLineOption("compare", "Compare two renders instead of checking the kernels."));
+    parser.addOption(QCommandLineOption("min-psnr", "Lowest acceptable PSNR in dB for --compare.", "dB", "40"));
+    parser.addOption(QCommandLineOption("samples", "Inputs per kernel.", "count", "1000000"));
+    parser.process(a);
+
+    if (parser.isSet("compare")) {
+        const QStringList images = parser.positionalArguments();
+        if (images.size() != 2) {
+            std::cerr << "--compare needs two images" << std::endl;
+            return 1;
+        }
+        return compareRenders(images[0], images[1], parser.value("min-psnr").toDouble());
+    }
+    return runKernels(parser.value("samples").toInt());
+}
@@ -0,0 +1,213 @@
+#include "camerapath.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <glm/gtx/transform.hpp>
+
+namespace {
+
+// Reads a 3-element array field into `out`, keeping `out.w` untouched.
+bool readVec3(const QJsonObject &object, const QString &field, glm::vec4 &out) {
+    if (!object[field].isArray()) {
+        std::cout << "keyframe " << field.toStdString() << " must be of type array" << std::endl;
+        return false;
+    }
+    QJsonArray array = object[field].toArray();
+    if (array.size() != 3 || !array[0].isDouble() || !array[1].isDouble() || !array[2].isDouble()) {
+        std::cout << "keyframe " << field.toStdString() << " must contain 3 floating-point values" << std::endl;
+        return false;
+    }
+    out.x = array[0].toDouble();
+    out.y = array[1].toDouble();
+    out.z = array[2].toDouble();
+    return true;
+}
+
+// Interpolates two directions by angle-agnostic normalized lerp, blending their lengths separately
+// so that look vectors keep their focus distance.
+glm::vec4 blendDirection(const glm::vec4 &a, const glm::vec4 &b, float s) {
+    float lengthA = glm::length(glm::vec3(a));
+    float lengthB = glm::length(glm::vec3(b));
+    if (lengthA == 0.f || lengthB == 0.f) {
+        return glm::mix(a, b, s);
+    }
+    glm::vec3 dir = glm::mix(glm::vec3(a) / lengthA, glm::vec3(b) / lengthB, s);
+    if (glm::length(dir) < 1e-6f) {
+        return s < 0.5f ? a : b;
+    }
+    return glm::vec4(glm::normalize(dir) * glm::mix(lengthA, lengthB, s), 0.f);
+}
+
+glm::vec4 catmullRom(const glm::vec4 &p0, const glm::vec4 &p1, const glm::vec4 &p2, const glm::vec4 &p3, float s) {
+    float s2 = s * s;
+    float s3 = s2 * s;
+    return 0.5f * ((2.f * p1) + (-p0 + p2) * s + (2.f * p0 - 5.f * p1 + 4.f * p2 - p3) * s2 + (-p0 + 3.f * p1 - 3.f * p2 + p3) * s3);
+}
+
+}
+
+bool CameraPath::load(const std::string &filepath, const SceneCameraData &base) {
+    QFile file(QString::fromStdString(filepath));
+    if (!file.open(QFile::ReadOnly)) {
+        std::cout << "could not open " << filepath << std::endl;
+        return false;
+    }
+
+    QJsonParseError jsonError;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &jsonError);
+    file.close();
+    if (doc.isNull() || !doc.isObject()) {
+        std::cout << "could not parse camera path " << filepath << std::endl;
+        return false;
+    }
+
+    QJsonObject path = doc.object();
+    if (path.contains("interpolation")) {
+        QString interpolation = path["interpolation"].toString();
+        if (interpolation == "linear") {
+            m_interpolation = Interpolation::INTERPOLATION_LINEAR;
+        }
+        else if (interpolation == "smooth") {
+            m_interpolation = Interpolation::INTERPOLATION_SMOOTH;
+        }
+        else {
+            std::cout << "unknown camera path interpolation \"" << interpolation.toStdString() << "\"" << std::endl;
+            return false;
+        }
+    }
+
+    if (!path["keyframes"].isArray() || path["keyframes"].toArray().isEmpty()) {
+        std::cout << "camera path must contain a non-empty \"keyframes\" array" << std::endl;
+        return false;
+    }
+
+    m_keyframes.clear();
+    for (auto value : path["keyframes"].toArray()) {
+        if (!value.isObject()) {
+            std::cout << "keyframes must be of type object" << std::endl;
+            return false;
+        }
+        QJsonObject keyframe = value.toObject();
+        if (!keyframe["time"].isDouble()) {
+            std::cout << "keyframe must contain a floating-point \"time\"" << std::endl;
+            return false;
+        }
+        if (keyframe.contains("look") && keyframe.contains("focus")) {
+            std::cout << "keyframe cannot contain both \"look\" and \"focus\"" << std::endl;
+            return false;
+        }
+
+        SceneCameraData camera = base;
+        if (keyframe.contains("position") && !readVec3(keyframe, "position", camera.pos)) {
+            return false;
+        }
+        if (keyframe.contains("up") && !readVec3(keyframe, "up", camera.up)) {
+            return false;
+        }
+        if (keyframe.contains("look") && !readVec3(keyframe, "look", camera.look)) {
+            return false;
+        }
+        if (keyframe.contains("focus")) {
+            glm::vec4 focus = camera.pos;
+            if (!readVec3(keyframe, "focus", focus)) {
+                return false;
+            }
+            camera.look = glm::vec4(glm::vec3(focus - camera.pos), 0.f);
+        }
+        if (keyframe.contains("heightAngle")) {
+            if (!keyframe["heightAngle"].isDouble()) {
+                std::cout << "keyframe heightAngle must be a floating-point value" << std::endl;
+                return false;
+            }
+            camera.heightAngle = keyframe["heightAngle"].toDouble() * M_PI / 180.f;
+        }
+        addKeyframe(keyframe["time"].toDouble(), camera);
+    }
+
+    return true;
+}
+
+CameraPath CameraPath::turntable(const SceneCameraData &camera, int frames, float degrees) {
+    CameraPath path;
+    path.m_closed = true;
+
+    glm::vec4 center = camera.pos + glm::vec4(glm::vec3(camera.look), 0.f);
+    glm::vec4 offset = camera.pos - center;
+    frames = std::max(frames, 1);
+    for (int i = 0; i <= frames; i++) {
+        float angle = glm::radians(degrees) * i / frames;
+        SceneCameraData keyframe = camera;
+        keyframe.pos = center + glm::rotate(angle, glm::vec3(0, 1, 0)) * offset;
+        keyframe.look = glm::vec4(glm::vec3(center - keyframe.pos), 0.f);
+        path.addKeyframe(i, keyframe);
+    }
+    return path;
+}
+
+void CameraPath::addKeyframe(float time, const SceneCameraData &camera) {
+    Keyframe keyframe{time, camera};
+    auto position = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), time,
+                                     [](float t, const Keyframe &k) { return t < k.time; });
+    m_keyframes.insert(position, keyframe);
+}
+
+void CameraPath::setInterpolation(Interpolation interpolation) {
+    m_interpolation = interpolation;
+}
+
+bool CameraPath::empty() const {
+    return m_keyframes.empty();
+}
+
+float CameraPath::frameTime(int frame, int frames) const {
+    if (m_keyframes.empty()) {
+        return 0.f;
+    }
+    float start = m_keyframes.front().time;
+    float end = m_keyframes.back().time;
+    int steps = m_closed ? frames : frames - 1;
+    if (steps <= 0) {
+        return start;
+    }
+    return start + (end - start) * frame / steps;
+}
+
+SceneCameraData CameraPath::sample(float time) const {
+    if (time <= m_keyframes.front().time) {
+        return m_keyframes.front().camera;
+    }
+    if (time >= m_keyframes.back().time) {
+        return m_keyframes.back().camera;
+    }
+
+    // Index of the first keyframe after `time`; the segment is [i - 1, i]
+    size_t i = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), time,
+                                [](float t, const Keyframe &k) { return t < k.time; }) - m_keyframes.begin();
+    const Keyframe &k1 = m_keyframes[i - 1];
+    const Keyframe &k2 = m_keyframes[i];
+    float span = k2.time - k1.time;
+    float s = span > 0.f ? (time - k1.time) / span : 0.f;
+
+    SceneCameraData camera = k1.camera;
+    if (m_interpolation == Interpolation::INTERPOLATION_SMOOTH) {
+        const Keyframe &k0 = m_keyframes[i >= 2 ? i - 2 : i - 1];
+        const Keyframe &k3 = m_keyframes[i + 1 < m_keyframes.size() ? i + 1 : i];
+        camera.pos = catmullRom(k0.camera.pos, k1.camera.pos, k2.camera.pos, k3.camera.pos, s);
+    }
+    else {
+        camera.pos = glm::mix(k1.camera.pos, k2.camera.pos, s);
+    }
+    camera.pos.w = 1.f;
+    camera.look = blendDirection(k1.camera.look, k2.camera.look, s);
+    camera.up = blendDirection(k1.camera.up, k2.camera.up, s);
+    camera.heightAngle = glm::mix(k1.camera.heightAngle, k2.camera.heightAngle, s);
+    camera.aperture = glm::mix(k1.camera.aperture, k2.camera.aperture, s);
+    camera.focalLength = glm::mix(k1.camera.focalLength, k2.camera.focalLength, s);
+    return camera;
+}
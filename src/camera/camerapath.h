@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include "utils/scenedata.h"
+
+// A keyframed camera path, used to render animated sequences (flythroughs, turntables)
+// of a static scene in a single process.
+
+class CameraPath {
+public:
+    enum class Interpolation {
+        INTERPOLATION_LINEAR,
+        INTERPOLATION_SMOOTH // Catmull-Rom through the keyframe positions
+    };
+
+    struct Keyframe {
+        float time;
+        SceneCameraData camera;
+    };
+
+    // Loads a camera path from a JSON file of the form
+    // { "interpolation": "linear" | "smooth",
+    //   "keyframes": [ { "time": 0, "position": [x, y, z], "look": [x, y, z] | "focus": [x, y, z],
+    //                    "up": [x, y, z], "heightAngle": degrees }, ... ] }
+    // Fields missing from a keyframe are taken from `base` (usually the scene's camera).
+    // @return False if the file could not be read or is invalid.
+    bool load(const std::string &filepath, const SceneCameraData &base);
+
+    // Builds a path orbiting the point the camera looks at around the world up axis.
+    // One keyframe is generated per frame, so sampling at frameTime(i, frames) is exact.
+    static CameraPath turntable(const SceneCameraData &camera, int frames, float degrees);
+
+    void addKeyframe(float time, const SceneCameraData &camera);
+    void setInterpolation(Interpolation interpolation);
+
+    bool empty() const;
+
+    // The time of frame `frame` out of `frames`, spread evenly over the keyframes' time span.
+    float frameTime(int frame, int frames) const;
+
+    // Returns the interpolated camera at `time`; clamps to the first/last keyframe.
+    SceneCameraData sample(float time) const;
+
+private:
+    std::vector<Keyframe> m_keyframes;
+    Interpolation m_interpolation = Interpolation::INTERPOLATION_LINEAR;
+    bool m_closed = false; // Last frame wraps back onto the first (turntables)
+};
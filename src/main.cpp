@@ -2,12 +2,133 @@
 #include <QCommandLineParser>
 #include <QImage>
 #include <QtCore>
+#include <QtConcurrent>
 
 #include <iostream>
+#include "utils/heatmap.h"
 #include "utils/sceneparser.h"
+#include "utils/tracing.h"
+#include "camera/camerapath.h"
 #include "raytracer/raytracer.h"
 #include "raytracer/raytracescene.h"
 
+// Saves a rendered image, falling back to PNG when the format cannot be deduced from the path
+bool saveImage(const QImage &image, const QString &path) {
+    TraceScope scope("io", "QImage::save");
+    scope.addArg("file", path.toStdString());
+    bool success = image.save(path);
+    if (!success) {
+        success = image.save(path, "PNG");
+    }
+    if (success) {
+        std::cout << "Saved rendered image to \"" << path.toStdString() << "\"" << std::endl;
+    } else {
+        std::cerr << "Error: failed to save image to \"" << path.toStdString() << "\"" << std::endl;
+    }
+    return success;
+}
+
+// Prints the render statistics requested with Settings/print-stats, as a table or, with
+// Settings/stats-format = json, as JSON
+void printStats(QSettings &settings, const RayTracer &raytracer, double parseSeconds, double saveSeconds) {
+    RenderTimings timings = raytracer.timings();
+    timings.parse = parseSeconds;
+    timings.save = saveSeconds;
+    if (settings.value("Settings/stats-format").toString() == "json") {
+        printStatsJson(std::cout, raytracer.counters(), timings, raytracer.accelerationStats());
+    } else {
+        printStatsTable(std::cout, raytracer.counters(), timings, raytracer.accelerationStats());
+    }
+}
+
+// Renders `frames` frames along a camera path in this process. The scene is compiled once,
+// and saving frame N runs on a worker thread while frame N + 1 renders into the other buffer.
+// The time spent saving, summed over frames, is added to `saveSeconds`.
+bool renderSequence(QSettings &settings, RayTracer &raytracer, const RayTraceScene &rtScene, int frames, double &saveSeconds) {
+    const SceneCameraData &sceneCamera = rtScene.getMetaData().cameraData;
+
+    CameraPath path;
+    if (settings.value("Sequence/turntable").toBool()) {
+        path = CameraPath::turntable(sceneCamera, frames, settings.value("Sequence/degrees", 360.0).toFloat());
+    } else {
+        QString pathFile = settings.value("Sequence/camera-path").toString();
+        if (pathFile.isEmpty() || !path.load(pathFile.toStdString(), sceneCamera)) {
+            std::cerr << "Error loading camera path: \"" << pathFile.toStdString() << "\"" << std::endl;
+            return false;
+        }
+    }
+
+    // %1 in the output pattern is replaced by the zero-padded frame number
+    QString outputPattern = settings.value("Sequence/output").toString();
+    if (!outputPattern.contains("%1")) {
+        std::cerr << "Error: Sequence/output must contain %1 for the frame number" << std::endl;
+        return false;
+    }
+
+    raytracer.prepare(rtScene);
+
+    QImage images[2];
+    QFuture<bool> saves[2];
+    double saveTimes[2] = {0.0, 0.0};
+    bool success = true;
+    for (int frame = 0; frame < frames; frame++) {
+        int buffer = frame % 2;
+        if (saves[buffer].isValid()) {
+            success = saves[buffer].result() && success;
+            saveSeconds += saveTimes[buffer];
+        }
+        if (images[buffer].isNull()) {
+            images[buffer] = QImage(rtScene.width(), rtScene.height(), QImage::Format_RGBX8888);
+        }
+        images[buffer].fill(Qt::black);
+        RGBA *data = reinterpret_cast<RGBA *>(images[buffer].bits());
+
+        raytracer.renderFrame(data, rtScene, path.sample(path.frameTime(frame, frames)));
+
+        QString framePath = outputPattern.arg(frame, 4, 10, QChar('0'));
+        const QImage *image = &images[buffer];
+        double *saveTime = &saveTimes[buffer];
+        saves[buffer] = QtConcurrent::run([image, framePath, saveTime]() {
+            QElapsedTimer timer;
+            timer.start();
+            bool saved = saveImage(*image, framePath);
+            *saveTime = timer.nsecsElapsed() * 1e-9;
+            return saved;
+        });
+    }
+    for (int buffer = 0; buffer < 2; buffer++) {
+        if (saves[buffer].isValid()) {
+            success = saves[buffer].result() && success;
+            saveSeconds += saveTimes[buffer];
+        }
+    }
+    return success;
+}
+
+// Saves the raytracer's cost map as a false-colour image at `path`, and unscaled next to it
+// with the suffix .pfm
+bool saveHeatmap(const RayTracer &raytracer, int width, int height, const QString &path) {
+    bool success = saveImage(heatmapImage(raytracer.costMap(), width, height), path);
+    QFileInfo info(path);
+    QString pfmPath = QDir(info.path()).filePath(info.completeBaseName() + ".pfm");
+    if (savePfm(raytracer.costMap(), width, height, pfmPath.toStdString())) {
+        std::cout << "Saved raw costs to \"" << pfmPath.toStdString() << "\"" << std::endl;
+    } else {
+        std::cerr << "Error: failed to save raw costs to \"" << pfmPath.toStdString() << "\"" << std::endl;
+        success = false;
+    }
+    return success;
+}
+
+// Writes the timeline recorded since Tracer::start()
+void saveTrace(const QString &path) {
+    if (Tracer::save(path.toStdString())) {
+        std::cout << "Saved trace to \"" << path.toStdString() << "\"" << std::endl;
+    } else {
+        std::cerr << "Error: failed to save trace to \"" << path.toStdString() << "\"" << std::endl;
+    }
+}
+
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
@@ -27,9 +148,21 @@ int main(int argc, char *argv[])
     QSettings settings( positionalArgs[0], QSettings::IniFormat );
     QString iScenePath = settings.value("IO/scene").toString();
     QString oImagePath = settings.value("IO/output").toString();
+    QString iCachePath = settings.value("IO/scene-cache").toString();
+    QString oHeatmapPath = settings.value("IO/heatmap").toString();
+    QString oTracePath = settings.value("IO/trace").toString();
+    bool streamingParser = settings.value("Settings/streaming-parser").toBool();
+
+    if (!oTracePath.isEmpty()) {
+        Tracer::start();
+    }
 
     RenderData metaData;
-    bool success = SceneParser::parse(iScenePath.toStdString(), metaData);
+    QElapsedTimer parseTimer;
+    parseTimer.start();
+    bool success = iCachePath.isEmpty() ? SceneParser::parse(iScenePath.toStdString(), metaData, streamingParser)
+                                        : SceneParser::parse(iScenePath.toStdString(), iCachePath.toStdString(), metaData, streamingParser);
+    double parseSeconds = parseTimer.nsecsElapsed() * 1e-9;
 
     if (!success) {
         std::cerr << "Error loading scene: \"" << iScenePath.toStdString() << "\"" << std::endl;
@@ -60,24 +193,87 @@ int main(int argc, char *argv[])
     rtConfig.enableDepthOfField  = settings.value("Feature/depthoffield").toBool();
     rtConfig.maxRecursiveDepth   = settings.value("Settings/maximum-recursive-depth").toInt();
     rtConfig.onlyRenderNormals   = settings.value("Settings/only-render-normals").toBool();
+    rtConfig.enableWavefront     = settings.value("Settings/wavefront").toBool();
+    rtConfig.lightCullThreshold  = settings.value("Settings/light-cull-threshold", 0.0).toFloat();
+    rtConfig.lightSamples        = settings.value("Settings/light-samples", 0).toInt();
+    rtConfig.lightSampleSeed     = settings.value("Settings/light-sample-seed", 0).toUInt();
+
+    QString shadowMode = settings.value("Settings/shadow-mode", "hard").toString();
+    if (shadowMode == "none") {
+        rtConfig.shadowMode = ShadowMode::SHADOW_NONE;
+    } else if (shadowMode == "hard") {
+        rtConfig.shadowMode = ShadowMode::SHADOW_HARD;
+    } else if (shadowMode == "cached") {
+        rtConfig.shadowMode = ShadowMode::SHADOW_CACHED;
+    } else {
+        std::cerr << "Error: unknown Settings/shadow-mode \"" << shadowMode.toStdString()
+                  << "\" (expected none, hard or cached)" << std::endl;
+        a.exit(1);
+        return 1;
+    }
+
+    QString accelerationStructure = settings.value("Settings/acceleration-structure", "bvh").toString();
+    if (!parseAccelerationStructure(accelerationStructure.toStdString(), rtConfig.accelerationStructure)) {
+        std::cerr << "Error: unknown Settings/acceleration-structure \"" << accelerationStructure.toStdString()
+                  << "\" (expected bvh, bvh4, lbvh, grid or two-level-grid)" << std::endl;
+        a.exit(1);
+        return 1;
+    }
+
+    int frames = settings.value("Sequence/frames", 0).toInt();
+    if (!oHeatmapPath.isEmpty() && frames > 0) {
+        std::cerr << "Warning: IO/heatmap is ignored for sequences" << std::endl;
+    } else if (!oHeatmapPath.isEmpty()) {
+        QString metric = settings.value("Settings/heatmap-metric", "tests").toString();
+        if (metric == "tests") {
+            rtConfig.costMetric = CostMetric::COST_TESTS;
+        } else if (metric == "rays") {
+            rtConfig.costMetric = CostMetric::COST_RAYS;
+        } else if (metric == "time") {
+            rtConfig.costMetric = CostMetric::COST_TIME;
+        } else {
+            std::cerr << "Error: unknown Settings/heatmap-metric \"" << metric.toStdString()
+                      << "\" (expected tests, rays or time)" << std::endl;
+            a.exit(1);
+            return 1;
+        }
+    }
+
+    bool printStatistics = settings.value("Settings/print-stats").toBool();
 
     RayTracer raytracer{ rtConfig };
 
     RayTraceScene rtScene{ width, height, metaData };
 
+    if (frames > 0) {
+        double saveSeconds = 0.0;
+        success = renderSequence(settings, raytracer, rtScene, frames, saveSeconds);
+        if (printStatistics) {
+            printStats(settings, raytracer, parseSeconds, saveSeconds);
+        }
+        if (!oTracePath.isEmpty()) {
+            saveTrace(oTracePath);
+        }
+        a.exit(success ? 0 : 1);
+        return success ? 0 : 1;
+    }
+
     // Note that we're passing `data` as a pointer (to its first element)
     // Recall from Lab 1 that you can access its elements like this: `data[i]`
     raytracer.render(data, rtScene);
 
     // Saving the image
-    success = image.save(oImagePath);
-    if (!success) {
-        success = image.save(oImagePath, "PNG");
+    QElapsedTimer saveTimer;
+    saveTimer.start();
+    saveImage(image, oImagePath);
+    if (!oHeatmapPath.isEmpty()) {
+        saveHeatmap(raytracer, width, height, oHeatmapPath);
     }
-    if (success) {
-        std::cout << "Saved rendered image to \"" << oImagePath.toStdString() << "\"" << std::endl;
-    } else {
-        std::cerr << "Error: failed to save image to \"" << oImagePath.toStdString() << "\"" << std::endl;
+    if (printStatistics) {
+        printStats(settings, raytracer, parseSeconds, saveTimer.nsecsElapsed() * 1e-9);
+    }
+    if (!oTracePath.isEmpty()) {
+        saveTrace(oTracePath);
     }
 
     a.exit();
@@ -0,0 +1,128 @@
+#include "accelerator.h"
+#include "bvh.h"
+#include "grid.h"
+#include "widebvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+bool Bounds::clip(const glm::vec3 &origin, const glm::vec3 &invDir, float &tEnter, float &tExit) const {
+    if (empty()) {
+        return false;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        if (std::isinf(invDir[axis])) {
+            // Parallel to the slab: inside it everywhere or nowhere
+            if (origin[axis] < min[axis] || origin[axis] > max[axis]) {
+                return false;
+            }
+            continue;
+        }
+        float t0 = (min[axis] - origin[axis]) * invDir[axis];
+        float t1 = (max[axis] - origin[axis]) * invDir[axis];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        tEnter = std::max(tEnter, t0);
+        tExit = std::min(tExit, t1);
+        if (tEnter > tExit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Bounds shapeBounds(const RenderShapeData &shape) {
+    const float half = 0.5f + 1e-4f;
+    Bounds bounds;
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec4 p(corner & 1 ? half : -half, corner & 2 ? half : -half, corner & 4 ? half : -half, 1.0f);
+        bounds.extend(glm::vec3(shape.ctm * p));
+    }
+    return bounds;
+}
+
+Bounds collectShapeBounds(const std::vector<RenderShapeData> &shapes, std::vector<Bounds> &bounds, std::vector<int> &indices) {
+    Bounds scene;
+    bounds.resize(shapes.size());
+    for (int s = 0; s < int(shapes.size()); s++) {
+        bounds[s] = shapeBounds(shapes[s]);
+        if (shapes[s].type != PrimitiveType::PRIMITIVE_MESH) {
+            scene.extend(bounds[s]);
+            indices.push_back(s);
+        }
+    }
+    if (scene.empty()) {
+        return scene;
+    }
+
+    glm::vec3 padding(boundsPadding(scene));
+    for (int s : indices) {
+        bounds[s].min -= padding;
+        bounds[s].max += padding;
+    }
+    scene.min -= padding;
+    scene.max += padding;
+    return scene;
+}
+
+float boundsPadding(const Bounds &scene) {
+    // Hit points are found in object space, so they can stray from the boxes by a few ulps of
+    // the scene's coordinates
+    glm::vec3 largest = glm::max(glm::abs(scene.min), glm::abs(scene.max));
+    return 1e-5f * std::max(1.0f, std::max(largest.x, std::max(largest.y, largest.z)));
+}
+
+const char *accelerationStructureName(AccelerationStructure structure) {
+    switch (structure) {
+    case AccelerationStructure::ACCEL_BVH:
+        return "bvh";
+    case AccelerationStructure::ACCEL_LBVH:
+        return "lbvh";
+    case AccelerationStructure::ACCEL_GRID:
+        return "grid";
+    case AccelerationStructure::ACCEL_TWO_LEVEL_GRID:
+        return "two-level-grid";
+    case AccelerationStructure::ACCEL_BVH4:
+        return "bvh4";
+    }
+    return "";
+}
+
+bool parseAccelerationStructure(const std::string &name, AccelerationStructure &structure) {
+    for (AccelerationStructure candidate : {AccelerationStructure::ACCEL_BVH, AccelerationStructure::ACCEL_BVH4,
+                                            AccelerationStructure::ACCEL_LBVH, AccelerationStructure::ACCEL_GRID,
+                                            AccelerationStructure::ACCEL_TWO_LEVEL_GRID}) {
+        if (name == accelerationStructureName(candidate)) {
+            structure = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<Accelerator> Accelerator::build(AccelerationStructure structure, const std::vector<RenderShapeData> &shapes,
+                                                bool parallel) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Accelerator> accelerator;
+    switch (structure) {
+    case AccelerationStructure::ACCEL_BVH:
+    case AccelerationStructure::ACCEL_LBVH:
+        accelerator = std::make_unique<BVH>(shapes, structure, parallel);
+        break;
+    case AccelerationStructure::ACCEL_BVH4:
+        accelerator = std::make_unique<WideBVH>(shapes, parallel);
+        break;
+    case AccelerationStructure::ACCEL_TWO_LEVEL_GRID:
+        accelerator = std::make_unique<TwoLevelGrid>(shapes);
+        break;
+    case AccelerationStructure::ACCEL_GRID:
+    default:
+        accelerator = std::make_unique<UniformGrid>(shapes);
+        break;
+    }
+    accelerator->m_stats.structure = accelerationStructureName(structure);
+    accelerator->m_stats.buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return accelerator;
+}
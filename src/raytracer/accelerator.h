@@ -0,0 +1,107 @@
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/renderstats.h"
+#include "utils/sceneparser.h"
+
+// Which spatial index finds the shapes a ray may hit, when acceleration is enabled
+enum class AccelerationStructure {
+    ACCEL_BVH,            // Bounding volume hierarchy built with the binned surface area heuristic
+    ACCEL_LBVH,           // Bounding volume hierarchy built from Morton codes; faster to build, slower to trace
+    ACCEL_GRID,           // Uniform grid
+    ACCEL_TWO_LEVEL_GRID, // Coarse grid whose crowded cells hold finer grids of their own
+    ACCEL_BVH4            // The SAH hierarchy collapsed to four children per node, with quantized boxes
+};
+
+// The name of `structure` in config files: bvh, bvh4, lbvh, grid or two-level-grid
+const char *accelerationStructureName(AccelerationStructure structure);
+// @return False if `name` is not the name of a structure.
+bool parseAccelerationStructure(const std::string &name, AccelerationStructure &structure);
+
+// An axis-aligned box; empty until it is extended
+struct Bounds {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+    void extend(const glm::vec3 &point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    void extend(const Bounds &bounds) {
+        min = glm::min(min, bounds.min);
+        max = glm::max(max, bounds.max);
+    }
+    bool empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+    glm::vec3 extent() const {
+        return empty() ? glm::vec3(0.0f) : max - min;
+    }
+    float surfaceArea() const {
+        glm::vec3 e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+    // Narrows [tEnter, tExit] to the part of the ray origin + t * dir inside the box.
+    // `invDir` is 1 / dir per component (infinite for zero components).
+    // @return False if none of it is inside.
+    bool clip(const glm::vec3 &origin, const glm::vec3 &invDir, float &tEnter, float &tExit) const;
+};
+
+// World bounds of `shape`: every primitive fits in the unit cube around its origin. The cube is
+// padded slightly, since intersect_cube() accepts hits up to 1e-5 outside it.
+Bounds shapeBounds(const RenderShapeData &shape);
+
+// Fills `bounds` (indexed like `shapes`) with the bounds of every shape, padded by
+// boundsPadding() of the scene, and `indices` with the shapes that are not meshes.
+// @return The bounds of those shapes.
+Bounds collectShapeBounds(const std::vector<RenderShapeData> &shapes, std::vector<Bounds> &bounds, std::vector<int> &indices);
+// How far to grow shape bounds in a scene with bounds `scene`, against rounding in the traversal
+float boundsPadding(const Bounds &scene);
+
+// Receives the shapes a traversal finds
+class ShapeVisitor {
+public:
+    // Tests `shape` against the ray, and returns how far along the ray shapes are still
+    // wanted: `tMax` to go on, a closer hit's t to narrow the search, or a negative value to stop.
+    virtual float visit(int shape, float tMax) = 0;
+
+protected:
+    ~ShapeVisitor() = default;
+};
+
+// A spatial index over the scene's shapes. Traversals only pick the shapes whose bounds the ray
+// may meet; the visitor runs the same exact intersection tests as an unaccelerated render, so
+// the image does not change.
+class Accelerator {
+public:
+    virtual ~Accelerator() = default;
+
+    // Visits every shape the ray origin + t * dir may hit for t in [0, tMax], each at most
+    // once and roughly front to back, until the visitor stops it or the rest of the ray lies
+    // beyond the tMax the visitor returned.
+    virtual void traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const = 0;
+
+    // Updates the structure after the ctms of the shapes in `changed` moved, without rebuilding
+    // it. Must not run during a traversal.
+    // @param shapes  Every shape, with its current ctm; the same shapes the structure was built over.
+    // @return False if the structure cannot be refitted, or has degraded too far to be worth
+    //         refitting; it should then be rebuilt.
+    virtual bool refit(const std::vector<RenderShapeData> &shapes, const std::vector<int> &changed) {
+        return false;
+    }
+
+    // Size, quality and build time of the structure
+    const AccelerationStats &stats() const { return m_stats; }
+
+    // Builds `structure` over `shapes`, on all cores if `parallel` is set and the structure
+    // supports it. Meshes are left out, since rays never hit them.
+    static std::unique_ptr<Accelerator> build(AccelerationStructure structure, const std::vector<RenderShapeData> &shapes,
+                                              bool parallel = false);
+
+protected:
+    AccelerationStats m_stats; // Filled in by each structure's constructor, and timed by build()
+};
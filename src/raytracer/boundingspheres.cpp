@@ -0,0 +1,64 @@
+#include "boundingspheres.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Distances from a ray to a sphere's centre are off by a few ulps of the distance from the ray
+// origin to the centre; a squared distance is accepted within this fraction of that squared
+const float kDistanceTolerance = 1e-9f;
+
+}
+
+BoundingSpheres::BoundingSpheres(const std::vector<RenderShapeData> &shapes) {
+    m_spheres.resize(shapes.size());
+    for (size_t s = 0; s < shapes.size(); s++) {
+        m_spheres[s] = boundingSphere(shapes[s]);
+    }
+    m_stats.references = m_spheres.size();
+}
+
+glm::vec4 BoundingSpheres::boundingSphere(const RenderShapeData &shape) {
+    if (shape.type == PrimitiveType::PRIMITIVE_MESH) {
+        return glm::vec4(0.0f, 0.0f, 0.0f, -std::numeric_limits<float>::infinity());
+    }
+    // The farthest points of the transformed cube from its centre are corners, and opposite
+    // corners are equally far; padded like shapeBounds()
+    const float half = 0.5f + 1e-4f;
+    float radius2 = 0.0f;
+    for (int corner = 0; corner < 4; corner++) {
+        glm::vec3 p(half, corner & 1 ? half : -half, corner & 2 ? half : -half);
+        glm::vec3 q = glm::mat3(shape.ctm) * p;
+        radius2 = std::max(radius2, glm::dot(q, q));
+    }
+    return glm::vec4(glm::vec3(shape.ctm[3]), radius2 * (1.0f + 1e-3f));
+}
+
+bool BoundingSpheres::refit(const std::vector<RenderShapeData> &shapes, const std::vector<int> &changed) {
+    for (int s : changed) {
+        m_spheres[s] = boundingSphere(shapes[s]);
+    }
+    return true;
+}
+
+void BoundingSpheres::traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const {
+    float dd = glm::dot(dir, dir);
+    int count = int(m_spheres.size());
+    for (int s = 0; s < count; s++) {
+        const glm::vec4 &sphere = m_spheres[s];
+        glm::vec3 toCentre = glm::vec3(sphere) - origin;
+        // The point of the ray in [0, tMax] nearest to the centre
+        float t = dd > 0.0f ? std::clamp(glm::dot(toCentre, dir) / dd, 0.0f, tMax) : 0.0f;
+        glm::vec3 offset = toCentre - t * dir;
+        float distance2 = glm::dot(offset, offset);
+        if (distance2 > sphere.w + kDistanceTolerance * glm::dot(toCentre, toCentre)) {
+            continue;
+        }
+        tMax = visitor.visit(s, tMax);
+        if (tMax < 0.0f) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+#include "accelerator.h"
+
+// Tests the shapes in index order, like the plain loop, but skips every shape whose bounding
+// sphere misses the ray between 0 and tMax. Each sphere is centred on its shape's origin and
+// holds the shape's transformed unit cube, so rejecting a shape costs a few dot products
+// instead of transforming the ray into its object space. There is nothing to build beyond one
+// sphere per shape, so the renderer uses it whenever acceleration is off.
+class BoundingSpheres : public Accelerator {
+public:
+    explicit BoundingSpheres(const std::vector<RenderShapeData> &shapes);
+
+    void traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const override;
+    bool refit(const std::vector<RenderShapeData> &shapes, const std::vector<int> &changed) override;
+
+private:
+    // The centre of `shape`'s sphere in xyz and its squared radius, padded against rounding, in
+    // w; meshes, which rays never hit, get a radius no ray passes within
+    static glm::vec4 boundingSphere(const RenderShapeData &shape);
+
+    std::vector<glm::vec4> m_spheres; // Indexed like the shapes
+};
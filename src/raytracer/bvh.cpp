@@ -0,0 +1,366 @@
+#include "bvh.h"
+#include "utils/renderstats.h"
+
+#include <algorithm>
+#include <bit>
+#include <future>
+#include <limits>
+#include <thread>
+
+namespace {
+
+// Bins per axis when evaluating SAH splits
+const int kBins = 16;
+// Most shapes in a leaf; the SAH builder may stop splitting below this
+const int kMaxLeafShapes = 8;
+// Shapes per leaf of an LBVH
+const int kMortonLeafShapes = 4;
+// Ranges with fewer shapes than this are built on the thread that split them
+const int kParallelShapes = 4096;
+// Below this depth, ranges are split at their median, which bounds the depth of the tree
+const int kMedianDepth = 40;
+// Entries in the traversal stack: kMedianDepth plus the depth of a median split of 2^31 shapes
+const int kStackSize = kMedianDepth + 32;
+
+int largestAxis(const glm::vec3 &extent) {
+    return extent.x >= extent.y ? (extent.x >= extent.z ? 0 : 2) : (extent.y >= extent.z ? 1 : 2);
+}
+
+// Spreads the low 10 bits of `v` out to every third bit
+std::uint32_t expandBits(std::uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code of a point in the unit cube; bit 3k + 2 is x, 3k + 1 is y and 3k is z
+std::uint32_t mortonCode(const glm::vec3 &unit) {
+    glm::uvec3 cell(glm::clamp(unit * 1024.0f, glm::vec3(0.0f), glm::vec3(1023.0f)));
+    return expandBits(cell.x) * 4 + expandBits(cell.y) * 2 + expandBits(cell.z);
+}
+
+}
+
+class BVH::Builder {
+public:
+    // A shape as the builder sees it, kept together so that splits reorder one array
+    struct Reference {
+        Bounds bounds;
+        glm::vec3 centre;
+        std::uint32_t code; // Morton code of the centre, for LBVHs
+        int shape;
+    };
+
+    Builder(std::vector<Reference> &references, bool morton, bool parallel) : m_refs(references), m_morton(morton) {
+        // Enough subtrees for about four per core
+        unsigned threads = parallel ? std::max(1u, std::thread::hardware_concurrency()) : 1u;
+        m_parallelDepth = threads > 1 ? std::bit_width(threads) + 1 : 0;
+
+        if (morton) {
+            Bounds centreBounds;
+            for (const Reference &reference : references) {
+                centreBounds.extend(reference.centre);
+            }
+            glm::vec3 scale = glm::vec3(1.0f) / glm::max(centreBounds.extent(), glm::vec3(1e-30f));
+            for (Reference &reference : references) {
+                reference.code = mortonCode((reference.centre - centreBounds.min) * scale);
+            }
+            std::sort(references.begin(), references.end(), [](const Reference &a, const Reference &b) {
+                return a.code < b.code || (a.code == b.code && a.shape < b.shape);
+            });
+        }
+    }
+
+    // Builds the subtree over references [begin, end) and appends it to `nodes`, depth first
+    void build(int begin, int end, int depth, std::vector<Node> &nodes) {
+        Bounds bounds, centreBounds;
+        for (int i = begin; i < end; i++) {
+            bounds.extend(m_refs[i].bounds);
+            centreBounds.extend(m_refs[i].centre);
+        }
+        int index = int(nodes.size());
+        nodes.push_back(Node{bounds, begin, 0, 0});
+
+        int axis = largestAxis(centreBounds.extent());
+        int mid = depth >= kMedianDepth ? splitMedian(begin, end, axis)
+                : m_morton             ? splitMorton(begin, end, axis)
+                                       : splitSah(begin, end, bounds, centreBounds, axis);
+        if (mid == begin) {
+            nodes[index].count = std::uint16_t(end - begin);
+            return;
+        }
+        nodes[index].axis = std::uint16_t(axis);
+
+        if (depth < m_parallelDepth && end - begin >= kParallelShapes) {
+            // The ranges are disjoint, so the right subtree can be built alongside the left one
+            std::vector<Node> right;
+            auto task = std::async(std::launch::async, [&]() { build(mid, end, depth + 1, right); });
+            build(begin, mid, depth + 1, nodes);
+            task.get();
+            int base = int(nodes.size());
+            nodes[index].first = base;
+            for (Node node : right) {
+                if (node.count == 0) {
+                    node.first += base;
+                }
+                nodes.push_back(node);
+            }
+        } else {
+            build(begin, mid, depth + 1, nodes);
+            nodes[index].first = int(nodes.size());
+            build(mid, end, depth + 1, nodes);
+        }
+    }
+
+private:
+    // Each split reorders references [begin, end) into two halves and returns where the second
+    // one starts, or returns `begin` to make the range a leaf. `axis` is set to the split axis.
+
+    // The split with the lowest SAH cost between kBins bins of shape centres on any axis
+    int splitSah(int begin, int end, const Bounds &bounds, const Bounds &centreBounds, int &axis) {
+        int count = end - begin;
+        if (count == 1) {
+            return begin;
+        }
+        glm::vec3 extent = centreBounds.extent();
+        glm::vec3 scale(0.0f);
+        for (int a = 0; a < 3; a++) {
+            scale[a] = extent[a] > 0.0f ? kBins * 0.99999f / extent[a] : 0.0f;
+        }
+        auto binOf = [&](const Reference &reference, int a) {
+            return std::min(kBins - 1, int((reference.centre[a] - centreBounds.min[a]) * scale[a]));
+        };
+
+        // One pass bins every axis
+        Bounds binBounds[3][kBins];
+        int binCounts[3][kBins] = {};
+        for (int i = begin; i < end; i++) {
+            for (int a = 0; a < 3; a++) {
+                int bin = binOf(m_refs[i], a);
+                binBounds[a][bin].extend(m_refs[i].bounds);
+                binCounts[a][bin]++;
+            }
+        }
+
+        float bestCost = std::numeric_limits<float>::max();
+        int bestBin = -1;
+        for (int a = 0; a < 3; a++) {
+            if (extent[a] <= 0.0f) {
+                continue;
+            }
+            // Areas and counts right of each boundary, then a sweep from the left
+            float rightArea[kBins];
+            int rightCount[kBins];
+            Bounds right;
+            int inRight = 0;
+            for (int bin = kBins - 1; bin > 0; bin--) {
+                right.extend(binBounds[a][bin]);
+                inRight += binCounts[a][bin];
+                rightArea[bin] = right.surfaceArea();
+                rightCount[bin] = inRight;
+            }
+            Bounds left;
+            int inLeft = 0;
+            for (int bin = 0; bin < kBins - 1; bin++) {
+                left.extend(binBounds[a][bin]);
+                inLeft += binCounts[a][bin];
+                if (inLeft == 0 || rightCount[bin + 1] == 0) {
+                    continue;
+                }
+                float cost = left.surfaceArea() * inLeft + rightArea[bin + 1] * rightCount[bin + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestBin = bin;
+                    axis = a;
+                }
+            }
+        }
+
+        if (bestBin < 0) {
+            // Every centre is in the same place; no split separates them spatially
+            return count <= kMaxLeafShapes ? begin : splitMedian(begin, end, axis);
+        }
+        float splitCost = kNodeCost + kShapeCost * bestCost / bounds.surfaceArea();
+        if (count <= kMaxLeafShapes && splitCost >= kShapeCost * count) {
+            return begin;
+        }
+        Reference *mid = std::partition(m_refs.data() + begin, m_refs.data() + end,
+                                        [&](const Reference &reference) { return binOf(reference, axis) <= bestBin; });
+        return int(mid - m_refs.data());
+    }
+
+    // Splits where the highest bit that differs across the range's Morton codes turns on
+    int splitMorton(int begin, int end, int &axis) {
+        if (end - begin <= kMortonLeafShapes) {
+            return begin;
+        }
+        std::uint32_t first = m_refs[begin].code, last = m_refs[end - 1].code;
+        if (first == last) {
+            return splitMedian(begin, end, axis);
+        }
+        int bit = 31 - std::countl_zero(first ^ last);
+        axis = 2 - bit % 3;
+        const Reference *mid = std::partition_point(m_refs.data() + begin, m_refs.data() + end,
+                                                    [&](const Reference &reference) { return (reference.code >> bit & 1u) == 0; });
+        return int(mid - m_refs.data());
+    }
+
+    // Splits at the median centre along `axis`, which the caller set to the axis the centres
+    // spread furthest on. LBVH ranges stay in Morton order.
+    int splitMedian(int begin, int end, int axis) {
+        if (end - begin <= 1) {
+            return begin;
+        }
+        int mid = begin + (end - begin) / 2;
+        if (!m_morton) {
+            std::nth_element(m_refs.data() + begin, m_refs.data() + mid, m_refs.data() + end,
+                             [&](const Reference &a, const Reference &b) { return a.centre[axis] < b.centre[axis]; });
+        }
+        return mid;
+    }
+
+    std::vector<Reference> &m_refs;
+    bool m_morton;
+    int m_parallelDepth;
+};
+
+BVH::BVH(const std::vector<RenderShapeData> &shapes, AccelerationStructure structure, bool parallel) {
+    std::vector<Bounds> bounds;
+    std::vector<int> indices;
+    collectShapeBounds(shapes, bounds, indices);
+    std::vector<Builder::Reference> references(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        const Bounds &box = bounds[indices[i]];
+        references[i] = Builder::Reference{box, 0.5f * (box.min + box.max), 0, indices[i]};
+    }
+    if (!references.empty()) {
+        m_nodes.reserve(2 * references.size());
+        Builder builder(references, structure == AccelerationStructure::ACCEL_LBVH, parallel);
+        builder.build(0, int(references.size()), 0, m_nodes);
+    }
+    m_order.resize(references.size());
+    for (size_t i = 0; i < references.size(); i++) {
+        m_order[i] = references[i].shape;
+    }
+
+    m_stats.nodes = m_nodes.size();
+    m_stats.references = m_order.size();
+    m_stats.sahCost = sahCost();
+    m_builtCost = m_stats.sahCost;
+}
+
+double BVH::sahCost() const {
+    if (m_nodes.empty()) {
+        return 0.0;
+    }
+    double rootArea = std::max(m_nodes[0].bounds.surfaceArea(), 1e-30f);
+    double cost = 0.0;
+    for (const Node &node : m_nodes) {
+        cost += node.bounds.surfaceArea() / rootArea * (node.count == 0 ? kNodeCost : kShapeCost * node.count);
+    }
+    return cost;
+}
+
+void BVH::linkNodes(int shapeCount) {
+    m_parents.assign(m_nodes.size(), -1);
+    m_leaves.assign(shapeCount, -1);
+    for (int node = 0; node < int(m_nodes.size()); node++) {
+        const Node &current = m_nodes[node];
+        if (current.count == 0) {
+            m_parents[node + 1] = node;
+            m_parents[current.first] = node;
+        } else {
+            for (int i = current.first; i < current.first + current.count; i++) {
+                m_leaves[m_order[i]] = node;
+            }
+        }
+    }
+    m_weightedArea = m_stats.sahCost * std::max(m_nodes[0].bounds.surfaceArea(), 1e-30f);
+}
+
+bool BVH::refit(const std::vector<RenderShapeData> &shapes, const std::vector<int> &changed) {
+    if (m_nodes.empty()) {
+        return false;
+    }
+    if (m_parents.empty()) {
+        linkNodes(int(shapes.size()));
+    }
+    Bounds scene = m_nodes[0].bounds;
+    std::vector<int> leaves;
+    for (int s : changed) {
+        if (s >= 0 && s < int(m_leaves.size()) && m_leaves[s] >= 0) {
+            scene.extend(shapeBounds(shapes[s]));
+            leaves.push_back(m_leaves[s]);
+        }
+    }
+    std::sort(leaves.begin(), leaves.end());
+    leaves.erase(std::unique(leaves.begin(), leaves.end()), leaves.end());
+
+    // Moved shapes are padded for the scene they moved into, like collectShapeBounds()
+    glm::vec3 padding(boundsPadding(scene));
+    for (int leaf : leaves) {
+        Bounds bounds;
+        for (int i = m_nodes[leaf].first; i < m_nodes[leaf].first + m_nodes[leaf].count; i++) {
+            bounds.extend(shapeBounds(shapes[m_order[i]]));
+        }
+        bounds.min -= padding;
+        bounds.max += padding;
+        // Walk up until a node's bounds stay the same
+        int node = leaf;
+        while (bounds.min != m_nodes[node].bounds.min || bounds.max != m_nodes[node].bounds.max) {
+            Node &current = m_nodes[node];
+            float cost = current.count == 0 ? kNodeCost : kShapeCost * current.count;
+            m_weightedArea += double(bounds.surfaceArea() - current.bounds.surfaceArea()) * cost;
+            current.bounds = bounds;
+            node = m_parents[node];
+            if (node < 0) {
+                break;
+            }
+            bounds = m_nodes[node + 1].bounds;
+            bounds.extend(m_nodes[m_nodes[node].first].bounds);
+        }
+    }
+
+    m_stats.sahCost = m_weightedArea / std::max(m_nodes[0].bounds.surfaceArea(), 1e-30f);
+    return m_stats.sahCost <= kMaxRefitCost * m_builtCost;
+}
+
+void BVH::traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const {
+    if (m_nodes.empty()) {
+        return;
+    }
+    glm::vec3 invDir = 1.0f / dir;
+    RenderCounters &counters = threadCounters();
+    int stack[kStackSize];
+    int stackSize = 0;
+    int node = 0;
+    while (true) {
+        const Node &current = m_nodes[node];
+        counters.accelerationNodes++;
+        float tEnter = 0.0f, tExit = tMax;
+        if (current.bounds.clip(origin, invDir, tEnter, tExit)) {
+            if (current.count == 0) {
+                // Visit the child on the near side of the split first
+                int nearChild = node + 1, farChild = current.first;
+                if (dir[current.axis] < 0.0f) {
+                    std::swap(nearChild, farChild);
+                }
+                stack[stackSize++] = farChild;
+                node = nearChild;
+                continue;
+            }
+            for (int i = current.first; i < current.first + current.count; i++) {
+                tMax = visitor.visit(m_order[i], tMax);
+                if (tMax < 0.0f) {
+                    return;
+                }
+            }
+        }
+        if (stackSize == 0) {
+            return;
+        }
+        node = stack[--stackSize];
+    }
+}
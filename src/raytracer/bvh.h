@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "accelerator.h"
+
+// A binary bounding volume hierarchy over the shapes' world bounds, built either with the
+// binned surface area heuristic (ACCEL_BVH), or from Morton codes of the shapes' centres
+// (ACCEL_LBVH), which builds several times faster but gives a tree that is slower to trace.
+// Large builds split the top of the tree on the calling thread, then build its subtrees in
+// parallel. When shapes move, refit() grows and shrinks the bounds on the paths from their
+// leaves to the root, keeping the tree's shape, until the SAH cost of the refitted tree
+// exceeds the built tree's by kMaxRefitCost.
+class BVH : public Accelerator {
+public:
+    // @param structure ACCEL_BVH or ACCEL_LBVH.
+    // @param parallel  Whether to build subtrees on all cores.
+    BVH(const std::vector<RenderShapeData> &shapes, AccelerationStructure structure, bool parallel);
+
+    void traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const override;
+    bool refit(const std::vector<RenderShapeData> &shapes, const std::vector<int> &changed) override;
+
+    // Relative costs of visiting a node and of testing a shape, for the surface area heuristic.
+    // A shape test transforms the ray into object space first, so it costs several box tests.
+    static constexpr float kNodeCost = 1.0f;
+    static constexpr float kShapeCost = 4.0f;
+    // A refitted tree whose SAH cost grows past this multiple of its cost as built should be rebuilt
+    static constexpr double kMaxRefitCost = 1.5;
+
+    struct Node {
+        Bounds bounds;
+        int first;          // Leaves: first entry in order(); inner nodes: index of the right child
+        std::uint16_t count; // Number of shapes in a leaf; 0 for inner nodes, whose left child follows them
+        std::uint16_t axis;  // Inner nodes: the axis the children were split on, for front-to-back order
+    };
+
+    // The tree in depth-first order, with the root first, and the shape indices its leaves
+    // refer to; for structures derived from it
+    const std::vector<Node> &nodes() const { return m_nodes; }
+    const std::vector<int> &order() const { return m_order; }
+
+private:
+    class Builder;
+
+    // Expected cost of tracing a ray through the tree, by the surface area heuristic
+    double sahCost() const;
+    // Fills m_parents and m_leaves, which only refit() needs
+    void linkNodes(int shapeCount);
+
+    std::vector<Node> m_nodes;
+    std::vector<int> m_order; // Shape indices, grouped by leaf
+
+    std::vector<int> m_parents;  // Parent of each node, or -1 for the root
+    std::vector<int> m_leaves;   // Leaf holding each shape, or -1 for meshes
+    double m_builtCost = 0.0;    // SAH cost when the tree was built
+    double m_weightedArea = 0.0; // The SAH cost times the root's surface area, kept up to date by refit()
+};
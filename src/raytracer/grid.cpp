@@ -0,0 +1,209 @@
+#include "grid.h"
+#include "utils/renderstats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Cells per shape of a UniformGrid, and of each TwoLevelGrid subgrid
+const float kGridDensity = 2.0f;
+// Cells per shape of a TwoLevelGrid's top grid
+const float kTopGridDensity = 1.0f / 16.0f;
+// Top cells overlapping more shapes than this get a subgrid
+const int kSubgridThreshold = 8;
+
+// Remembers which shapes the current ray has been tested against, so a shape spanning
+// several cells is only tested once. Each thread keeps one, stamped with a ray number.
+class Mailbox {
+public:
+    void begin(int shapeCount) {
+        if (m_stamps.size() < size_t(shapeCount)) {
+            m_stamps.resize(shapeCount, 0);
+        }
+        if (++m_ray == 0) {
+            std::fill(m_stamps.begin(), m_stamps.end(), 0);
+            m_ray = 1;
+        }
+    }
+
+    // Whether `shape` has not been tested against this ray yet; marks it as tested
+    bool firstVisit(int shape) {
+        if (m_stamps[shape] == m_ray) {
+            return false;
+        }
+        m_stamps[shape] = m_ray;
+        return true;
+    }
+
+private:
+    std::vector<std::uint32_t> m_stamps;
+    std::uint32_t m_ray = 0;
+};
+
+Mailbox &threadMailbox() {
+    thread_local Mailbox mailbox;
+    return mailbox;
+}
+
+// Visits the shapes listed in [begin, end) that the ray has not met yet.
+// @return False if the visitor stopped the traversal.
+bool visitShapes(const int *begin, const int *end, Mailbox &mailbox, ShapeVisitor &visitor, float &tMax) {
+    for (const int *shape = begin; shape != end; shape++) {
+        if (mailbox.firstVisit(*shape)) {
+            tMax = visitor.visit(*shape, tMax);
+            if (tMax < 0.0f) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}
+
+void GridLevel::build(const Bounds &bounds, const std::vector<Bounds> &shapeBounds, const std::vector<int> &shapes, float density) {
+    m_bounds = bounds;
+    glm::vec3 extent = bounds.extent();
+    float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+    // Flat scenes still get cells across their plane
+    glm::vec3 sides = maxExtent > 0.0f ? glm::max(extent, glm::vec3(maxExtent * 1e-3f)) : glm::vec3(1.0f);
+    float cellSide = std::cbrt(sides.x * sides.y * sides.z / std::max(1.0f, density * shapes.size()));
+    for (int axis = 0; axis < 3; axis++) {
+        m_resolution[axis] = std::clamp(int(std::ceil(extent[axis] / cellSide)), 1, kMaxResolution);
+        m_cellSize[axis] = extent[axis] / m_resolution[axis];
+        m_invCellSize[axis] = m_cellSize[axis] > 0.0f ? 1.0f / m_cellSize[axis] : 0.0f;
+    }
+
+    // Count each cell's shapes, then fill the lists in place
+    int cells = m_resolution.x * m_resolution.y * m_resolution.z;
+    m_cellStart.assign(cells + 1, 0);
+    auto forEachCell = [this, &shapeBounds](int shape, auto &&f) {
+        glm::ivec3 lo = cellCoordinates(shapeBounds[shape].min);
+        glm::ivec3 hi = cellCoordinates(shapeBounds[shape].max);
+        for (int z = lo.z; z <= hi.z; z++) {
+            for (int y = lo.y; y <= hi.y; y++) {
+                for (int x = lo.x; x <= hi.x; x++) {
+                    f(cellIndex(glm::ivec3(x, y, z)));
+                }
+            }
+        }
+    };
+    for (int shape : shapes) {
+        forEachCell(shape, [this](int cell) { m_cellStart[cell + 1]++; });
+    }
+    for (int cell = 0; cell < cells; cell++) {
+        m_cellStart[cell + 1] += m_cellStart[cell];
+    }
+    m_cellShapes.resize(m_cellStart[cells]);
+    std::vector<int> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+    for (int shape : shapes) {
+        forEachCell(shape, [this, &fill, shape](int cell) { m_cellShapes[fill[cell]++] = shape; });
+    }
+}
+
+Bounds GridLevel::cellBounds(int cell) const {
+    glm::ivec3 coordinates(cell % m_resolution.x, (cell / m_resolution.x) % m_resolution.y,
+                           cell / (m_resolution.x * m_resolution.y));
+    Bounds bounds;
+    bounds.min = m_bounds.min + glm::vec3(coordinates) * m_cellSize;
+    bounds.max = m_bounds.min + glm::vec3(coordinates + 1) * m_cellSize;
+    return bounds;
+}
+
+glm::ivec3 GridLevel::cellCoordinates(const glm::vec3 &point) const {
+    glm::vec3 cell = glm::floor((point - m_bounds.min) * m_invCellSize);
+    return glm::ivec3(glm::clamp(cell, glm::vec3(0.0f), glm::vec3(m_resolution - 1)));
+}
+
+UniformGrid::UniformGrid(const std::vector<RenderShapeData> &shapes) : m_shapeCount(int(shapes.size())) {
+    std::vector<Bounds> bounds;
+    std::vector<int> indices;
+    Bounds scene = collectShapeBounds(shapes, bounds, indices);
+    m_grid.build(scene, bounds, indices, kGridDensity);
+    m_stats.nodes = m_grid.cellCount();
+    m_stats.references = m_grid.referenceCount();
+}
+
+void UniformGrid::traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const {
+    glm::vec3 invDir = 1.0f / dir;
+    float tEnter = 0.0f, tExit = tMax;
+    if (!m_grid.bounds().clip(origin, invDir, tEnter, tExit)) {
+        return;
+    }
+    Mailbox &mailbox = threadMailbox();
+    mailbox.begin(m_shapeCount);
+    RenderCounters &counters = threadCounters();
+    m_grid.walk(origin, dir, invDir, tEnter, tExit, [&](int cell, float tCellExit) {
+        counters.accelerationNodes++;
+        // Shapes overlap several cells, so a closer hit may lie beyond this one;
+        // the walk ends once the closest hit so far lies before the next cell
+        return visitShapes(m_grid.cellBegin(cell), m_grid.cellEnd(cell), mailbox, visitor, tMax) && tMax >= tCellExit;
+    });
+}
+
+TwoLevelGrid::TwoLevelGrid(const std::vector<RenderShapeData> &shapes) : m_shapeCount(int(shapes.size())) {
+    std::vector<Bounds> bounds;
+    std::vector<int> indices;
+    Bounds scene = collectShapeBounds(shapes, bounds, indices);
+    m_top.build(scene, bounds, indices, kTopGridDensity);
+
+    m_cellGrid.assign(m_top.cellCount(), -1);
+    for (int cell = 0; cell < m_top.cellCount(); cell++) {
+        std::vector<int> cellShapes(m_top.cellBegin(cell), m_top.cellEnd(cell));
+        if (int(cellShapes.size()) <= kSubgridThreshold) {
+            continue;
+        }
+        // The subgrid covers the part of the cell its shapes fill. Traversals only walk it
+        // while the ray is inside the cell, so it may reach a little past the cell's faces.
+        Bounds filled;
+        for (int shape : cellShapes) {
+            filled.extend(bounds[shape]);
+        }
+        Bounds cellBounds = m_top.cellBounds(cell);
+        glm::vec3 margin = 1e-3f * cellBounds.extent();
+        filled.min = glm::max(filled.min, cellBounds.min - margin);
+        filled.max = glm::min(filled.max, cellBounds.max + margin);
+        m_cellGrid[cell] = int(m_subgrids.size());
+        m_subgrids.emplace_back();
+        m_subgrids.back().build(filled, bounds, cellShapes, kGridDensity);
+    }
+
+    m_stats.nodes = m_top.cellCount();
+    m_stats.references = m_top.referenceCount();
+    for (const GridLevel &grid : m_subgrids) {
+        m_stats.nodes += grid.cellCount();
+        m_stats.references += grid.referenceCount();
+    }
+}
+
+void TwoLevelGrid::traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const {
+    glm::vec3 invDir = 1.0f / dir;
+    float tEnter = 0.0f, tExit = tMax;
+    if (!m_top.bounds().clip(origin, invDir, tEnter, tExit)) {
+        return;
+    }
+    Mailbox &mailbox = threadMailbox();
+    mailbox.begin(m_shapeCount);
+    RenderCounters &counters = threadCounters();
+    float tCellEnter = tEnter;
+    m_top.walk(origin, dir, invDir, tEnter, tExit, [&](int cell, float tCellExit) {
+        counters.accelerationNodes++;
+        int subgrid = m_cellGrid[cell];
+        float tSubEnter = tCellEnter, tSubExit = std::min(tCellExit, tMax);
+        tCellEnter = tCellExit;
+        if (subgrid < 0) {
+            return visitShapes(m_top.cellBegin(cell), m_top.cellEnd(cell), mailbox, visitor, tMax) && tMax >= tCellExit;
+        }
+        const GridLevel &grid = m_subgrids[subgrid];
+        bool more = true;
+        if (grid.bounds().clip(origin, invDir, tSubEnter, tSubExit)) {
+            grid.walk(origin, dir, invDir, tSubEnter, tSubExit, [&](int subcell, float tSubcellExit) {
+                counters.accelerationNodes++;
+                more = visitShapes(grid.cellBegin(subcell), grid.cellEnd(subcell), mailbox, visitor, tMax);
+                return more && tMax >= tSubcellExit;
+            });
+        }
+        return more && tMax >= tCellExit;
+    });
+}
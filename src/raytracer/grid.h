@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "accelerator.h"
+
+// One level of a uniform grid: a box split into equal cells, each listing the shapes whose
+// bounds overlap it
+class GridLevel {
+public:
+    // Splits `bounds` into about `density` cells per shape, at most kMaxResolution per axis
+    void build(const Bounds &bounds, const std::vector<Bounds> &shapeBounds, const std::vector<int> &shapes, float density);
+
+    const Bounds &bounds() const { return m_bounds; }
+    int cellCount() const { return int(m_cellStart.size()) - 1; }
+    int referenceCount() const { return int(m_cellShapes.size()); }
+    Bounds cellBounds(int cell) const;
+    // The shapes overlapping `cell`, as [begin, end)
+    const int *cellBegin(int cell) const { return m_cellShapes.data() + m_cellStart[cell]; }
+    const int *cellEnd(int cell) const { return m_cellShapes.data() + m_cellStart[cell + 1]; }
+
+    // Steps through the cells the ray meets in [tEnter, tExit], which must already lie inside
+    // bounds(), with a 3D-DDA (Amanatides and Woo), calling visitCell(cell, tCellExit) in order
+    // until it returns false
+    template <typename VisitCell>
+    void walk(const glm::vec3 &origin, const glm::vec3 &dir, const glm::vec3 &invDir,
+              float tEnter, float tExit, VisitCell &&visitCell) const;
+
+private:
+    static constexpr int kMaxResolution = 256;
+
+    Bounds m_bounds;
+    glm::ivec3 m_resolution{1};
+    glm::vec3 m_cellSize{1.0f};
+    glm::vec3 m_invCellSize{1.0f};
+    std::vector<int> m_cellStart;  // Offset of each cell's list in m_cellShapes, plus one past the end
+    std::vector<int> m_cellShapes;
+
+    glm::ivec3 cellCoordinates(const glm::vec3 &point) const;
+    int cellIndex(const glm::ivec3 &cell) const {
+        return (cell.z * m_resolution.y + cell.y) * m_resolution.x + cell.x;
+    }
+};
+
+// A single grid over the whole scene. Fastest when shapes are about the same size and evenly
+// spread, like a voxel kit; a few large shapes or dense clusters make its cells uneven.
+class UniformGrid : public Accelerator {
+public:
+    explicit UniformGrid(const std::vector<RenderShapeData> &shapes);
+    void traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const override;
+
+private:
+    GridLevel m_grid;
+    int m_shapeCount;
+};
+
+// A coarse grid whose crowded cells each hold a finer grid over their own shapes, so clusters
+// get small cells without empty space paying for them
+class TwoLevelGrid : public Accelerator {
+public:
+    explicit TwoLevelGrid(const std::vector<RenderShapeData> &shapes);
+    void traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const override;
+
+private:
+    GridLevel m_top;
+    std::vector<int> m_cellGrid;  // Index into m_subgrids for each top cell, or -1 to use its shape list
+    std::vector<GridLevel> m_subgrids;
+    int m_shapeCount;
+};
+
+template <typename VisitCell>
+void GridLevel::walk(const glm::vec3 &origin, const glm::vec3 &dir, const glm::vec3 &invDir,
+                     float tEnter, float tExit, VisitCell &&visitCell) const {
+    glm::ivec3 cell = cellCoordinates(origin + tEnter * dir);
+    glm::ivec3 step(0), end(0);
+    glm::vec3 tNext(std::numeric_limits<float>::infinity());
+    glm::vec3 tDelta(std::numeric_limits<float>::infinity());
+    for (int axis = 0; axis < 3; axis++) {
+        if (dir[axis] > 0.0f && !std::isinf(invDir[axis])) {
+            step[axis] = 1;
+            end[axis] = m_resolution[axis];
+            tNext[axis] = (m_bounds.min[axis] + (cell[axis] + 1) * m_cellSize[axis] - origin[axis]) * invDir[axis];
+            tDelta[axis] = m_cellSize[axis] * invDir[axis];
+        } else if (dir[axis] < 0.0f && !std::isinf(invDir[axis])) {
+            step[axis] = -1;
+            end[axis] = -1;
+            tNext[axis] = (m_bounds.min[axis] + cell[axis] * m_cellSize[axis] - origin[axis]) * invDir[axis];
+            tDelta[axis] = -m_cellSize[axis] * invDir[axis];
+        }
+    }
+
+    while (true) {
+        int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+        if (!visitCell(cellIndex(cell), std::min(tNext[axis], tExit)) || tNext[axis] > tExit || step[axis] == 0) {
+            return;
+        }
+        cell[axis] += step[axis];
+        if (cell[axis] == end[axis]) {
+            return;
+        }
+        tNext[axis] += tDelta[axis];
+    }
+}
@@ -2,8 +2,112 @@
 #include "raytracer/illuminate.h"
 #include "utils/scenedata.h"
 #include "intersect.h"
+#include "utils/fastmath.h"
+#include "utils/renderstats.h"
 #include <iostream>
 
+namespace {
+
+// Shadow rays start this far along their direction, so they do not hit the surface they leave
+const float kShadowRayOffset = 0.001f;
+
+// Cosine of the angle between a spot light's axis and the direction from the light to `position`
+float spotCosine(const SceneLightData &light, glm::vec4 position) {
+    glm::vec4 distance = light.pos - position;
+    glm::vec3 new_distance = glm::vec3(distance.x, distance.y, distance.z);
+    glm::vec3 directionToLight = glm::normalize(new_distance);
+    glm::vec3 spot_light_dir = glm::normalize(glm::vec3(-light.dir.x, -light.dir.y, -light.dir.z));
+    return glm::dot(directionToLight, spot_light_dir);
+}
+
+#ifndef RAY_FAST_MATH
+// Angle between a spot light's axis and the direction from the light to `position`
+float spotAngle(const SceneLightData &light, glm::vec4 position) {
+    return acos(std::fmin(std::fmax(spotCosine(light, position), -1.0), 1.0));
+}
+#endif
+
+// The transcendental functions of the shading model. With RAY_FAST_MATH they use the float
+// approximations in fastmath.h instead of libm; see there for their error bounds.
+
+float specularPower(float r_product, float shininess) {
+#ifdef RAY_FAST_MATH
+    return fastmath::pow(r_product, shininess);
+#else
+    return pow(r_product, shininess);
+#endif
+}
+
+float attenuation(const SceneLightData &light, glm::vec4 distance) {
+#ifdef RAY_FAST_MATH
+    float real_distance = glm::length(glm::vec3(distance));
+    return std::fmin(1.0f, 1.0f / (light.function.x + real_distance * (light.function.y + real_distance * light.function.z)));
+#else
+    float real_distance = sqrt(pow(distance.x, 2) + pow(distance.y, 2) + pow(distance.z, 2));
+    return std::fmin(1.0, 1.0f / (light.function.x + real_distance * light.function.y + pow(real_distance, 2) * light.function.z));
+#endif
+}
+
+// Whether `position` lies inside a spot light's cone. The fast path compares cosines instead
+// of taking the arc cosine.
+bool insideSpotCone(const SceneLightData &light, glm::vec4 position) {
+#ifdef RAY_FAST_MATH
+    return spotCosine(light, position) >= fastmath::cos(light.angle);
+#else
+    return spotAngle(light, position) <= light.angle;
+#endif
+}
+
+// How much of a spot light reaches `position`: 1 inside the inner cone, falling off smoothly
+// to 0 across the penumbra
+float spotFactor(const SceneLightData &light, glm::vec4 position) {
+    float outer_angle = light.angle;
+    float inner_angle = outer_angle - light.penumbra;
+#ifdef RAY_FAST_MATH
+    // Only points in the penumbra need the angle itself
+    float cosine = spotCosine(light, position);
+    if (cosine >= fastmath::cos(inner_angle)){
+        return 1.0f;
+    }
+    if (cosine < fastmath::cos(outer_angle)){
+        return 0.0f;
+    }
+    float t = std::fmin(std::fmax((fastmath::acos(cosine) - inner_angle) / light.penumbra, 0.0f), 1.0f);
+    return 1.0f - t * t * (3.0f - 2.0f * t);
+#else
+    float x = spotAngle(light, position);
+    float falloff = -2 * pow(((std::abs(x - inner_angle)) / light.penumbra), 3) + 3 * pow((std::abs((x - inner_angle)) / light.penumbra), 2);
+    if (x <= inner_angle){
+        return 1.0f;
+    }else if (x > inner_angle && x <= outer_angle){
+        return 1 - falloff;
+    }
+    return 0.0f;
+#endif
+}
+
+// Texture u coordinate around the y axis, for the curved sides of cylinders, cones and spheres
+float azimuthU(glm::vec4 intersect_position, float epsilon) {
+#ifdef RAY_FAST_MATH
+    return (fastmath::atan2(intersect_position.x, intersect_position.z) - fastmath::kHalfPi) * fastmath::kInvTwoPi + epsilon;
+#else
+    float theta = atan2(intersect_position.x, intersect_position.z) - (M_PI / 2.0f);
+    return theta / (2.0f * M_PI) + epsilon;
+#endif
+}
+
+// Texture v coordinate of a point on the unit sphere, from its latitude
+float latitudeV(glm::vec4 intersect_position, float epsilon) {
+#ifdef RAY_FAST_MATH
+    return fastmath::asin(intersect_position.y / 0.5f) * (1.0f / fastmath::kPi) + 0.5f + epsilon;
+#else
+    float phi = asin(intersect_position.y / 0.5f);
+    return phi / M_PI + 0.5f + epsilon;
+#endif
+}
+
+}
+
 // Helper function to convert illumination to RGBA, applying some form of tone-mapping (e.g. clamping) in the process
 RGBA Illuminate::toRGBA(const glm::vec4 &illumination) {
     // Task 1
@@ -23,143 +127,229 @@ glm::vec4 Illuminate::toVec4(const RGBA &pixel) {
 }
 
 // Calculates the RGBA of a pixel from intersection infomation and globally-defined coefficients
+template <bool Shadows>
 glm::vec4 Illuminate::phong(glm::vec4  position,
-                       std::vector<RenderShapeData> primiTypes,
+                       const std::vector<RenderShapeData> &primiTypes,
+                       const std::vector<glm::mat4> &inv_ctms,
                       glm::vec3  normal,
                       glm::vec3  directionToCamera,
-                      SceneMaterial  &material,
+                      const ShadingMaterial &material,
                       glm::vec4 texture,
                       std::vector<SceneLightData> &lights,
-                      SceneGlobalData globalData) {
+                      const std::vector<int> &lightIndices,
+                      const std::vector<float> &lightWeights,
+                      SceneGlobalData globalData,
+                      const Accelerator *accelerator) {
     // Normalizing directions
     normal            = glm::normalize(normal);
     directionToCamera = glm::normalize(directionToCamera);
 
-    float blend = material.blend;
-    float ka = globalData.ka;
-    float ks = globalData.ks;
-    float kd = globalData.kd;
+    glm::vec4 illumination = ambient(material, globalData);
+
+    // lightWeights is either empty, weighting every light by 1, or parallel to lightIndices
+    for (size_t i = 0; i < lightIndices.size(); i++) {
+        const SceneLightData &light = lights[lightIndices[i]];
+        glm::vec4 directionToLight;
+        float distanceToLight;
+        if (shadowRay(light, position, directionToLight, distanceToLight) &&
+            (!Shadows || has_shadow(position, primiTypes, inv_ctms, directionToLight, distanceToLight, accelerator) == false)){
+            addLight(light, position, normal, directionToCamera, material, texture, globalData, illumination,
+                     lightWeights.empty() ? 1.0f : lightWeights[i]);
+        }
+    }
 
+//    RGBA returnValue = toRGBA(illumination);
+    return illumination;
+}
+
+template glm::vec4 Illuminate::phong<false>(glm::vec4, const std::vector<RenderShapeData> &, const std::vector<glm::mat4> &, glm::vec3, glm::vec3,
+                                            const ShadingMaterial &, glm::vec4, std::vector<SceneLightData> &,
+                                            const std::vector<int> &, const std::vector<float> &, SceneGlobalData,
+                                            const Accelerator *);
+template glm::vec4 Illuminate::phong<true>(glm::vec4, const std::vector<RenderShapeData> &, const std::vector<glm::mat4> &, glm::vec3, glm::vec3,
+                                           const ShadingMaterial &, glm::vec4, std::vector<SceneLightData> &,
+                                           const std::vector<int> &, const std::vector<float> &, SceneGlobalData,
+                                           const Accelerator *);
+
+glm::vec4 Illuminate::ambient(const ShadingMaterial &material, const SceneGlobalData &globalData) {
     // Output illumination (we can ignore opacity)
     glm::vec4 illumination(0, 0, 0, 1);
 
-
-    glm::vec4 ambient = material.cAmbient * ka;
-    glm::vec4 diffuse = material.cDiffuse * kd;
-    glm::vec4 specular = material.cSpecular * ks;
+    glm::vec4 ambient = material.cAmbient * globalData.ka;
     illumination = illumination + ambient;
+    return illumination;
+}
+
+bool Illuminate::shadowRay(const SceneLightData &light, glm::vec4 position, glm::vec4 &directionToLight, float &distanceToLight) {
+    switch(light.type){
+    case LightType::LIGHT_DIRECTIONAL:
+        directionToLight = -light.dir;
+        distanceToLight = std::numeric_limits<float>::max();
+        return true;
+    case LightType::LIGHT_SPOT:
+        // Outside the cone the light contributes nothing, so there is nothing to occlude
+        if (!insideSpotCone(light, position)){
+            return false;
+        }
+        directionToLight = light.pos - position;
+        distanceToLight = glm::length(directionToLight);
+        return true;
+    case LightType::LIGHT_POINT:
+        directionToLight = light.pos - position;
+        distanceToLight = glm::length(directionToLight);
+        return true;
+    default:
+        return false;
+    }
+}
 
-    for (const SceneLightData &light : lights) {
-        switch(light.type){
-        case LightType::LIGHT_DIRECTIONAL:{
-            float distanceToLight = std::numeric_limits<float>::max();
+void Illuminate::addLight(const SceneLightData &light,
+                          glm::vec4 position,
+                          glm::vec3 normal,
+                          glm::vec3 directionToCamera,
+                          const ShadingMaterial &material,
+                          glm::vec4 texture,
+                          const SceneGlobalData &globalData,
+                          glm::vec4 &illumination,
+                          float weight) {
+    // Weighted lights are accumulated on their own, so that unweighted ones add exactly as before
+    if (weight != 1.0f){
+        glm::vec4 contribution(0.0f);
+        addLight(light, position, normal, directionToCamera, material, texture, globalData, contribution);
+        illumination += weight * contribution;
+        return;
+    }
 
-            if (has_shadow(position, primiTypes, -light.dir, distanceToLight) == false){
+    float blend = material.blend;
+    float ks = globalData.ks;
+    float kd = globalData.kd;
 
-                glm::vec3 new_light_pos = glm::vec3(-light.dir.x, -light.dir.y, -light.dir.z);
-                glm::vec3 directionToLight = glm::normalize(new_light_pos);
-                float product = std::fmin(std::fmax(glm::dot(normal, directionToLight), 0.0), 1.0);
-                illumination += light.color * (blend * texture + (1.0f - blend) * diffuse) * product;
+    glm::vec4 diffuse = material.cDiffuse * kd;
+    glm::vec4 specular = material.cSpecular * ks;
 
-                float reflect = std::fmax(glm::dot(directionToLight, normal), 0.0);
-                glm::vec3 directionReflection = glm::normalize(2.0f * reflect * normal - directionToLight);
-                float r_product = std::fmin(std::fmax(glm::dot(directionReflection, directionToCamera), 0.0), 1.0);
-                r_product = pow(r_product, material.shininess);
-                illumination += light.color * specular * r_product;
-            }
+    switch(light.type){
+    case LightType::LIGHT_DIRECTIONAL:{
+        glm::vec3 new_light_pos = glm::vec3(-light.dir.x, -light.dir.y, -light.dir.z);
+        glm::vec3 directionToLight = glm::normalize(new_light_pos);
+        float product = std::fmin(std::fmax(glm::dot(normal, directionToLight), 0.0), 1.0);
+        illumination += light.color * (blend * texture + (1.0f - blend) * diffuse) * product;
+
+        float reflect = std::fmax(glm::dot(directionToLight, normal), 0.0);
+        glm::vec3 directionReflection = glm::normalize(2.0f * reflect * normal - directionToLight);
+        float r_product = std::fmin(std::fmax(glm::dot(directionReflection, directionToCamera), 0.0), 1.0);
+        r_product = specularPower(r_product, material.shininess);
+        illumination += light.color * specular * r_product;
+        break;
+    }
+    case LightType::LIGHT_SPOT:{
+        glm::vec4 distance = light.pos - position;
+        glm::vec3 new_distance = glm::vec3(distance.x, distance.y, distance.z);
+        glm::vec3 directionToLight = glm::normalize(new_distance);
+
+        float att = attenuation(light, distance);
+        float spot = spotFactor(light, position);
+        if (spot <= 0.0f){
             break;
         }
-        case LightType::LIGHT_SPOT:{
 
-            glm::vec4 distance = light.pos - position;
-            glm::vec3 new_distance = glm::vec3(distance.x, distance.y, distance.z);
-            glm::vec3 directionToLight = glm::normalize(new_distance);
+        float product = std::fmin(std::fmax(glm::dot(normal, directionToLight), 0.0), 1.0);
 
-            float distanceToLight = glm::length(distance);
+        float reflect = std::fmax(glm::dot(directionToLight, normal), 0.0);
+        glm::vec3 directionReflection = glm::normalize(2.0f * reflect * normal - directionToLight);
+        float r_product = std::fmin(std::fmax(glm::dot(directionReflection, directionToCamera), 0.0), 1.0);
+        r_product = specularPower(r_product, material.shininess);
 
-            if (has_shadow(position, primiTypes, distance, distanceToLight) == false){
-                float real_distance = sqrt(pow(distance.x, 2) + pow(distance.y, 2) + pow(distance.z, 2));
-                float att = std::fmin(1.0, 1.0f / (light.function.x + real_distance * light.function.y + pow(real_distance, 2) * light.function.z));
+        illumination += light.color * att * spot * (blend * texture + (1.0f - blend) * diffuse) * product;
+        illumination += light.color * att * spot * specular * r_product;
+        break;
+    }
+    case LightType::LIGHT_POINT:{
+        glm::vec4 distance = light.pos - position;
+        glm::vec3 new_distance = glm::vec3(distance.x, distance.y, distance.z);
+        glm::vec3 directionToLight = glm::normalize(new_distance);
 
-                float outer_angle = light.angle;
-                float inner_angle = outer_angle - light.penumbra;
-                glm::vec3 spot_light_dir = glm::normalize(glm::vec3(-light.dir.x, -light.dir.y, -light.dir.z));
-                float x = acos(std::fmin(std::fmax(glm::dot(directionToLight, spot_light_dir), -1.0), 1.0));
-                float falloff = -2 * pow(((abs(x - inner_angle)) / light.penumbra), 3) + 3 * pow((abs((x - inner_angle)) / light.penumbra), 2);
+        float att = attenuation(light, distance);
 
-                float product = std::fmin(std::fmax(glm::dot(normal, directionToLight), 0.0), 1.0);
+        float product = std::fmin(std::fmax(glm::dot(normal, directionToLight), 0.0), 1.0);
+        illumination += light.color * att * (blend * texture + (1.0f - blend) * diffuse) * product;
 
-                float reflect = std::fmax(glm::dot(directionToLight, normal), 0.0);
-                glm::vec3 directionReflection = glm::normalize(2.0f * reflect * normal - directionToLight);
-                float r_product = std::fmin(std::fmax(glm::dot(directionReflection, directionToCamera), 0.0), 1.0);
-                r_product = pow(r_product, material.shininess);
+        float reflect = std::fmax(glm::dot(directionToLight, normal), 0.0);
+        glm::vec3 directionReflection = glm::normalize(2.0f * reflect * normal - directionToLight);
+        float r_product = std::fmin(std::fmax(glm::dot(directionReflection, directionToCamera), 0.0), 1.0);
+        r_product = specularPower(r_product, material.shininess);
+        illumination += light.color * att * specular * r_product;
+        break;
+    }
+    default:
+        break;
+    }
+}
 
-                if (x <= inner_angle){
-                    illumination += light.color * att * (blend * texture + (1.0f - blend) * diffuse) * product;
-                    illumination += light.color * att * specular * r_product;
+bool Illuminate::has_shadow(glm::vec4 position, const std::vector<RenderShapeData> &primiTypes, const std::vector<glm::mat4> &inv_ctms,
+                            glm::vec4 world_directionToLight, float distanceToLight, const Accelerator *accelerator){
+    return occluder(position, primiTypes, inv_ctms, world_directionToLight, distanceToLight, accelerator) >= 0;
+}
 
-                }else if (x > inner_angle && x <= outer_angle){
-                    illumination += light.color * att * (1 - falloff) * (blend * texture + (1.0f - blend) * diffuse) * product;
-                    illumination += light.color * att * (1 - falloff) *  specular * r_product;
-            }
+int Illuminate::occluder(glm::vec4 position, const std::vector<RenderShapeData> &primiTypes, const std::vector<glm::mat4> &inv_ctms,
+                         glm::vec4 world_directionToLight, float distanceToLight, const Accelerator *accelerator){
+    threadCounters().shadowRays++;
+    if (accelerator != nullptr){
+        // Stops at the first shape that blocks the ray
+        class OccluderVisitor : public ShapeVisitor {
+        public:
+            OccluderVisitor(Illuminate &illuminate, const std::vector<RenderShapeData> &shapes, const std::vector<glm::mat4> &inv_ctms,
+                            glm::vec4 position, glm::vec4 direction, float distance)
+                : m_illuminate(illuminate), m_shapes(shapes), m_inv_ctms(inv_ctms), m_position(position), m_direction(direction),
+                  m_distance(distance) {}
+
+            float visit(int s, float tMax) override {
+                if (m_illuminate.occludes(m_shapes[s], m_inv_ctms[s], m_position, m_direction, m_distance)){
+                    occluder = s;
+                    return -1.0f;
+                }
+                return tMax;
             }
 
-            break;
-        }
-        case LightType::LIGHT_POINT:{
-            glm::vec4 distance = light.pos - position;
-            glm::vec3 new_distance = glm::vec3(distance.x, distance.y, distance.z);
-            glm::vec3 directionToLight = glm::normalize(new_distance);
-
-            float distanceToLight = glm::length(distance);
-
-            if (has_shadow(position, primiTypes, distance, distanceToLight) == false){
-                float real_distance = sqrt(pow(distance.x, 2) + pow(distance.y, 2) + pow(distance.z, 2));
-                float att = std::fmin(1.0, 1.0f / (light.function.x + real_distance * light.function.y + pow(real_distance, 2) * light.function.z));
-
-
-                float product = std::fmin(std::fmax(glm::dot(normal, directionToLight), 0.0), 1.0);
-                illumination += light.color * att * (blend * texture + (1.0f - blend) * diffuse) * product;
-
-                float reflect = std::fmax(glm::dot(directionToLight, normal), 0.0);
-                glm::vec3 directionReflection = glm::normalize(2.0f * reflect * normal - directionToLight);
-                float r_product = std::fmin(std::fmax(glm::dot(directionReflection, directionToCamera), 0.0), 1.0);
-                r_product = pow(r_product, material.shininess);
-                illumination += light.color * att * specular * r_product;
-            }
-            break;
-        }
-        default:
-            break;
+            int occluder = -1;
+
+        private:
+            Illuminate &m_illuminate;
+            const std::vector<RenderShapeData> &m_shapes;
+            const std::vector<glm::mat4> &m_inv_ctms;
+            glm::vec4 m_position;
+            glm::vec4 m_direction;
+            float m_distance;
+        };
+
+        // occludes() accepts hits up to distanceToLight past the offset start of the ray
+        OccluderVisitor visitor(*this, primiTypes, inv_ctms, position, world_directionToLight, distanceToLight);
+        accelerator->traverse(glm::vec3(position), glm::vec3(world_directionToLight), kShadowRayOffset + distanceToLight, visitor);
+        return visitor.occluder;
+    }
+    for (int s = 0; s < primiTypes.size(); s++){
+        if (occludes(primiTypes[s], inv_ctms[s], position, world_directionToLight, distanceToLight)){
+            return s;
         }
-
-
     }
-
-//    RGBA returnValue = toRGBA(illumination);
-    return illumination;
+    return -1;
 }
 
-bool Illuminate::has_shadow(glm::vec4 position, std::vector<RenderShapeData> primiTypes, glm::vec4 world_directionToLight, float distanceToLight){
+bool Illuminate::occludes(const RenderShapeData &curr_shape, const glm::mat4 &inv_ctm, glm::vec4 position, glm::vec4 world_directionToLight,
+                          float distanceToLight){
 
     Intersect intersect;
     bool is_shadow = false;
-    float tMin = std::numeric_limits<float>::max();
+    threadCounters().intersectionTests[int(curr_shape.type)]++;
 
     float t;
     glm::vec4 ray;
 
-    for (int s = 0; s < primiTypes.size(); s++){
-        RenderShapeData curr_shape = primiTypes[s];
-        glm::mat4 ctm = curr_shape.ctm;
-
-        glm::vec4 transformedPosition = glm::inverse(ctm) * position;
-        glm::vec4 directionToLight = glm::inverse(ctm) * world_directionToLight;
+    glm::vec4 transformedPosition = inv_ctm * position;
+    glm::vec4 directionToLight = inv_ctm * world_directionToLight;
 
-        float epsilon = 0.001f;
-        glm::vec4 shadowRayStart = transformedPosition + epsilon * directionToLight;
+    glm::vec4 shadowRayStart = transformedPosition + kShadowRayOffset * directionToLight;
 
-    switch(curr_shape.primitive.type){
+    switch(curr_shape.type){
     case PrimitiveType::PRIMITIVE_CUBE:{
         bool success = intersect.intersect_cube(shadowRayStart, directionToLight, t, ray);
         if (success){
@@ -199,10 +389,6 @@ bool Illuminate::has_shadow(glm::vec4 position, std::vector<RenderShapeData> pri
     default:
         break;
     }
-    if (is_shadow){
-        break;
-    }
-    }
 
     return is_shadow;
 }
@@ -215,19 +401,25 @@ glm::vec4 Illuminate::uv_cylinder(glm::vec4 intersect_position, RGBA* texture, i
     float v;
     int c;
     int r;
-    if (abs(intersect_position.y - 0.5) <= epsilon) {
+    if (std::abs(intersect_position.y - 0.5) <= epsilon) {
         u = intersect_position.x + 0.5 + epsilon;
         v = 1.0f - (intersect_position.z + 0.5) + epsilon;
-    }else if (abs(intersect_position.y + 0.5) <= epsilon){
+    }else if (std::abs(intersect_position.y + 0.5) <= epsilon){
         u = intersect_position.x + 0.5 + epsilon;
         v = intersect_position.z + 0.5 + epsilon;
     }else{
-        float theta = atan2(intersect_position.x, intersect_position.z) - (M_PI / 2.0f);
-        u = theta / (2.0f * M_PI) + epsilon;
+        u = azimuthU(intersect_position, epsilon);
         v = intersect_position.y + 0.5 + epsilon;
     }
     c = static_cast<int>(floor(u * repeatedU * width)) % t_width;
     r = static_cast<int>(floor((1 - v) * repeatedV * height)) % t_height;
+    // A negative u or v leaves a negative remainder; wrap it back into the texture
+    if (c < 0){
+        c += t_width;
+    }
+    if (r < 0){
+        r += t_height;
+    }
     if (c == t_width){
         c -= 1;
     }
@@ -246,17 +438,23 @@ glm::vec4 Illuminate::uv_cone(glm::vec4 intersect_position, RGBA* texture, int t
     float v;
     int c;
     int r;
-    if (abs(intersect_position.y + 0.5) <= epsilon){
+    if (std::abs(intersect_position.y + 0.5) <= epsilon){
         u = intersect_position.x + 0.5 + epsilon;
         v = intersect_position.z + 0.5 + epsilon;
 
     }else{
-        float theta = atan2(intersect_position.x, intersect_position.z) - (M_PI / 2.0f);
-        u = theta / (2.0f * M_PI) + epsilon;
+        u = azimuthU(intersect_position, epsilon);
         v = intersect_position.y + 0.5 + epsilon;
     }
     c = static_cast<int>(floor(u * repeatedU * width)) % t_width;
     r = static_cast<int>(floor((1 - v) * repeatedV * height)) % t_height;
+    // A negative u or v leaves a negative remainder; wrap it back into the texture
+    if (c < 0){
+        c += t_width;
+    }
+    if (r < 0){
+        r += t_height;
+    }
     if (c == t_width){
         c -= 1;
     }
@@ -275,27 +473,34 @@ glm::vec4 Illuminate::uv_cube(glm::vec4 intersect_position, RGBA* texture, int t
     float v;
     int c;
     int r;
-    if (abs(intersect_position.y - 0.5) <= epsilon) {
+    if (std::abs(intersect_position.y - 0.5) <= epsilon) {
         u = intersect_position.x + 0.5 + epsilon;
         v = 1.0f - (intersect_position.z + 0.5) + epsilon;
-    }else if (abs(intersect_position.y + 0.5) <= epsilon){
+    }else if (std::abs(intersect_position.y + 0.5) <= epsilon){
         u = intersect_position.x + 0.5 + epsilon;
         v = intersect_position.z + 0.5 + epsilon;
-    }else if (abs(intersect_position.x - 0.5) <= epsilon) {
+    }else if (std::abs(intersect_position.x - 0.5) <= epsilon) {
         u = 1.0f - (intersect_position.z + 0.5) + epsilon;
         v = intersect_position.y + 0.5 + epsilon;
-    }else if (abs(intersect_position.x + 0.5) <= epsilon){
+    }else if (std::abs(intersect_position.x + 0.5) <= epsilon){
         u = intersect_position.z + 0.5 + epsilon;
         v = intersect_position.y + 0.5 + epsilon;
-    }else if (abs(intersect_position.z - 0.5) <= epsilon) {
+    }else if (std::abs(intersect_position.z - 0.5) <= epsilon) {
         u = intersect_position.x + 0.5 + epsilon;
         v = intersect_position.y + 0.5 + epsilon;
-    }else if (abs(intersect_position.z + 0.5) <= epsilon){
+    }else if (std::abs(intersect_position.z + 0.5) <= epsilon){
         u = 1.0f - (intersect_position.x + 0.5) + epsilon;
         v = intersect_position.y + 0.5 + epsilon;
     }
     c = static_cast<int>(floor(u * repeatedU * width)) % t_width;
     r = static_cast<int>(floor((1 - v) * repeatedV * height)) % t_height;
+    // A negative u or v leaves a negative remainder; wrap it back into the texture
+    if (c < 0){
+        c += t_width;
+    }
+    if (r < 0){
+        r += t_height;
+    }
 
     if (c == t_width){
         c = c - 1;
@@ -312,12 +517,17 @@ glm::vec4 Illuminate::uv_sphere(glm::vec4 intersect_position, RGBA* texture, int
     float height = (float) t_height;
     float epsilon = 0.001f;
 
-    float theta = atan2(intersect_position.x, intersect_position.z) - (M_PI / 2.0f);
-    float phi = asin(intersect_position.y / 0.5f);
-    float u = theta / (2.0f * M_PI) + epsilon;
-    float v = phi / M_PI + 0.5f + epsilon;
+    float u = azimuthU(intersect_position, epsilon);
+    float v = latitudeV(intersect_position, epsilon);
     int c = static_cast<int>(floor(u * repeatedU * width)) % t_width;
     int r = static_cast<int>(floor((1 - v) * repeatedV * height)) % t_height;
+    // A negative u or v leaves a negative remainder; wrap it back into the texture
+    if (c < 0){
+        c += t_width;
+    }
+    if (r < 0){
+        r += t_height;
+    }
 
     if (c == t_width){
         c -= 1;
@@ -7,15 +7,42 @@ public:
 
     RGBA toRGBA(const glm::vec4 &illumination);
     glm::vec4 toVec4(const RGBA &pixel);
+    // Shadows selects at compile time whether has_shadow() is tested for each light
+    template <bool Shadows>
     glm::vec4 phong(glm::vec4  position,
-               std::vector<RenderShapeData> primiTypes,
+               const std::vector<RenderShapeData> &primiTypes,
+               const std::vector<glm::mat4> &inv_ctms,
            glm::vec3  normal,
            glm::vec3  directionToCamera,
-           SceneMaterial  &material,
+           const ShadingMaterial &material,
                     glm::vec4 texture,
            std::vector<SceneLightData> &lights,
-           SceneGlobalData globalData);
-    bool has_shadow(glm::vec4 position, std::vector<RenderShapeData> primiTypes, glm::vec4 lightPosition, float distanceToLight);
+           const std::vector<int> &lightIndices,
+           const std::vector<float> &lightWeights,
+           SceneGlobalData globalData,
+           const Accelerator *accelerator = nullptr);
+    // Shadow rays are tested against the shapes `accelerator` finds along them, or against
+    // every shape when it is null. inv_ctms holds the inverse CTM of each shape.
+    bool has_shadow(glm::vec4 position, const std::vector<RenderShapeData> &primiTypes, const std::vector<glm::mat4> &inv_ctms,
+                    glm::vec4 lightPosition, float distanceToLight, const Accelerator *accelerator = nullptr);
+    // The index of a shape that blocks the shadow ray, or -1 if none does. Without an
+    // accelerator, this is the first such shape.
+    int occluder(glm::vec4 position, const std::vector<RenderShapeData> &primiTypes, const std::vector<glm::mat4> &inv_ctms,
+                 glm::vec4 lightPosition, float distanceToLight, const Accelerator *accelerator = nullptr);
+    // Whether `shape`, whose inverse CTM is inv_ctm, blocks the shadow ray
+    bool occludes(const RenderShapeData &shape, const glm::mat4 &inv_ctm, glm::vec4 position, glm::vec4 lightPosition, float distanceToLight);
+
+    // The pieces phong() is made of, for callers that trace shadow rays in batches.
+    // ambient() is the illumination every point starts from. shadowRay() gives the direction
+    // and distance to test with has_shadow(), and returns false when the light cannot reach
+    // the point at all (unsupported lights, or points outside a spot light's cone).
+    // addLight() adds an unshadowed light, scaled by `weight`; normal and directionToCamera
+    // must be normalized.
+    glm::vec4 ambient(const ShadingMaterial &material, const SceneGlobalData &globalData);
+    bool shadowRay(const SceneLightData &light, glm::vec4 position, glm::vec4 &directionToLight, float &distanceToLight);
+    void addLight(const SceneLightData &light, glm::vec4 position, glm::vec3 normal, glm::vec3 directionToCamera,
+                  const ShadingMaterial &material, glm::vec4 texture, const SceneGlobalData &globalData,
+                  glm::vec4 &illumination, float weight = 1.0f);
 
     glm::vec4 uv_cylinder(glm::vec4 intersect_position, RGBA* texture, int t_width, int t_height, int repeatedU, int repeatedV);
     glm::vec4 uv_sphere(glm::vec4 intersect_position, RGBA* texture, int t_width, int t_height, int repeatedU, int repeatedV);
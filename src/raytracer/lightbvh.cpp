@@ -0,0 +1,249 @@
+#include "lightbvh.h"
+#include "utils/renderstats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Lights per leaf
+const int kLeafSize = 4;
+
+}
+
+float LightBVH::influenceRadius(const SceneLightData &light, float threshold) {
+    const float infinity = std::numeric_limits<float>::infinity();
+    if (light.type == LightType::LIGHT_DIRECTIONAL || threshold <= 0.0f) {
+        return infinity;
+    }
+    // Attenuation is min(1, 1 / (c + l d + q d^2)); solve for the distance at which it scales
+    // the brightest channel down to the threshold
+    float brightest = std::max(light.color.r, std::max(light.color.g, light.color.b));
+    float c = light.function.x;
+    float l = light.function.y;
+    float q = light.function.z;
+    if (c < 0.0f || l < 0.0f || q < 0.0f) {
+        return infinity;
+    }
+    float k = brightest / threshold;
+    if (brightest < threshold || c > k) {
+        return 0.0f;
+    }
+    if (q > 0.0f) {
+        return (-l + std::sqrt(l * l + 4.0f * q * (k - c))) / (2.0f * q);
+    }
+    if (l > 0.0f) {
+        return (k - c) / l;
+    }
+    return infinity;
+}
+
+void LightBVH::build(const std::vector<SceneLightData> &lights, float threshold) {
+    m_lights = &lights;
+    m_nodes.clear();
+    m_order.clear();
+    m_unbounded.clear();
+    m_spheres.assign(lights.size(), glm::vec4(0.0f));
+
+    for (int i = 0; i < lights.size(); i++) {
+        if (lights[i].type != LightType::LIGHT_POINT && lights[i].type != LightType::LIGHT_SPOT) {
+            m_unbounded.push_back(i);
+            continue;
+        }
+        // Lights that are below the threshold everywhere are dropped
+        float radius = influenceRadius(lights[i], threshold);
+        if (radius > 0.0f) {
+            m_spheres[i] = glm::vec4(glm::vec3(lights[i].pos), radius);
+            m_order.push_back(i);
+        }
+    }
+    if (!m_order.empty()) {
+        m_nodes.reserve(2 * m_order.size() / kLeafSize + 1);
+        buildNode(0, m_order.size());
+    }
+}
+
+// Splits the lights at the median of the longest axis of their centres
+int LightBVH::buildNode(int first, int count) {
+    int index = m_nodes.size();
+    m_nodes.push_back(Node{});
+
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(std::numeric_limits<float>::lowest());
+    glm::vec3 centreLo = lo;
+    glm::vec3 centreHi = hi;
+    float power = 0.0f;
+    for (int i = first; i < first + count; i++) {
+        const glm::vec4 &sphere = m_spheres[m_order[i]];
+        const SceneColor &color = (*m_lights)[m_order[i]].color;
+        glm::vec3 centre(sphere);
+        lo = glm::min(lo, centre - sphere.w);
+        hi = glm::max(hi, centre + sphere.w);
+        centreLo = glm::min(centreLo, centre);
+        centreHi = glm::max(centreHi, centre);
+        power += std::max(color.r, std::max(color.g, color.b));
+    }
+    m_nodes[index].min = lo;
+    m_nodes[index].max = hi;
+    m_nodes[index].centreMin = centreLo;
+    m_nodes[index].centreMax = centreHi;
+    m_nodes[index].power = power;
+
+    if (count <= kLeafSize) {
+        m_nodes[index].first = first;
+        m_nodes[index].count = count;
+        return index;
+    }
+
+    glm::vec3 extent = centreHi - centreLo;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int half = count / 2;
+    std::nth_element(m_order.begin() + first, m_order.begin() + first + half, m_order.begin() + first + count,
+                     [this, axis](int a, int b) { return m_spheres[a][axis] < m_spheres[b][axis]; });
+
+    buildNode(first, half);
+    int right = buildNode(first + half, count - half);
+    m_nodes[index].first = right;
+    m_nodes[index].count = 0;
+    return index;
+}
+
+const std::vector<int> &LightBVH::unboundedLights() const {
+    return m_unbounded;
+}
+
+void LightBVH::query(const glm::vec4 &position, std::vector<int> &lightIndices) const {
+    lightIndices.assign(m_unbounded.begin(), m_unbounded.end());
+    if (m_nodes.empty()) {
+        return;
+    }
+
+    glm::vec3 p(position);
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    RenderCounters &counters = threadCounters();
+    while (top > 0) {
+        const Node &node = m_nodes[stack[--top]];
+        counters.lightBvhNodes++;
+        if (glm::any(glm::lessThan(p, node.min)) || glm::any(glm::greaterThan(p, node.max))) {
+            continue;
+        }
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                const glm::vec4 &sphere = m_spheres[m_order[i]];
+                glm::vec3 offset = p - glm::vec3(sphere);
+                if (glm::dot(offset, offset) <= sphere.w * sphere.w) {
+                    lightIndices.push_back(m_order[i]);
+                }
+            }
+        } else {
+            int self = &node - m_nodes.data();
+            stack[top++] = node.first;
+            stack[top++] = self + 1;
+        }
+    }
+    std::sort(lightIndices.begin(), lightIndices.end());
+}
+
+// Estimated contribution of a whole subtree: its power over the squared distance to its
+// lights, with the distance clamped to the subtree's size so that nearby clusters are not
+// overestimated. Zero when the point lies outside every light's sphere of influence.
+float LightBVH::importance(const Node &node, const glm::vec3 &position) const {
+    if (glm::any(glm::lessThan(position, node.min)) || glm::any(glm::greaterThan(position, node.max))) {
+        return 0.0f;
+    }
+    glm::vec3 offset = position - 0.5f * (node.centreMin + node.centreMax);
+    glm::vec3 extent = node.centreMax - node.centreMin;
+    float distance2 = std::max(glm::dot(offset, offset), std::max(0.25f * glm::dot(extent, extent), 1e-4f));
+    return node.power / distance2;
+}
+
+// Estimated contribution of a single light: brightest channel x attenuation x cosine. The
+// cosine term is kept above zero, because the specular term can light points facing away.
+float LightBVH::importance(int light, const glm::vec3 &position, const glm::vec3 &normal) const {
+    const SceneLightData &data = (*m_lights)[light];
+    const glm::vec4 &sphere = m_spheres[light];
+    glm::vec3 toLight = glm::vec3(sphere) - position;
+    float distance2 = glm::dot(toLight, toLight);
+    if (distance2 > sphere.w * sphere.w) {
+        return 0.0f;
+    }
+    float distance = std::sqrt(distance2);
+    glm::vec3 directionToLight = distance > 0.0f ? toLight / distance : normal;
+
+    // Outside the cone (with some margin for rounding) a spot light contributes nothing
+    if (data.type == LightType::LIGHT_SPOT) {
+        glm::vec3 axis = glm::normalize(glm::vec3(data.dir));
+        float angle = std::acos(std::clamp(glm::dot(-directionToLight, axis), -1.0f, 1.0f));
+        if (angle > data.angle + 1e-3f) {
+            return 0.0f;
+        }
+    }
+
+    float attenuation = std::min(1.0f, 1.0f / (data.function.x + distance * data.function.y + distance2 * data.function.z));
+    float cosine = std::max(glm::dot(normal, directionToLight), 0.0f);
+    return std::max(data.color.r, std::max(data.color.g, data.color.b)) * attenuation * (0.1f + 0.9f * cosine);
+}
+
+bool LightBVH::sample(const glm::vec4 &position, const glm::vec3 &normal, float u, int &lightIndex, float &pdf) const {
+    if (m_nodes.empty()) {
+        return false;
+    }
+    glm::vec3 p(position);
+    pdf = 1.0f;
+    int index = 0;
+    if (importance(m_nodes[0], p) <= 0.0f) {
+        return false;
+    }
+
+    // Descend, choosing each child in proportion to its importance and reusing `u`
+    RenderCounters &counters = threadCounters();
+    counters.lightBvhNodes++;
+    while (m_nodes[index].count == 0) {
+        counters.lightBvhNodes += 2;
+        int left = index + 1;
+        int right = m_nodes[index].first;
+        float leftImportance = importance(m_nodes[left], p);
+        float rightImportance = importance(m_nodes[right], p);
+        float total = leftImportance + rightImportance;
+        if (!(total > 0.0f)) {
+            return false;
+        }
+        float leftProbability = leftImportance / total;
+        if (u < leftProbability) {
+            u = u / leftProbability;
+            pdf *= leftProbability;
+            index = left;
+        } else {
+            u = (u - leftProbability) / (1.0f - leftProbability);
+            pdf *= 1.0f - leftProbability;
+            index = right;
+        }
+        u = std::min(u, 0.99999994f);
+    }
+
+    const Node &leaf = m_nodes[index];
+    float weights[kLeafSize];
+    float total = 0.0f;
+    for (int i = 0; i < leaf.count; i++) {
+        weights[i] = importance(m_order[leaf.first + i], p, normal);
+        total += weights[i];
+    }
+    if (!(total > 0.0f)) {
+        return false;
+    }
+    float target = u * total;
+    int chosen = 0;
+    while (chosen < leaf.count - 1 && (target >= weights[chosen] || weights[chosen] == 0.0f)) {
+        target -= weights[chosen];
+        chosen++;
+    }
+    if (weights[chosen] == 0.0f) {
+        return false;
+    }
+    lightIndex = m_order[leaf.first + chosen];
+    pdf *= weights[chosen] / total;
+    return true;
+}
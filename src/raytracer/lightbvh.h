@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/scenedata.h"
+
+// A bounding volume hierarchy over the point and spot lights' spheres of influence, so that a
+// shading point only visits the lights that can still contribute there. A light's influence
+// radius is the distance at which its brightest colour channel times its attenuation drops
+// below a threshold; with a threshold of 0 every radius is infinite.
+// Each node also stores the total power of its lights, so the hierarchy doubles as a light
+// tree for picking lights in proportion to their estimated contribution.
+// Directional lights are not in the hierarchy and are returned for every point.
+class LightBVH {
+public:
+    // @param lights    The scene's lights; must outlive the BVH.
+    // @param threshold Contribution below which a light is ignored; 0 keeps every light.
+    void build(const std::vector<SceneLightData> &lights, float threshold);
+
+    // Replaces `lightIndices` with the indices of the lights that may reach `position`,
+    // in increasing order so that lights are accumulated in scene order.
+    void query(const glm::vec4 &position, std::vector<int> &lightIndices) const;
+
+    // Picks one of the point and spot lights that may reach `position`, with probability
+    // proportional to an estimate of its contribution there (power x attenuation x cosine).
+    // Every light that can contribute has a non-zero probability, so weighting its shading by
+    // 1 / pdf is unbiased.
+    // @param u   A uniform random number in [0, 1).
+    // @return    False if no light can reach the point.
+    bool sample(const glm::vec4 &position, const glm::vec3 &normal, float u, int &lightIndex, float &pdf) const;
+
+    // Lights outside the hierarchy, which reach every point
+    const std::vector<int> &unboundedLights() const;
+
+    // Distance beyond which `light` contributes less than `threshold`; infinity if it never does.
+    static float influenceRadius(const SceneLightData &light, float threshold);
+
+private:
+    struct Node {
+        glm::vec3 min;        // Bounds of the lights' spheres of influence
+        glm::vec3 max;
+        glm::vec3 centreMin;  // Bounds of the lights' positions
+        glm::vec3 centreMax;
+        float power;          // Sum of the lights' brightest colour channels
+        int first; // Leaves: first entry in m_order; inner nodes: index of the right child
+        int count; // Number of lights in a leaf; 0 for inner nodes, whose left child follows them
+    };
+
+    int buildNode(int first, int count);
+    float importance(const Node &node, const glm::vec3 &position) const;
+    float importance(int light, const glm::vec3 &position, const glm::vec3 &normal) const;
+
+    const std::vector<SceneLightData> *m_lights = nullptr;
+    std::vector<Node> m_nodes;
+    std::vector<int> m_order;             // Light indices, grouped by leaf
+    std::vector<glm::vec4> m_spheres;     // Centre and radius of each light's influence, by light index
+    std::vector<int> m_unbounded;
+};
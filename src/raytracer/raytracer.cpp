@@ -1,10 +1,264 @@
 #include "raytracer.h"
+#include "boundingspheres.h"
 #include "QtGui/qimage.h"
 #include "raytracescene.h"
 #include "intersect.h"
 #include "illuminate.h"
 #include "utils/rgba.h"
+#include "utils/tracing.h"
+#include <QtConcurrent>
+#include <QThread>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <utility>
+
+namespace {
+
+// rayTracer() recurses while depth <= 4, so a path has at most six segments
+const int kMaxPathSegments = 6;
+
+// Pixels traced together by the wavefront renderer; bounds the size of its queues
+const int kWavefrontBatch = 1 << 16;
+// Smallest batch the parallel wavefront renderer splits the image into
+const int kMinParallelWavefrontBatch = 1 << 10;
+
+// Width and height of the tiles the image is rendered in
+const int kTileSize = 16;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Measures one pixel in a CostMetric: the change in the thread's counters, or the time,
+// between start() and stop()
+class PixelCost {
+public:
+    PixelCost(CostMetric metric, const RenderCounters &counters) : m_metric(metric), m_counters(counters) {}
+
+    bool enabled() const {
+        return m_metric != CostMetric::COST_NONE;
+    }
+
+    void start() {
+        if (m_metric == CostMetric::COST_TIME){
+            m_start = std::chrono::steady_clock::now();
+        } else if (enabled()){
+            m_work = work();
+        }
+    }
+
+    float stop() const {
+        if (m_metric == CostMetric::COST_TIME){
+            return float(secondsSince(m_start) * 1e6);
+        }
+        return float(work() - m_work);
+    }
+
+private:
+    std::uint64_t work() const {
+        if (m_metric == CostMetric::COST_RAYS){
+            return m_counters.primaryRays + m_counters.reflectionRays + m_counters.shadowRays;
+        }
+        std::uint64_t tests = 0;
+        for (std::uint64_t count : m_counters.intersectionTests){
+            tests += count;
+        }
+        return tests;
+    }
+
+    CostMetric m_metric;
+    const RenderCounters &m_counters;
+    std::chrono::steady_clock::time_point m_start;
+    std::uint64_t m_work = 0;
+};
+
+struct WavefrontRay {
+    glm::vec4 origin;
+    glm::vec4 dir;
+    RayCone cone;
+    int pixel; // Within the current batch
+    int depth;
+};
+
+struct ShadowQuery {
+    glm::vec4 position;
+    glm::vec4 directionToLight;
+    float distanceToLight;
+    size_t slot; // Index of the (hit, light) pair in the batch's light lists
+};
+
+// A uniform number in [0, 1) that depends only on the shading point, the sample and the seed,
+// so light sampling is deterministic and independent of the order pixels are rendered in
+float sampleHash(const glm::vec4 &position, int sample, std::uint32_t seed) {
+    std::uint32_t h = seed * 0x9e3779b9u ^ std::uint32_t(sample) * 0x85ebca6bu;
+    for (int i = 0; i < 3; i++){
+        std::uint32_t bits;
+        std::memcpy(&bits, &position[i], sizeof(bits));
+        h ^= bits + 0x9e3779b9u + (h << 6) + (h >> 2);
+    }
+    // Final avalanche (from MurmurHash3)
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return (h >> 8) * (1.0f / (1u << 24));
+}
+
+// Whether `features` is a combination RayTracer::features() can return: FEATURE_SHADOW_CACHE
+// only comes with FEATURE_SHADOWS
+constexpr bool validFeatures(std::uint32_t features) {
+    return features <= RayTracer::FEATURE_ALL &&
+           (!(features & RayTracer::FEATURE_SHADOW_CACHE) || (features & RayTracer::FEATURE_SHADOWS));
+}
+
+template <std::uint32_t Features, typename F>
+auto callFeatures(F &f) {
+    return f.template operator()<Features>();
+}
+
+// The entry of the dispatch table for `Features`, which is null unless it is valid
+template <std::uint32_t Features, typename F>
+constexpr auto featureEntry() {
+    using Call = decltype(&callFeatures<0, F>);
+    if constexpr (validFeatures(Features)){
+        return Call(&callFeatures<Features, F>);
+    } else {
+        return Call(nullptr);
+    }
+}
+
+template <typename F, std::uint32_t... Features>
+auto dispatchFeatures(std::uint32_t features, F &f, std::integer_sequence<std::uint32_t, Features...>) {
+    static constexpr decltype(&callFeatures<0, F>) table[] = {featureEntry<Features, F>()...};
+    assert(validFeatures(features) && "not a combination RayTracer::features() returns");
+    return table[features](f);
+}
+
+// Calls `f.template operator()<Features>()` with the runtime `features` as a compile-time
+// constant, through a table with an instantiation of `f` for every valid combination of
+// RayTracer::Feature bits
+template <typename F>
+auto dispatchFeatures(std::uint32_t features, F &&f) {
+    return dispatchFeatures(features, f, std::make_integer_sequence<std::uint32_t, RayTracer::FEATURE_ALL + 1>());
+}
+
+// Spreads the low 10 bits of `x` out to every third bit, for 3D Morton codes
+std::uint64_t spreadBits(std::uint64_t x) {
+    x &= 0x3ff;
+    x = (x | x << 16) & 0x30000ff;
+    x = (x | x << 8) & 0x300f00f;
+    x = (x | x << 4) & 0x30c30c3;
+    x = (x | x << 2) & 0x9249249;
+    return x;
+}
+
+std::uint64_t morton(const glm::vec3 &cell) {
+    return spreadBits(cell.x) | spreadBits(cell.y) << 1 | spreadBits(cell.z) << 2;
+}
+
+// Reorders a queue of rays so that neighbours start in the same grid cell and travel in
+// similar directions, which keeps the shapes they test and the texels they read in cache.
+// Rays sharing their origin, like primary rays, end up sorted by direction.
+template <typename T, typename Origin, typename Direction>
+void sortCoherent(std::vector<T> &items, Origin origin, Direction direction) {
+    if (items.size() < 2){
+        return;
+    }
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(std::numeric_limits<float>::lowest());
+    for (const T &item : items){
+        glm::vec3 o = glm::vec3(origin(item));
+        lo = glm::min(lo, o);
+        hi = glm::max(hi, o);
+    }
+    glm::vec3 scale = 1023.0f / glm::max(hi - lo, glm::vec3(1e-6f));
+
+    std::vector<std::pair<std::uint64_t, std::uint32_t>> keys(items.size());
+    for (size_t i = 0; i < items.size(); i++){
+        glm::vec3 cell = (glm::vec3(origin(items[i])) - lo) * scale;
+        glm::vec3 d = glm::vec3(direction(items[i]));
+        float length = glm::length(d);
+        if (length > 0.0f){
+            d /= length;
+        }
+        glm::vec3 dirCell = (d + 1.0f) * (0.5f * 1023.0f);
+        keys[i] = {morton(cell) << 30 | morton(dirCell), std::uint32_t(i)};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<T> sorted;
+    sorted.reserve(items.size());
+    for (const auto &key : keys){
+        sorted.push_back(items[key.second]);
+    }
+    items.swap(sorted);
+}
+
+// Each mipmap level of a texture after the first: a 2x2 box filter of the level above, down
+// to 1x1. An odd row or column is averaged with itself.
+void buildMipmaps(std::vector<TextureLevel> &levels) {
+    while (levels.back().width > 1 || levels.back().height > 1){
+        const TextureLevel &above = levels.back();
+        TextureLevel level{nullptr, std::max(above.width / 2, 1), std::max(above.height / 2, 1)};
+        level.data = new RGBA[level.width * level.height];
+        for (int y = 0; y < level.height; y++){
+            int y0 = std::min(2 * y, above.height - 1);
+            int y1 = std::min(2 * y + 1, above.height - 1);
+            for (int x = 0; x < level.width; x++){
+                int x0 = std::min(2 * x, above.width - 1);
+                int x1 = std::min(2 * x + 1, above.width - 1);
+                const RGBA texels[4] = {above.data[y0 * above.width + x0], above.data[y0 * above.width + x1],
+                                        above.data[y1 * above.width + x0], above.data[y1 * above.width + x1]};
+                int r = 0, g = 0, b = 0, a = 0;
+                for (const RGBA &texel : texels){
+                    r += texel.r;
+                    g += texel.g;
+                    b += texel.b;
+                    a += texel.a;
+                }
+                level.data[y * level.width + x] = RGBA{std::uint8_t((r + 2) / 4), std::uint8_t((g + 2) / 4),
+                                                       std::uint8_t((b + 2) / 4), std::uint8_t((a + 2) / 4)};
+            }
+        }
+        levels.push_back(level);
+    }
+}
+
+// Whether an object-space point of a cylinder or cone lies on one of its flat caps
+bool onCap(const glm::vec4 &object_point) {
+    return std::abs(std::abs(object_point.y) - 0.5f) <= 0.001f;
+}
+
+// Distance from the y axis of an object-space point, kept away from zero at the poles and apex
+float radialDistance(const glm::vec4 &object_point) {
+    return std::max(std::sqrt(object_point.x * object_point.x + object_point.z * object_point.z), 1e-3f);
+}
+
+// Object-space length of one repetition of the texture along u and v around a hit, following
+// the uv_* mappings of Illuminate: faces and caps span the unit square, and the curved sides
+// wrap u once around the y axis
+glm::vec2 textureSpan(PrimitiveType type, const glm::vec4 &object_point) {
+    const float pi = 3.14159265f;
+    switch (type){
+    case PrimitiveType::PRIMITIVE_SPHERE:
+        return glm::vec2(2.0f * pi * radialDistance(object_point), 0.5f * pi);
+    case PrimitiveType::PRIMITIVE_CYLINDER:
+    case PrimitiveType::PRIMITIVE_CONE:
+        if (onCap(object_point)){
+            return glm::vec2(1.0f);
+        }
+        return glm::vec2(2.0f * pi * radialDistance(object_point), 1.0f);
+    default:
+        return glm::vec2(1.0f);
+    }
+}
+
+}
 
 /**
  * @brief Stores the image specified from the input file in this class's
@@ -41,183 +295,685 @@ RayTracer::RayTracer(Config config) :
     m_config(config)
 {}
 
+RayTracer::~RayTracer() {
+    for (auto &[filename, texture] : m_textureCache) {
+        delete[] texture.data;
+        for (size_t level = 1; level < texture.levels.size(); level++) {
+            delete[] texture.levels[level].data;
+        }
+    }
+}
+
+void RayTracer::prepare(const RayTraceScene &scene) {
+    TraceScope scope("compile", "RayTracer::prepare");
+    auto start = std::chrono::steady_clock::now();
+    metaData = scene.getMetaData();
+    globalData = metaData.globalData;
+    primiTypes = metaData.shapes;
+    lights = metaData.lights;
+    bool textured = m_config.enableTextureMap;
+    {
+        TraceScope buildScope("compile", "LightBVH::build");
+        m_lightBVH.build(lights, m_config.lightCullThreshold);
+    }
+
+    materials.resize(metaData.materials.size());
+    for (size_t m = 0; m < metaData.materials.size(); m++){
+        const SceneMaterial &sceneMaterial = metaData.materials[m];
+        ShadingMaterial &material = materials[m];
+        material.cAmbient = sceneMaterial.cAmbient;
+        material.cDiffuse = sceneMaterial.cDiffuse;
+        material.cSpecular = sceneMaterial.cSpecular;
+        material.cReflective = sceneMaterial.cReflective;
+        material.shininess = sceneMaterial.shininess;
+        // Without texture mapping, textured materials are shaded with their diffuse colour
+        material.blend = textured ? sceneMaterial.blend : 0.0f;
+        material.texture = nullptr;
+        material.t_width = material.t_height = 0;
+        material.levels = nullptr;
+        material.levelCount = 0;
+        material.repeatU = sceneMaterial.textureMap.repeatU;
+        material.repeatV = sceneMaterial.textureMap.repeatV;
+        if (textured && sceneMaterial.textureMap.isUsed){
+            // Decode each texture file once, however many materials use it
+            const std::string &filename = sceneMaterial.textureMap.filename;
+            if (!m_textureCache.contains(filename)){
+                TraceScope textureScope("io", "loadTextureFromFile");
+                textureScope.addArg("file", filename);
+                RGBA* texture_map = loadTextureFromFile(QString::fromStdString(filename));
+                Texture &texture = m_textureCache[filename];
+                texture = Texture{texture_map, t_width, t_height, {TextureLevel{texture_map, t_width, t_height}}};
+                if (texture_map != nullptr && m_config.enableTextureFilter){
+                    buildMipmaps(texture.levels);
+                }
+            }
+            const Texture &texture = m_textureCache[filename];
+            material.texture = texture.data;
+            material.t_width = texture.width;
+            material.t_height = texture.height;
+            material.levels = texture.levels.data();
+            material.levelCount = int(texture.levels.size());
+        }
+    }
+
+    ctms.resize(primiTypes.size());
+    inv_ctms.resize(primiTypes.size());
+    for (int s = 0; s < primiTypes.size(); s++){
+        ctms[s] = primiTypes[s].ctm;
+        inv_ctms[s] = glm::inverse(primiTypes[s].ctm);
+    }
+    if (m_config.enableAcceleration){
+        TraceScope buildScope("compile", "Accelerator::build");
+        m_accelerator = Accelerator::build(m_config.accelerationStructure, primiTypes, m_config.enableParallelism);
+    } else {
+        m_accelerator = std::make_unique<BoundingSpheres>(primiTypes);
+    }
+    m_prepared = true;
+    m_timings.compile += secondsSince(start);
+}
+
+bool RayTracer::updateTransforms(const std::vector<int> &shapes, const std::vector<glm::mat4> &new_ctms) {
+    if (!m_prepared || shapes.size() != new_ctms.size()){
+        return false;
+    }
+    for (int s : shapes){
+        if (s < 0 || s >= int(primiTypes.size())){
+            return false;
+        }
+    }
+    TraceScope scope("compile", "RayTracer::updateTransforms");
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < shapes.size(); i++){
+        int s = shapes[i];
+        primiTypes[s].ctm = new_ctms[i];
+        ctms[s] = new_ctms[i];
+        inv_ctms[s] = glm::inverse(new_ctms[i]);
+    }
+    if (m_accelerator && !m_accelerator->refit(primiTypes, shapes)){
+        TraceScope buildScope("compile", "Accelerator::build");
+        m_accelerator = Accelerator::build(m_config.accelerationStructure, primiTypes, m_config.enableParallelism);
+    }
+    m_timings.compile += secondsSince(start);
+    return true;
+}
+
+std::uint32_t RayTracer::features() const {
+    bool shadows = m_config.enableShadow && m_config.shadowMode != ShadowMode::SHADOW_NONE;
+    bool cached = shadows && m_config.shadowMode == ShadowMode::SHADOW_CACHED;
+    return (shadows ? std::uint32_t(FEATURE_SHADOWS) : 0u) |
+           (m_config.enableReflection ? std::uint32_t(FEATURE_REFLECTION) : 0u) |
+           (m_config.enableTextureMap ? std::uint32_t(FEATURE_TEXTURE) : 0u) |
+           (cached ? std::uint32_t(FEATURE_SHADOW_CACHE) : 0u);
+}
+
+void RayTracer::flushCounters() {
+    RenderCounters &counters = threadCounters();
+    std::lock_guard<std::mutex> lock(m_countersMutex);
+    m_counters += counters;
+    counters = RenderCounters{};
+}
+
+const RenderCounters &RayTracer::counters() const {
+    return m_counters;
+}
+
+const RenderTimings &RayTracer::timings() const {
+    return m_timings;
+}
+
+const std::vector<float> &RayTracer::costMap() const {
+    return m_costMap;
+}
+
+const AccelerationStats &RayTracer::accelerationStats() const {
+    static const AccelerationStats none;
+    return m_accelerator ? m_accelerator->stats() : none;
+}
+
 void RayTracer::render(RGBA *imageData, const RayTraceScene &scene) {
     // Note that we're passing `data` as a pointer (to its first element)
     // Recall from Lab 1 that you can access its elements like this: `data[i]`
+    if (!m_prepared){
+        prepare(scene);
+    }
+    renderFrame(imageData, scene, scene.getMetaData().cameraData);
+}
 
-    // TODO: Implement the ray tracing algorithm. Good luck!
-
+void RayTracer::renderFrame(RGBA *imageData, const RayTraceScene &scene, const SceneCameraData &cameraData) {
     int height = scene.height();
     int width = scene.width();
-    int depth = 0;
     camera = scene.getCamera();
-    metaData = scene.getMetaData();
-    cameradata = metaData.cameraData;
-    globalData = metaData.globalData;
-    primiTypes = metaData.shapes;
-    lights = metaData.lights;
+    cameradata = cameraData;
     viewMatrix = camera.getViewMatrix(cameradata);
     glm::mat4 inv_viewMatrix = glm::inverse(viewMatrix);
-    Intersect intersect;
+    // The wavefront stages interleave pixels, so per-pixel costs need the depth-first renderer
+    bool wavefront = m_config.enableWavefront && m_config.costMetric == CostMetric::COST_NONE;
+    if (m_config.costMetric != CostMetric::COST_NONE){
+        m_costMap.assign(size_t(width) * height, 0.0f);
+    }
+    TraceScope scope("render", "RayTracer::renderFrame");
+    auto start = std::chrono::steady_clock::now();
+    dispatchFeatures(features(), [&]<std::uint32_t Features>() {
+        if (wavefront){
+            renderWavefront<Features>(imageData, width, height, inv_viewMatrix);
+        } else {
+            renderPixels<Features>(imageData, width, height, inv_viewMatrix);
+        }
+    });
+    m_timings.render += secondsSince(start);
+}
+
+template <std::uint32_t Features>
+void RayTracer::renderPixels(RGBA *imageData, int width, int height, const glm::mat4 &inv_viewMatrix) {
+    struct Tile {
+        int x0, y0, x1, y1;
+    };
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += kTileSize){
+        for (int x = 0; x < width; x += kTileSize){
+            tiles.push_back(Tile{x, y, std::min(x + kTileSize, width), std::min(y + kTileSize, height)});
+        }
+    }
+
+    auto render = [&](const Tile &tile) {
+        renderTile<Features>(imageData, width, height, inv_viewMatrix, tile.x0, tile.y0, tile.x1, tile.y1);
+    };
+    if (m_config.enableParallelism){
+        QtConcurrent::blockingMap(tiles, render);
+    } else {
+        std::for_each(tiles.begin(), tiles.end(), render);
+    }
+}
+
+template <std::uint32_t Features>
+void RayTracer::renderTile(RGBA *imageData, int width, int height, const glm::mat4 &inv_viewMatrix,
+                           int x0, int y0, int x1, int y1) {
+    TraceScope scope("render", "tile");
+    if (scope.active()){
+        scope.addArg("x", x0);
+        scope.addArg("y", y0);
+    }
+    int depth = 0;
     Illuminate illuminate;
-    for (int s = 0; s < primiTypes.size(); s++){
-        if (primiTypes[s].primitive.material.textureMap.isUsed){
-            QString filename = QString::fromStdString(primiTypes[s].primitive.material.textureMap.filename);
-            RGBA* texture_map = loadTextureFromFile(filename);
-            textures[primiTypes[s].primitive.type] = texture_map;
-            t_widths[primiTypes[s].primitive.type] = t_width;
-            t_heights[primiTypes[s].primitive.type] = t_height;
+    ShadowCache shadowCache;
+    LightSelection selection;
+    RenderCounters &counters = threadCounters();
+    PixelCost pixelCost(m_config.costMetric, counters);
+    RayCone cone = primaryCone(height);
+    if constexpr (bool(Features & FEATURE_SHADOW_CACHE)){
+        shadowCache.receiver.assign(lights.size(), -1);
+        shadowCache.occluder.assign(lights.size(), -1);
+        shadowCache.reused.assign(lights.size(), 0);
+    }
+    for (int j = y0; j < y1; j++){
+        if constexpr (bool(Features & FEATURE_SHADOW_CACHE)){
+            // The previous pixel of a row's first one is the end of the row above, not a
+            // neighbour, so lit results are not carried over. Occluders still are, since
+            // retesting one is exact.
+            std::fill(shadowCache.receiver.begin(), shadowCache.receiver.end(), -1);
+            std::fill(shadowCache.reused.begin(), shadowCache.reused.end(), 0);
         }
-        ctms[s] = primiTypes[s].ctm;
-        inv_ctms[s] = glm::inverse(primiTypes[s].ctm);
+        for (int i = x0; i < x1; i++){
+            glm::vec4 world_eye;
+            glm::vec4 world_d;
+            pixelCost.start();
+            primaryRay(i, j, width, height, inv_viewMatrix, world_eye, world_d);
+            counters.primaryRays++;
+
+            imageData[j * width + i] = illuminate.toRGBA(trace<Features>(world_eye, world_d, primiTypes, depth, cone, selection, &shadowCache));
+            if (pixelCost.enabled()){
+                m_costMap[size_t(j) * width + i] = pixelCost.stop();
+            }
+        }
+    }
+    flushCounters();
+}
+
+void RayTracer::primaryRay(int i, int j, int width, int height, const glm::mat4 &inv_viewMatrix,
+                           glm::vec4 &world_eye, glm::vec4 &world_d) {
+    float k = 1.0;
+    float x = (i+0.5)/width - 0.5;
+    float y = (height - 1 - j +0.5)/height -0.5;
+    float V = 2 * k * tan(camera.getHeightAngle(cameradata)/2.0);
+    float U = camera.getAspectRatio(width, height) * V;
+    glm::vec4 uvk = glm::vec4(U*x, V*y, -k, 1.0);
+    glm::vec4 eye = glm::vec4(0.0, 0.0, 0.0, 1.0);
+    glm::vec4 d = uvk - eye;
+
+    world_eye =  inv_viewMatrix * eye;
+    world_d = inv_viewMatrix * d;
+}
+
+RayCone RayTracer::primaryCone(int height) {
+    return RayCone{0.0f, float(2.0 * tan(camera.getHeightAngle(cameradata) / 2.0) / height)};
+}
+
+bool RayTracer::intersectShape(int s, const glm::vec4 &world_eye, const glm::vec4 &world_d, float &t, glm::vec4 &object_point) {
+    Intersect intersect;
+    const RenderShapeData &curr_shape = primiTypes[s];
+    const glm::mat4 &inv_ctm = inv_ctms[s];
+    glm::vec4 object_eye = inv_ctm * world_eye;
+    glm::vec4 object_d = inv_ctm * world_d;
+    threadCounters().intersectionTests[int(curr_shape.type)]++;
+
+    switch(curr_shape.type){
+    case PrimitiveType::PRIMITIVE_CUBE:
+        return intersect.intersect_cube(object_eye, object_d, t, object_point);
+    case PrimitiveType::PRIMITIVE_CONE:
+        return intersect.intersect_cone(object_eye, object_d, t, object_point);
+    case PrimitiveType::PRIMITIVE_CYLINDER:
+        return intersect.intersect_cylinder(object_eye, object_d, t, object_point);
+    case PrimitiveType::PRIMITIVE_SPHERE:
+        return intersect.intersect_sphere(object_eye, object_d, t, object_point);
+    default:
+        return false;
     }
-    for (int j = 0; j < height; j++){
-        for (int i = 0; i < width; i++){
-            float k = 1.0;
-            float x = (i+0.5)/width - 0.5;
-            float y = (height - 1 - j +0.5)/height -0.5;
-            float V = 2 * k * tan(camera.getHeightAngle(cameradata)/2.0);
-            float U = camera.getAspectRatio(width, height) * V;
-            glm::vec4 uvk = glm::vec4(U*x, V*y, -k, 1.0);
-            glm::vec4 eye = glm::vec4(0.0, 0.0, 0.0, 1.0);
-            glm::vec4 d = uvk - eye;
+}
 
-            world_eye =  inv_viewMatrix * eye;
-            world_d = inv_viewMatrix * d;
+bool RayTracer::closestHit(const glm::vec4 &world_eye, const glm::vec4 &world_d, Hit &hit) {
+    // Only the shape index and the object-space hit point are recorded, so the normal and
+    // texture are evaluated once, for the final hit only. Structures may visit shapes out of
+    // index order, so ties go to the lower index, as in a loop over every shape.
+    class ClosestHitVisitor : public ShapeVisitor {
+    public:
+        ClosestHitVisitor(RayTracer &raytracer, const glm::vec4 &eye, const glm::vec4 &d, Hit &hit)
+            : m_raytracer(raytracer), m_eye(eye), m_d(d), m_hit(hit) {}
 
-            imageData[j * width + i] = illuminate.toRGBA(rayTracer(world_eye, world_d, primiTypes, depth));
+        float visit(int s, float tMax) override {
+            float t;
+            glm::vec4 object_point;
+            if (m_raytracer.intersectShape(s, m_eye, m_d, t, object_point) &&
+                (t < tMax || (t == tMax && s < m_hit.shape))){
+                m_hit.t = t;
+                m_hit.shape = s;
+                m_hit.object_point = object_point;
+                threadCounters().closerHits++;
+                return t;
+            }
+            return tMax;
+        }
+
+    private:
+        RayTracer &m_raytracer;
+        const glm::vec4 &m_eye;
+        const glm::vec4 &m_d;
+        Hit &m_hit;
+    };
 
+    hit.shape = -1;
+    ClosestHitVisitor visitor(*this, world_eye, world_d, hit);
+    m_accelerator->traverse(glm::vec3(world_eye), glm::vec3(world_d), std::numeric_limits<float>::max(), visitor);
+    return hit.shape >= 0;
+}
+
+template <std::uint32_t Features>
+void RayTracer::surface(const Hit &hit, const glm::vec4 &world_d, float footprint, glm::vec3 &world_normal, glm::vec4 &texture) {
+    constexpr bool textured = Features & FEATURE_TEXTURE;
+    Intersect intersect;
+    Illuminate illuminate;
+    const RenderShapeData &shape = primiTypes[hit.shape];
+    const ShadingMaterial &sceneMaterial = materials[shape.material];
+    glm::mat4 ctm = ctms[hit.shape];
+    glm::vec4 object_point = hit.object_point;
+    texture = glm::vec4(0.0, 0.0, 0.0, 0.0);
+
+    switch(shape.type){
+    case PrimitiveType::PRIMITIVE_CUBE:
+        world_normal = intersect.normal_cube(object_point, ctm);
+        break;
+    case PrimitiveType::PRIMITIVE_CONE:
+        world_normal = intersect.normal_cone(object_point, ctm);
+        break;
+    case PrimitiveType::PRIMITIVE_CYLINDER:
+        world_normal = intersect.normal_cylinder(object_point, ctm);
+        break;
+    case PrimitiveType::PRIMITIVE_SPHERE:
+        world_normal = intersect.normal_sphere(object_point, ctm);
+        break;
+    default:
+        return;
+    }
+    if (!textured || sceneMaterial.texture == nullptr){
+        return;
+    }
+    threadCounters().textureFetches++;
+
+    // Pick the mipmap level whose texels are as wide as the ray's footprint, stretched by the
+    // angle it meets the surface at. The texture is nearest-sampled within that level.
+    const TextureLevel *level = &sceneMaterial.levels[0];
+    if (m_config.enableTextureFilter && footprint > 0.0f && sceneMaterial.levelCount > 1){
+        float cosine = std::abs(glm::dot(glm::normalize(world_normal), glm::normalize(glm::vec3(world_d))));
+        float scale = (glm::length(glm::vec3(ctm[0])) + glm::length(glm::vec3(ctm[1])) + glm::length(glm::vec3(ctm[2]))) / 3.0f;
+        glm::vec2 span = textureSpan(shape.type, object_point) * scale;
+        float texels = std::max(sceneMaterial.repeatU * level->width / span.x, sceneMaterial.repeatV * level->height / span.y);
+        float lod = std::log2(footprint / std::max(cosine, 0.1f) * texels);
+        level += std::clamp(int(std::lround(lod)), 0, sceneMaterial.levelCount - 1);
     }
 
+    switch(shape.type){
+    case PrimitiveType::PRIMITIVE_CUBE:
+        texture = illuminate.uv_cube(object_point, level->data, level->width, level->height,
+                                     sceneMaterial.repeatU, sceneMaterial.repeatV);
+        break;
+    case PrimitiveType::PRIMITIVE_CONE:
+        texture = illuminate.uv_cone(object_point, level->data, level->width, level->height,
+                                     sceneMaterial.repeatU, sceneMaterial.repeatV);
+        break;
+    case PrimitiveType::PRIMITIVE_CYLINDER:
+        texture = illuminate.uv_cylinder(object_point, level->data, level->width, level->height,
+                                         sceneMaterial.repeatU, sceneMaterial.repeatV);
+        break;
+    default:
+        texture = illuminate.uv_sphere(object_point, level->data, level->width, level->height,
+                                       sceneMaterial.repeatU, sceneMaterial.repeatV);
+        break;
+    }
 }
+
+RayCone RayTracer::reflectCone(const RayCone &cone, const Hit &hit, float footprint) const {
+    // A curved mirror of radius r widens the reflected cone by twice its footprint over r
+    const glm::mat4 &ctm = ctms[hit.shape];
+    float curvature = 0.0f;
+    switch(primiTypes[hit.shape].type){
+    case PrimitiveType::PRIMITIVE_SPHERE:
+        curvature = 1.0f / (0.5f * (glm::length(glm::vec3(ctm[0])) + glm::length(glm::vec3(ctm[1])) +
+                                    glm::length(glm::vec3(ctm[2]))) / 3.0f);
+        break;
+    case PrimitiveType::PRIMITIVE_CYLINDER:
+    case PrimitiveType::PRIMITIVE_CONE:
+        if (!onCap(hit.object_point)){
+            curvature = 1.0f / (radialDistance(hit.object_point) *
+                                (glm::length(glm::vec3(ctm[0])) + glm::length(glm::vec3(ctm[2]))) / 2.0f);
+        }
+        break;
+    default:
+        break;
+    }
+    return RayCone{footprint, cone.spread + 2.0f * footprint * curvature};
 }
 
-glm::vec4 RayTracer::rayTracer(glm::vec4 world_eye, glm::vec4 world_d, std::vector<RenderShapeData> primiTypes, int depth){
+void RayTracer::selectLights(const glm::vec4 &position, const glm::vec3 &normal,
+                             std::vector<int> &indices, std::vector<float> &weights) const {
+    if (m_config.lightSamples <= 0){
+        m_lightBVH.query(position, indices);
+        weights.clear();
+        return;
+    }
+
+    const std::vector<int> &unbounded = m_lightBVH.unboundedLights();
+    indices.assign(unbounded.begin(), unbounded.end());
+    weights.assign(unbounded.size(), 1.0f);
+    glm::vec3 n = glm::normalize(normal);
+    for (int s = 0; s < m_config.lightSamples; s++){
+        int light;
+        float pdf;
+        if (m_lightBVH.sample(position, n, sampleHash(position, s, m_config.lightSampleSeed), light, pdf)){
+            indices.push_back(light);
+            weights.push_back(1.0f / (m_config.lightSamples * pdf));
+        }
+    }
+}
+
+glm::vec4 RayTracer::rayTracer(glm::vec4 world_eye, glm::vec4 world_d, const std::vector<RenderShapeData> &primiTypes, int depth){
+    return dispatchFeatures(features(), [&]<std::uint32_t Features>() {
+        LightSelection selection;
+        glm::vec4 color = trace<Features>(world_eye, world_d, primiTypes, depth, RayCone{}, selection);
+        flushCounters();
+        return color;
+    });
+}
+
+glm::vec4 RayTracer::shadeCached(const Hit &hit, const glm::vec4 &position, const glm::vec3 &world_normal,
+                                 const glm::vec3 &directionToCamera, const ShadingMaterial &material, const glm::vec4 &texture,
+                                 const std::vector<int> &lightIndices, const std::vector<float> &lightWeights, ShadowCache &cache) {
+    Illuminate illuminate;
+    glm::vec3 normal = glm::normalize(world_normal);
+    glm::vec3 toCamera = glm::normalize(directionToCamera);
+    glm::vec4 illumination = illuminate.ambient(material, globalData);
+    for (size_t i = 0; i < lightIndices.size(); i++){
+        int l = lightIndices[i];
+        glm::vec4 directionToLight;
+        float distanceToLight;
+        if (!illuminate.shadowRay(lights[l], position, directionToLight, distanceToLight)){
+            continue;
+        }
+        int &occluder = cache.occluder[l];
+        bool lit;
+        if (occluder >= 0 && illuminate.occludes(primiTypes[occluder], inv_ctms[occluder], position, directionToLight, distanceToLight)){
+            lit = false;
+        } else if (occluder < 0 && cache.receiver[l] == hit.shape && !cache.reused[l]){
+            lit = true;
+            cache.reused[l] = 1;
+        } else {
+            occluder = illuminate.occluder(position, primiTypes, inv_ctms, directionToLight, distanceToLight, m_accelerator.get());
+            cache.receiver[l] = hit.shape;
+            cache.reused[l] = 0;
+            lit = occluder < 0;
+        }
+        if (lit){
+            illuminate.addLight(lights[l], position, normal, toCamera, material, texture, globalData, illumination,
+                                lightWeights.empty() ? 1.0f : lightWeights[i]);
+        }
+    }
+    return illumination;
+}
+
+template <std::uint32_t Features>
+glm::vec4 RayTracer::trace(glm::vec4 world_eye, glm::vec4 world_d, const std::vector<RenderShapeData> &primiTypes, int depth,
+                           RayCone cone, LightSelection &selection, ShadowCache *shadowCache){
 
     glm::vec4 color;
 
-    Intersect intersect;
     Illuminate illuminate;
 
-    float tMin = std::numeric_limits<float>::max();
-    glm::vec4 texture(0.0, 0.0, 0.0, 0.0);
     float epsilon = 0.001f;
-    glm::vec4 real_ray;
-    glm::vec3 world_normal;
-    SceneMaterial currsceneMaterial;
-    glm::vec3 directionToCamera;
-    bool inter_success = false;
-    float t;
-    glm::vec4 ray;
-    for (int s = 0; s < primiTypes.size(); s++){
+    glm::vec3 directionToCamera = glm::vec3(-world_d.x, -world_d.y, -world_d.z);
 
-        RenderShapeData curr_shape = primiTypes[s];
-        RGBA* texture_map = textures[curr_shape.primitive.type];
-        int w = t_widths[curr_shape.primitive.type];
-        int h = t_heights[curr_shape.primitive.type];
-        glm::mat4 ctm = ctms[s];
-        glm::mat4 inv_ctm = inv_ctms[s];
-        SceneMaterial sceneMaterial = curr_shape.primitive.material;
-        glm::vec4 object_eye = inv_ctm * world_eye;
-        glm::vec4 object_d = inv_ctm * world_d;
-
-
-        directionToCamera = glm::vec3(-world_d.x, -world_d.y, -world_d.z);
-
-        switch(curr_shape.primitive.type){
-        case PrimitiveType::PRIMITIVE_CUBE:{
-            bool success = intersect.intersect_cube(object_eye, object_d, t, ray);
-            if (success){
-                inter_success = true;
-                if (t < tMin){
-                    tMin = t;
-                    real_ray = ray;
-                    currsceneMaterial = sceneMaterial;
-                    world_normal = intersect.normal_cube(ray, ctm);
-                    if (curr_shape.primitive.material.textureMap.isUsed){
-                        int repeatedU = curr_shape.primitive.material.textureMap.repeatU;
-                        int repeatedV = curr_shape.primitive.material.textureMap.repeatV;
-                        texture = illuminate.uv_cube(ray, texture_map, w, h, repeatedU, repeatedV);
-                    }
+    Hit hit;
+    if (closestHit(world_eye, world_d, hit)){
+        threadCounters().shadedHits++;
+        const ShadingMaterial &currsceneMaterial = materials[primiTypes[hit.shape].material];
+        glm::vec3 world_normal;
+        glm::vec4 texture;
+        float footprint = cone.width + cone.spread * hit.t * glm::length(world_d);
+        surface<Features>(hit, world_d, footprint, world_normal, texture);
+
+        glm::vec4 intersect_position = world_eye + hit.t * world_d;
+        selectLights(intersect_position, world_normal, selection.indices, selection.weights);
+        if (bool(Features & FEATURE_SHADOW_CACHE) && shadowCache != nullptr){
+            color = shadeCached(hit, intersect_position, world_normal, directionToCamera, currsceneMaterial, texture,
+                                selection.indices, selection.weights, *shadowCache);
+        } else {
+            color = illuminate.phong<bool(Features & FEATURE_SHADOWS)>(intersect_position, primiTypes, inv_ctms, world_normal, directionToCamera,
+                                                                       currsceneMaterial, texture, lights, selection.indices, selection.weights, globalData,
+                                                                       m_accelerator.get());
+        }
+        if constexpr (bool(Features & FEATURE_REFLECTION)){
+            glm::vec4 reflectiveness = currsceneMaterial.cReflective;
+            if ((reflectiveness.x > 0.0f || reflectiveness.y > 0.0f || reflectiveness.z > 0.0f) && depth <= 4){
+                glm::vec3 coming_ray = glm::vec3(world_d.x, world_d.y, world_d.z);
+                world_eye = intersect_position + epsilon * glm::vec4(world_normal, 0.0f);
+                world_d = glm::vec4(glm::reflect(coming_ray, world_normal), 0.0);
+                threadCounters().reflectionRays++;
+                RayCone reflected = m_config.enableTextureFilter ? reflectCone(cone, hit, footprint) : RayCone{};
+                color += globalData.ks * trace<Features>(world_eye, world_d, primiTypes, depth + 1, reflected, selection);
+            }
+        }
+
+        return color;
+    }
+    return glm::vec4(0.0, 0.0, 0.0, 255.0);
+
+}
+
+template <std::uint32_t Features>
+void RayTracer::renderWavefront(RGBA *imageData, int width, int height, const glm::mat4 &inv_viewMatrix) {
+    // A shaded point waiting for its shadow rays
+    struct SurfacePoint {
+        int ray;
+        glm::vec4 position;
+        glm::vec3 world_normal;
+        glm::vec4 texture;
+        const ShadingMaterial *material;
+        RayCone reflected; // Cone of the reflection ray, if there is one
+    };
+
+    float epsilon = 0.001f;
+    int pixels = width * height;
+    int batchSize = kWavefrontBatch;
+    if (m_config.enableParallelism){
+        // Enough batches to keep every core busy, each still large enough to sort
+        batchSize = std::clamp(pixels / (4 * QThread::idealThreadCount()), kMinParallelWavefrontBatch, kWavefrontBatch);
+    }
+    std::vector<int> batches;
+    for (int first = 0; first < pixels; first += batchSize){
+        batches.push_back(first);
+    }
+
+    auto render = [&](int first) {
+        int count = std::min(batchSize, pixels - first);
+        Illuminate illuminate;
+        std::vector<WavefrontRay> rays;
+        std::vector<WavefrontRay> reflected;
+        std::vector<SurfacePoint> surfaces;
+        std::vector<ShadowQuery> shadowQueries;
+        // The lights each hit may see, as ranges of hitLights, their weights, and whether they are unoccluded
+        std::vector<int> visibleLights;
+        std::vector<float> lightWeights;
+        std::vector<int> hitLights;
+        std::vector<float> hitWeights;
+        std::vector<size_t> hitLightStart;
+        std::vector<char> lit;
+        // Colour of every segment of every path, folded back to front once the batch is done
+        std::vector<glm::vec4> segments;
+        std::vector<int> segmentCount;
+
+        TraceScope scope("render", "wavefront batch");
+        scope.addArg("first", first);
+        segments.assign(size_t(count) * kMaxPathSegments, glm::vec4(0.0f));
+        segmentCount.assign(count, 0);
+
+        rays.resize(count);
+        RayCone cone = primaryCone(height);
+        for (int p = 0; p < count; p++){
+            WavefrontRay &ray = rays[p];
+            primaryRay((first + p) % width, (first + p) / width, width, height, inv_viewMatrix, ray.origin, ray.dir);
+            ray.cone = cone;
+            ray.pixel = p;
+            ray.depth = 0;
+            threadCounters().primaryRays++;
+        }
+
+        while (!rays.empty()){
+            // Intersection stage: closest hits, and the surface at each of them
+            sortCoherent(rays, [](const WavefrontRay &ray) { return ray.origin; },
+                         [](const WavefrontRay &ray) { return ray.dir; });
+            surfaces.clear();
+            for (int r = 0; r < rays.size(); r++){
+                const WavefrontRay &ray = rays[r];
+                Hit hit;
+                if (!closestHit(ray.origin, ray.dir, hit)){
+                    segments[size_t(ray.pixel) * kMaxPathSegments + ray.depth] = glm::vec4(0.0, 0.0, 0.0, 255.0);
+                    segmentCount[ray.pixel] = ray.depth + 1;
+                    continue;
                 }
+                threadCounters().shadedHits++;
+                SurfacePoint point;
+                point.ray = r;
+                point.position = ray.origin + hit.t * ray.dir;
+                point.material = &materials[primiTypes[hit.shape].material];
+                float footprint = ray.cone.width + ray.cone.spread * hit.t * glm::length(ray.dir);
+                surface<Features>(hit, ray.dir, footprint, point.world_normal, point.texture);
+                if (m_config.enableTextureFilter){
+                    point.reflected = reflectCone(ray.cone, hit, footprint);
+                }
+                surfaces.push_back(point);
             }
-            break;
-        }
-        case PrimitiveType::PRIMITIVE_CONE:{
-            bool success = intersect.intersect_cone(object_eye, object_d, t, ray);
-            if (success){
-                inter_success = true;
-                if (t < tMin){
-                    tMin = t;
-                    real_ray = ray;
-                    currsceneMaterial = sceneMaterial;
-                    world_normal = intersect.normal_cone(ray, ctm);
-                    if (curr_shape.primitive.material.textureMap.isUsed){
-                        int repeatedU = curr_shape.primitive.material.textureMap.repeatU;
-                        int repeatedV = curr_shape.primitive.material.textureMap.repeatV;
-                        texture = illuminate.uv_cone(ray, texture_map, w, h, repeatedU, repeatedV);
+
+            // Shadow stage: one query per hit and light that can reach it
+            shadowQueries.clear();
+            hitLights.clear();
+            hitWeights.clear();
+            hitLightStart.assign(1, 0);
+            for (size_t h = 0; h < surfaces.size(); h++){
+                selectLights(surfaces[h].position, surfaces[h].world_normal, visibleLights, lightWeights);
+                for (size_t i = 0; i < visibleLights.size(); i++){
+                    int l = visibleLights[i];
+                    ShadowQuery query;
+                    query.position = surfaces[h].position;
+                    query.slot = hitLights.size();
+                    hitLights.push_back(l);
+                    hitWeights.push_back(lightWeights.empty() ? 1.0f : lightWeights[i]);
+                    if (illuminate.shadowRay(lights[l], query.position, query.directionToLight, query.distanceToLight)){
+                        shadowQueries.push_back(query);
                     }
                 }
+                hitLightStart.push_back(hitLights.size());
             }
-            break;
-        }
-        case PrimitiveType::PRIMITIVE_CYLINDER:{
-            bool success = intersect.intersect_cylinder(object_eye, object_d, t, ray);
-            if (success){
-                inter_success = true;
-                if (t < tMin){
-                    tMin = t;
-                    real_ray = ray;
-                    currsceneMaterial = sceneMaterial;
-                    world_normal = intersect.normal_cylinder(ray, ctm);
-                    if (curr_shape.primitive.material.textureMap.isUsed){
-                        int repeatedU = curr_shape.primitive.material.textureMap.repeatU;
-                        int repeatedV = curr_shape.primitive.material.textureMap.repeatV;
-                        texture = illuminate.uv_cylinder(ray, texture_map, w, h, repeatedU, repeatedV);
-                    }
+            lit.assign(hitLights.size(), 0);
+            if constexpr (bool(Features & FEATURE_SHADOWS)){
+                sortCoherent(shadowQueries, [](const ShadowQuery &query) { return query.position; },
+                             [](const ShadowQuery &query) { return query.directionToLight; });
+                for (const ShadowQuery &query : shadowQueries){
+                    lit[query.slot] = !illuminate.has_shadow(query.position, primiTypes, inv_ctms, query.directionToLight, query.distanceToLight,
+                                                             m_accelerator.get());
+                }
+            } else {
+                for (const ShadowQuery &query : shadowQueries){
+                    lit[query.slot] = 1;
                 }
             }
-            break;
-        }
-        case PrimitiveType::PRIMITIVE_SPHERE:{
-            bool success = intersect.intersect_sphere(object_eye, object_d, t, ray);
-            if (success){
-                inter_success = true;
-                if (t < tMin){
-                    tMin = t;
-                    real_ray = ray;
-                    currsceneMaterial = sceneMaterial;
-                    world_normal = intersect.normal_sphere(ray, ctm);
-                    if (curr_shape.primitive.material.textureMap.isUsed){
-                        int repeatedU = curr_shape.primitive.material.textureMap.repeatU;
-                        int repeatedV = curr_shape.primitive.material.textureMap.repeatV;
-                        texture = illuminate.uv_sphere(ray, texture_map, w, h, repeatedU, repeatedV);
+
+            // Shading stage, which also queues the reflection rays for the next bounce
+            reflected.clear();
+            for (size_t h = 0; h < surfaces.size(); h++){
+                const SurfacePoint &point = surfaces[h];
+                const WavefrontRay &ray = rays[point.ray];
+                glm::vec3 normal = glm::normalize(point.world_normal);
+                glm::vec3 directionToCamera = glm::normalize(glm::vec3(-ray.dir.x, -ray.dir.y, -ray.dir.z));
+                glm::vec4 illumination = illuminate.ambient(*point.material, globalData);
+                for (size_t k = hitLightStart[h]; k < hitLightStart[h + 1]; k++){
+                    if (lit[k]){
+                        illuminate.addLight(lights[hitLights[k]], point.position, normal, directionToCamera, *point.material,
+                                            point.texture, globalData, illumination, hitWeights[k]);
                     }
                 }
+                segments[size_t(ray.pixel) * kMaxPathSegments + ray.depth] = illumination;
+                segmentCount[ray.pixel] = ray.depth + 1;
+
+                glm::vec4 reflectiveness = point.material->cReflective;
+                if (bool(Features & FEATURE_REFLECTION) &&
+                    (reflectiveness.x > 0.0f || reflectiveness.y > 0.0f || reflectiveness.z > 0.0f) && ray.depth <= 4){
+                    glm::vec3 coming_ray = glm::vec3(ray.dir.x, ray.dir.y, ray.dir.z);
+                    WavefrontRay next;
+                    next.origin = point.position + epsilon * glm::vec4(point.world_normal, 0.0f);
+                    next.dir = glm::vec4(glm::reflect(coming_ray, point.world_normal), 0.0);
+                    next.cone = point.reflected;
+                    next.pixel = ray.pixel;
+                    next.depth = ray.depth + 1;
+                    reflected.push_back(next);
+                    threadCounters().reflectionRays++;
+                }
             }
-            break;
+            rays.swap(reflected);
         }
-        default:
-            break;
 
-     }
-}
-
-    if (inter_success){
-        glm::vec4 intersect_position = world_eye + tMin * world_d;
-        color = illuminate.phong(intersect_position, primiTypes, world_normal, directionToCamera, currsceneMaterial, texture, lights, globalData);
-        glm::vec4 reflectiveness = currsceneMaterial.cReflective;
-        if ((reflectiveness.x > 0.0f || reflectiveness.y > 0.0f || reflectiveness.z > 0.0f) && depth <= 4){
-            glm::vec3 coming_ray = glm::vec3(world_d.x, world_d.y, world_d.z);
-            world_eye = intersect_position + epsilon * glm::vec4(world_normal, 0.0f);
-            world_d = glm::vec4(glm::reflect(coming_ray, world_normal), 0.0);
-            color += globalData.ks * rayTracer(world_eye, world_d, primiTypes, depth + 1);
+        // Combine each path back to front, the same way rayTracer's recursion does
+        for (int p = 0; p < count; p++){
+            const glm::vec4 *path = &segments[size_t(p) * kMaxPathSegments];
+            glm::vec4 color = path[segmentCount[p] - 1];
+            for (int d = segmentCount[p] - 2; d >= 0; d--){
+                glm::vec4 segment = path[d];
+                segment += globalData.ks * color;
+                color = segment;
+            }
+            imageData[first + p] = illuminate.toRGBA(color);
         }
-
-        return color;
+        flushCounters();
+    };
+    if (m_config.enableParallelism){
+        QtConcurrent::blockingMap(batches, render);
+    } else {
+        std::for_each(batches.begin(), batches.end(), render);
     }
-    return glm::vec4(0.0, 0.0, 0.0, 255.0);
-
 }
-
-
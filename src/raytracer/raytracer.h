@@ -1,16 +1,72 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <glm/glm.hpp>
 #include "QtCore/qstring.h"
 #include "utils/rgba.h"
 #include "raytracer.h"
 #include "raytracescene.h"
+#include "lightbvh.h"
+#include "accelerator.h"
+#include "utils/renderstats.h"
 
 // A forward declaration for the RaytraceScene class
 
 class RayTraceScene;
 
+// One mipmap level of a decoded texture
+struct TextureLevel {
+    RGBA *data;
+    int width;
+    int height;
+};
+
+// The parts of a SceneMaterial read while tracing and shading, with the texture already
+// decoded. Unlike SceneMaterial it holds no strings, so it is cheap to keep in a flat table.
+struct ShadingMaterial {
+    SceneColor cAmbient;
+    SceneColor cDiffuse;
+    SceneColor cSpecular;
+    SceneColor cReflective;
+    float shininess;
+    float blend;
+
+    RGBA *texture; // Decoded texture map, or nullptr when the material has none
+    int t_width;
+    int t_height;
+    int repeatU;
+    int repeatV;
+    const TextureLevel *levels; // The texture, then with enableTextureFilter each mipmap down to 1x1
+    int levelCount;
+};
+
+// The footprint of a ray, as a cone that is `width` wide at the ray's origin and widens by
+// `spread` per unit of distance along it (the ray cones of Akenine-Möller et al., "Texture
+// Level of Detail Strategies for Real-Time Ray Tracing"). Rays without a pixel have a zero cone,
+// and sample the full-size texture.
+struct RayCone {
+    float width = 0.0f;
+    float spread = 0.0f;
+};
+
+// How shadow rays are traced when shadows are enabled
+enum class ShadowMode {
+    SHADOW_NONE,   // No shadow rays; every light reaches every point it faces
+    SHADOW_HARD,   // One shadow ray per light and shading point
+    SHADOW_CACHED  // Primary hits reuse the previous pixel's result for a light when it hit the same shape
+};
+
+// What RayTracer::costMap() records for each pixel, including its shadow and reflection rays
+enum class CostMetric {
+    COST_NONE,  // Nothing is recorded
+    COST_TESTS, // Ray-shape intersection tests
+    COST_RAYS,  // Primary, reflection and shadow rays
+    COST_TIME   // Microseconds spent tracing the pixel
+};
+
 // A class representing a ray-tracer
 
 class RayTracer
@@ -21,13 +77,30 @@ public:
         bool enableReflection    = false;
         bool enableRefraction    = false;
         bool enableTextureMap    = false;
-        bool enableTextureFilter = false;
+        bool enableTextureFilter = false; // Samples the mipmap level that matches each ray's cone
         bool enableParallelism   = false;
         bool enableSuperSample   = false;
         bool enableAcceleration  = false;
         bool enableDepthOfField  = false;
         int maxRecursiveDepth    = 4;
         bool onlyRenderNormals   = false;
+        bool enableWavefront     = false;
+        ShadowMode shadowMode    = ShadowMode::SHADOW_HARD; // Only used when enableShadow is set
+        float lightCullThreshold = 0.0f; // See LightBVH; 0 never culls a light that can contribute
+        int lightSamples         = 0;    // Point and spot lights sampled per shading point; 0 shades them all
+        std::uint32_t lightSampleSeed = 0;
+        CostMetric costMetric    = CostMetric::COST_NONE; // Renders depth-first even if enableWavefront is set
+        AccelerationStructure accelerationStructure = AccelerationStructure::ACCEL_BVH; // Only used when enableAcceleration is set
+    };
+
+    // The Config features the trace and shade loops are compiled for. Each render dispatches
+    // once to the instantiation for its Config, so a disabled feature costs nothing per ray.
+    enum Feature : std::uint32_t {
+        FEATURE_SHADOWS      = 1 << 0,
+        FEATURE_REFLECTION   = 1 << 1,
+        FEATURE_TEXTURE      = 1 << 2,
+        FEATURE_SHADOW_CACHE = 1 << 3, // ShadowMode::SHADOW_CACHED, set together with FEATURE_SHADOWS
+        FEATURE_ALL          = (1 << 4) - 1,
     };
 
     Camera camera;
@@ -35,11 +108,9 @@ public:
     SceneCameraData cameradata;
     SceneGlobalData globalData;
     std::vector<RenderShapeData> primiTypes;
-    std::map<PrimitiveType, RGBA*> textures;
-    std::map<PrimitiveType, int> t_widths;
-    std::map<PrimitiveType, int> t_heights;
-    std::map<int, glm::mat4> ctms;
-    std::map<int, glm::mat4> inv_ctms;
+    std::vector<ShadingMaterial> materials; // Indexed by material ID
+    std::vector<glm::mat4> ctms;     // Indexed like primiTypes
+    std::vector<glm::mat4> inv_ctms;
     std::vector<SceneLightData> lights;
     glm::mat4 viewMatrix;
 
@@ -48,19 +119,140 @@ public:
 
 public:
     RayTracer(Config config);
+    ~RayTracer();
 
     int t_width;
     int t_height;
     RGBA* loadTextureFromFile(const QString &file);
 
+    // Compiles the scene for rendering: decodes textures, caches the per-shape matrices, and
+    // builds the acceleration structure, or without enableAcceleration, each shape's bounding
+    // sphere (see BoundingSpheres).
+    // Called once by the first render; frames rendered afterwards reuse the compiled scene.
+    // @param scene The scene to be rendered.
+    void prepare(const RayTraceScene &scene);
+
+    // Moves shapes of the prepared scene for the next frames: sets the ctm of every shape in
+    // `shapes` (indices into RenderData::shapes) to the matching entry of `new_ctms`. The
+    // acceleration structure is refitted to the new bounds, and rebuilt instead when it cannot
+    // be refitted or refitting has made it too slow to trace. Counted as compile time.
+    // @return False, changing nothing, if the scene has not been prepared, the two vectors
+    // differ in length, or a shape index is out of range.
+    bool updateTransforms(const std::vector<int> &shapes, const std::vector<glm::mat4> &new_ctms);
+
     // Renders the scene synchronously.
     // The ray-tracer will render the scene and fill imageData in-place.
     // @param imageData The pointer to the imageData to be filled.
     // @param scene The scene to be rendered.
     void render(RGBA *imageData, const RayTraceScene &scene);
-    glm::vec4 rayTracer(glm::vec4 world_eye, glm::vec4 world_d, std::vector<RenderShapeData> primiTypes, int depth);
+
+    // Work done by every render so far. Worker threads count privately and add their totals
+    // at the end of each tile. Shading is deferred to the final hit of each ray, so
+    // closerHits - shadedHits is the number of normal and texture evaluations this saves.
+    const RenderCounters &counters() const;
+    // Time spent in prepare() and rendering; parse and save are left to the caller
+    const RenderTimings &timings() const;
+    // The cost of each pixel of the last frame in Config::costMetric, in row-major order.
+    // Empty when the metric is COST_NONE.
+    const std::vector<float> &costMap() const;
+    // The acceleration structure built by prepare(); its structure is null without one
+    const AccelerationStats &accelerationStats() const;
+
+    // Renders one frame of the (already prepared) scene as seen from `cameraData`.
+    // Used for animated sequences, where only the camera changes between frames.
+    void renderFrame(RGBA *imageData, const RayTraceScene &scene, const SceneCameraData &cameraData);
+    glm::vec4 rayTracer(glm::vec4 world_eye, glm::vec4 world_d, const std::vector<RenderShapeData> &primiTypes, int depth);
 
 private:
+    // The closest intersection along a ray: which shape, and where in its object space
+    struct Hit {
+        float t;
+        int shape;
+        glm::vec4 object_point;
+    };
+
+    // The Feature bits enabled by m_config
+    std::uint32_t features() const;
+
+    void primaryRay(int i, int j, int width, int height, const glm::mat4 &inv_viewMatrix,
+                    glm::vec4 &world_eye, glm::vec4 &world_d);
+    // The cone of a primary ray: zero width at the eye, spreading by one pixel per unit of distance
+    RayCone primaryCone(int height);
+    bool closestHit(const glm::vec4 &world_eye, const glm::vec4 &world_d, Hit &hit);
+    // Intersects the ray with shape `s` in its object space
+    bool intersectShape(int s, const glm::vec4 &world_eye, const glm::vec4 &world_d, float &t, glm::vec4 &object_point);
+    // Evaluates the world-space normal and, for textured materials, the texture at a hit.
+    // `footprint` is the width of the ray's cone there, which picks the texture's mipmap level
+    // with enableTextureFilter.
+    template <std::uint32_t Features>
+    void surface(const Hit &hit, const glm::vec4 &world_d, float footprint, glm::vec3 &world_normal, glm::vec4 &texture);
+    // The cone of the ray reflected at `hit`, where the incoming cone was `footprint` wide.
+    // Curved surfaces spread it further, like a convex mirror.
+    RayCone reflectCone(const RayCone &cone, const Hit &hit, float footprint) const;
+    // The shadow ray results of the previous pixel in a tile row, by light index
+    struct ShadowCache {
+        std::vector<int> receiver;  // Shape the light was last tested from, or -1
+        std::vector<int> occluder;  // Shape that blocked it, or -1 if it was unoccluded
+        std::vector<char> reused;   // Whether an unoccluded result was already reused once
+    };
+    // The lights selectLights() chose for a hit. Kept per tile and refilled at every hit, so
+    // shading does not allocate; a hit is fully shaded before its reflection is traced.
+    struct LightSelection {
+        std::vector<int> indices;
+        std::vector<float> weights;
+    };
+
+    // rayTracer() for a fixed set of features, for a ray with footprint `cone`. `selection` is
+    // scratch space for the lights of each hit. Primary rays pass the tile's shadow cache,
+    // which is only used with FEATURE_SHADOW_CACHE.
+    template <std::uint32_t Features>
+    glm::vec4 trace(glm::vec4 world_eye, glm::vec4 world_d, const std::vector<RenderShapeData> &primiTypes, int depth,
+                    RayCone cone, LightSelection &selection, ShadowCache *shadowCache = nullptr);
+    // phong() for SHADOW_CACHED. A light that was blocked at the previous pixel is first tested
+    // against the same occluder only, which is exact. An unoccluded result is reused for the
+    // next pixel of the same tile row if it hit the same shape, which can move the start of a
+    // shadow by one pixel.
+    glm::vec4 shadeCached(const Hit &hit, const glm::vec4 &position, const glm::vec3 &world_normal,
+                          const glm::vec3 &directionToCamera, const ShadingMaterial &material, const glm::vec4 &texture,
+                          const std::vector<int> &lightIndices, const std::vector<float> &lightWeights, ShadowCache &cache);
+    // Renders the image in square tiles, on worker threads if enableParallelism is set
+    template <std::uint32_t Features>
+    void renderPixels(RGBA *imageData, int width, int height, const glm::mat4 &inv_viewMatrix);
+    template <std::uint32_t Features>
+    void renderTile(RGBA *imageData, int width, int height, const glm::mat4 &inv_viewMatrix,
+                    int x0, int y0, int x1, int y1);
+    // Adds the calling thread's counters to m_counters
+    void flushCounters();
+    // Chooses the lights to shade `position` with. Normally these are all the lights that can
+    // reach it, and `weights` is left empty. With light sampling, directional lights are kept
+    // and lightSamples point and spot lights are picked from the light tree, each weighted by
+    // 1 / (lightSamples * pdf) so the expected result matches shading every light.
+    void selectLights(const glm::vec4 &position, const glm::vec3 &normal,
+                      std::vector<int> &indices, std::vector<float> &weights) const;
+
+    // Breadth-first alternative to calling rayTracer() per pixel: every stage (closest hits,
+    // shadow rays, reflection rays) runs over a whole batch of rays, sorted for coherence,
+    // before the next one starts. Produces the same image as the depth-first renderer, except
+    // that SHADOW_CACHED traces every shadow ray like SHADOW_HARD. With enableParallelism,
+    // batches are rendered on worker threads.
+    template <std::uint32_t Features>
+    void renderWavefront(RGBA *imageData, int width, int height, const glm::mat4 &inv_viewMatrix);
+
     const Config m_config;
+    bool m_prepared = false;
+    LightBVH m_lightBVH;
+    std::unique_ptr<Accelerator> m_accelerator; // Built by prepare(): BoundingSpheres unless enableAcceleration is set
+    RenderCounters m_counters;
+    std::mutex m_countersMutex;
+    RenderTimings m_timings;
+    std::vector<float> m_costMap;
+
+    struct Texture {
+        RGBA *data;
+        int width;
+        int height;
+        std::vector<TextureLevel> levels; // Level 0 is `data` itself
+    };
+    std::map<std::string, Texture> m_textureCache; // Decoded textures by filename, shared between materials
 };
 
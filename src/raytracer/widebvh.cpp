@@ -0,0 +1,226 @@
+#include "widebvh.h"
+#include "utils/renderstats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) && !defined(RAY_NO_SIMD)
+#define RAY_WIDEBVH_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Entries in the traversal stack: up to three children are left behind at each level
+const int kStackSize = 256;
+
+// Direction components are kept at least this far from zero, so that quantized box tests
+// never multiply zero by infinity
+const float kMinDirection = 1e-30f;
+
+// The smallest exponent whose 255 steps cover `extent`
+std::int8_t quantizationExponent(float extent) {
+    if (extent <= 0.0f) {
+        return -100;
+    }
+    int exponent;
+    std::frexp(extent * 1.0001f / 255.0f, &exponent);
+    return std::int8_t(std::clamp(exponent, -100, 127));
+}
+
+}
+
+WideBVH::WideBVH(const std::vector<RenderShapeData> &shapes, bool parallel) {
+    BVH binary(shapes, AccelerationStructure::ACCEL_BVH, parallel);
+    m_order = binary.order();
+    double cost = 0.0;
+    if (!binary.nodes().empty()) {
+        m_nodes.reserve(binary.nodes().size() / 2 + 1);
+        collapse(binary.nodes(), 0, cost);
+        cost /= std::max(binary.nodes()[0].bounds.surfaceArea(), 1e-30f);
+    }
+    m_stats.nodes = m_nodes.size();
+    m_stats.references = m_order.size();
+    m_stats.sahCost = cost;
+}
+
+int WideBVH::collapse(const std::vector<BVH::Node> &binary, int node, double &cost) {
+    // Start from the two children, and open the largest inner child until there are four
+    int children[kWidth];
+    int childCount = 0;
+    if (binary[node].count > 0) {
+        children[childCount++] = node;
+    } else {
+        children[childCount++] = node + 1;
+        children[childCount++] = binary[node].first;
+        while (childCount < kWidth) {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for (int i = 0; i < childCount; i++) {
+                const BVH::Node &child = binary[children[i]];
+                if (child.count == 0 && child.bounds.surfaceArea() > largestArea) {
+                    largest = i;
+                    largestArea = child.bounds.surfaceArea();
+                }
+            }
+            if (largest < 0) {
+                break;
+            }
+            // Keep the children in the binary tree's order
+            int opened = children[largest];
+            std::copy_backward(children + largest + 1, children + childCount, children + childCount + 1);
+            children[largest] = opened + 1;
+            children[largest + 1] = binary[opened].first;
+            childCount++;
+        }
+    }
+
+    const Bounds &bounds = binary[node].bounds;
+    Node wide{};
+    wide.childCount = std::uint8_t(childCount);
+    float step[3];
+    for (int axis = 0; axis < 3; axis++) {
+        wide.origin[axis] = bounds.min[axis];
+        wide.exponent[axis] = quantizationExponent(bounds.max[axis] - bounds.min[axis]);
+        step[axis] = std::ldexp(1.0f, wide.exponent[axis]);
+    }
+    for (int i = 0; i < childCount; i++) {
+        const Bounds &box = binary[children[i]].bounds;
+        for (int axis = 0; axis < 3; axis++) {
+            // Round outwards, then step further out wherever float rounding still cuts the box
+            float origin = wide.origin[axis];
+            int lo = std::clamp(int(std::floor((box.min[axis] - origin) / step[axis])), 0, 255);
+            int hi = std::clamp(int(std::ceil((box.max[axis] - origin) / step[axis])), 0, 255);
+            while (lo > 0 && origin + lo * step[axis] > box.min[axis]) {
+                lo--;
+            }
+            while (hi < 255 && origin + hi * step[axis] < box.max[axis]) {
+                hi++;
+            }
+            wide.lo[axis][i] = std::uint8_t(lo);
+            wide.hi[axis][i] = std::uint8_t(hi);
+        }
+    }
+    cost += BVH::kNodeCost * bounds.surfaceArea();
+
+    int index = int(m_nodes.size());
+    m_nodes.push_back(wide);
+    for (int i = 0; i < childCount; i++) {
+        const BVH::Node &child = binary[children[i]];
+        if (child.count > 0) {
+            m_nodes[index].child[i] = child.first;
+            m_nodes[index].count[i] = std::uint8_t(child.count);
+            cost += BVH::kShapeCost * child.count * child.bounds.surfaceArea();
+        } else {
+            int collapsed = collapse(binary, children[i], cost);
+            m_nodes[index].child[i] = collapsed;
+        }
+    }
+    return index;
+}
+
+int WideBVH::intersectChildren(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDir, float tMax,
+                               float tNear[kWidth]) const {
+    // A bound q steps from the node's corner is met at t = q * (step * invDir) + (corner - origin) * invDir
+#ifdef RAY_WIDEBVH_SSE
+    __m128 enter = _mm_setzero_ps();
+    __m128 exit = _mm_set1_ps(tMax);
+    __m128i zero = _mm_setzero_si128();
+    for (int axis = 0; axis < 3; axis++) {
+        __m128 scale = _mm_set1_ps(std::ldexp(invDir[axis], node.exponent[axis]));
+        __m128 offset = _mm_set1_ps((node.origin[axis] - origin[axis]) * invDir[axis]);
+        std::int32_t loBytes, hiBytes;
+        std::memcpy(&loBytes, node.lo[axis], sizeof(loBytes));
+        std::memcpy(&hiBytes, node.hi[axis], sizeof(hiBytes));
+        __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(loBytes), zero), zero));
+        __m128 hi = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(hiBytes), zero), zero));
+        __m128 t0 = _mm_add_ps(_mm_mul_ps(lo, scale), offset);
+        __m128 t1 = _mm_add_ps(_mm_mul_ps(hi, scale), offset);
+        enter = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+        exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+    }
+    _mm_storeu_ps(tNear, enter);
+    int mask = _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+#else
+    float tFar[kWidth];
+    for (int i = 0; i < kWidth; i++) {
+        tNear[i] = 0.0f;
+        tFar[i] = tMax;
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        float scale = std::ldexp(invDir[axis], node.exponent[axis]);
+        float offset = (node.origin[axis] - origin[axis]) * invDir[axis];
+        for (int i = 0; i < kWidth; i++) {
+            float t0 = node.lo[axis][i] * scale + offset;
+            float t1 = node.hi[axis][i] * scale + offset;
+            tNear[i] = std::max(tNear[i], std::min(t0, t1));
+            tFar[i] = std::min(tFar[i], std::max(t0, t1));
+        }
+    }
+    int mask = 0;
+    for (int i = 0; i < kWidth; i++) {
+        mask |= (tNear[i] <= tFar[i]) << i;
+    }
+#endif
+    return mask & ((1 << node.childCount) - 1);
+}
+
+void WideBVH::traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const {
+    if (m_nodes.empty()) {
+        return;
+    }
+    glm::vec3 invDir;
+    for (int axis = 0; axis < 3; axis++) {
+        float d = std::abs(dir[axis]) < kMinDirection ? std::copysign(kMinDirection, dir[axis]) : dir[axis];
+        invDir[axis] = 1.0f / d;
+    }
+
+    // Children waiting to be visited, with the parameter the ray enters them at
+    struct Entry {
+        float tNear;
+        int child;
+        int count;
+    };
+    Entry stack[kStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = Entry{0.0f, 0, 0};
+    RenderCounters &counters = threadCounters();
+    while (stackSize > 0) {
+        Entry entry = stack[--stackSize];
+        if (entry.tNear > tMax) {
+            continue;
+        }
+        if (entry.count > 0) {
+            for (int i = entry.child; i < entry.child + entry.count; i++) {
+                tMax = visitor.visit(m_order[i], tMax);
+                if (tMax < 0.0f) {
+                    return;
+                }
+            }
+            continue;
+        }
+
+        const Node &node = m_nodes[entry.child];
+        counters.accelerationNodes++;
+        float tNear[kWidth];
+        int mask = intersectChildren(node, origin, invDir, tMax, tNear);
+        // Push the hit children farthest first, so the nearest one is visited next
+        int hits[kWidth];
+        int hitCount = 0;
+        for (int i = 0; i < kWidth; i++) {
+            if (mask & (1 << i)) {
+                int j = hitCount++;
+                while (j > 0 && tNear[hits[j - 1]] < tNear[i]) {
+                    hits[j] = hits[j - 1];
+                    j--;
+                }
+                hits[j] = i;
+            }
+        }
+        for (int h = 0; h < hitCount; h++) {
+            int i = hits[h];
+            stack[stackSize++] = Entry{tNear[i], node.child[i], node.count[i]};
+        }
+    }
+}
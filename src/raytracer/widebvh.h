@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+
+// A 4-wide BVH made by collapsing the binary SAH tree of BVH: each node holds up to four
+// children, and a ray tests all four of their boxes at once. The boxes are quantized to 8 bits
+// per side on a power-of-two grid anchored at the node's corner, so a node fits in one 64-byte
+// cache line, and the tree takes half the memory of the binary one. Quantized boxes are
+// rounded outwards, so they never cull a hit. The box tests use SSE where it is available,
+// unless RAY_NO_SIMD is defined, and a scalar loop otherwise. Children are quantized against
+// their parent's box, so moving shapes means rebuilding rather than refitting the tree.
+class WideBVH : public Accelerator {
+public:
+    WideBVH(const std::vector<RenderShapeData> &shapes, bool parallel);
+
+    void traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, ShapeVisitor &visitor) const override;
+
+private:
+    static constexpr int kWidth = 4;
+
+    struct alignas(64) Node {
+        float origin[3];                  // Corner of the node's bounds
+        std::int8_t exponent[3];          // Quantization steps are 2^exponent along each axis
+        std::uint8_t childCount;          // Children are packed at the front
+        std::uint8_t lo[3][kWidth];       // Lower child bounds in steps from the origin, by axis
+        std::uint8_t hi[3][kWidth];       // Upper child bounds in steps from the origin, by axis
+        std::int32_t child[kWidth];       // Leaves: first entry in m_order; inner nodes: index of the child node
+        std::uint8_t count[kWidth];       // Number of shapes in a leaf child; 0 for inner children
+    };
+    static_assert(sizeof(Node) == 64, "a WideBVH node should fill one cache line");
+
+    // Appends the node collapsed from binary node `node`, then its subtrees, and returns its
+    // index. Adds the SAH cost of the subtree, times the root's surface area, to `cost`.
+    int collapse(const std::vector<BVH::Node> &binary, int node, double &cost);
+    // Entry and exit parameters of the ray against each child box of `node`.
+    // @return A bit mask of the children the ray meets within [0, tMax].
+    int intersectChildren(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDir, float tMax,
+                          float tNear[kWidth]) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<int> m_order; // Shape indices, grouped by leaf
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A bump allocator: objects are carved out of large blocks and all released together when
+// the arena is destroyed, instead of costing one malloc and one free each. Pointers stay
+// valid for the arena's lifetime. Objects with non-trivial destructors are destroyed in
+// reverse order of creation.
+class Arena {
+public:
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena() {
+        clear();
+    }
+
+    template <typename T, typename... Args>
+    T *create(Args &&...args) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+        T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            m_destructors.push_back(Destructor{object, [](void *p) { static_cast<T *>(p)->~T(); }});
+        }
+        return object;
+    }
+
+    // Destroys every object and frees every block.
+    void clear() {
+        for (auto it = m_destructors.rbegin(); it != m_destructors.rend(); ++it) {
+            it->destroy(it->object);
+        }
+        m_destructors.clear();
+        m_blocks.clear();
+        m_position = m_end = nullptr;
+        m_nextBlockSize = kFirstBlockSize;
+    }
+
+    // The arena's state at one point, to roll back to
+    struct Mark {
+        size_t blocks;
+        std::byte *position;
+        std::byte *end;
+        size_t nextBlockSize;
+        size_t destructors;
+    };
+
+    Mark mark() const {
+        return Mark{m_blocks.size(), m_position, m_end, m_nextBlockSize, m_destructors.size()};
+    }
+
+    // Destroys every object created since `mark` was taken and frees their memory. Pointers
+    // to those objects must no longer be used.
+    void rollback(const Mark &mark) {
+        for (size_t i = m_destructors.size(); i > mark.destructors; i--) {
+            m_destructors[i - 1].destroy(m_destructors[i - 1].object);
+        }
+        m_destructors.resize(mark.destructors);
+        m_blocks.resize(mark.blocks);
+        m_position = mark.position;
+        m_end = mark.end;
+        m_nextBlockSize = mark.nextBlockSize;
+    }
+
+private:
+    static constexpr size_t kFirstBlockSize = 64 * 1024;
+    static constexpr size_t kMaxBlockSize = 4 * 1024 * 1024;
+
+    struct Destructor {
+        void *object;
+        void (*destroy)(void *);
+    };
+
+    void *allocate(size_t size, size_t alignment) {
+        std::uintptr_t address = (reinterpret_cast<std::uintptr_t>(m_position) + alignment - 1) & ~(alignment - 1);
+        if (m_position == nullptr || address + size > reinterpret_cast<std::uintptr_t>(m_end)) {
+            // Blocks grow geometrically, so large scenes need few of them
+            size_t blockSize = std::max(m_nextBlockSize, size);
+            m_nextBlockSize = std::min(m_nextBlockSize * 2, kMaxBlockSize);
+            m_blocks.emplace_back(new std::byte[blockSize]);
+            m_position = m_blocks.back().get();
+            m_end = m_position + blockSize;
+            address = reinterpret_cast<std::uintptr_t>(m_position);
+        }
+        m_position = reinterpret_cast<std::byte *>(address + size);
+        return reinterpret_cast<void *>(address);
+    }
+
+    std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+    std::byte *m_position = nullptr;
+    std::byte *m_end = nullptr;
+    size_t m_nextBlockSize = kFirstBlockSize;
+    std::vector<Destructor> m_destructors;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// Float-only approximations of the transcendental functions used while shading. They avoid
+// the libm calls and the promotions to double of the exact path, and are only used when the
+// renderer is built with RAY_FAST_MATH. The error bounds below are checked over each
+// function's domain by benchmarks/shading_benchmark.cpp.
+namespace fastmath {
+
+constexpr float kPi = 3.14159265f;
+constexpr float kHalfPi = 1.57079633f;
+constexpr float kInvTwoPi = 0.159154943f;
+
+inline std::uint32_t floatBits(float x) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+inline float bitsFloat(std::uint32_t bits) {
+    float x;
+    std::memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+// log2(x) for normal x > 0. Absolute error below 4e-7 for x in [2^-8, 2^8]; beyond that
+// it is dominated by rounding the result to float.
+// The exponent is read from the float's bits; the mantissa, moved into [sqrt(1/2), sqrt(2)),
+// goes through the atanh series log2(m) = 2 / ln(2) * atanh((m - 1) / (m + 1)).
+inline float log2(float x) {
+    std::uint32_t bits = floatBits(x);
+    int exponent = int(bits >> 23) - 127;
+    float m = bitsFloat((bits & 0x007fffffu) | 0x3f800000u);
+    if (m > 1.41421356f) {
+        m *= 0.5f;
+        exponent++;
+    }
+    float s = (m - 1.0f) / (m + 1.0f);
+    float s2 = s * s;
+    float series = s * (2.88539008f + s2 * (0.961796694f + s2 * (0.577078016f + s2 * 0.412198583f)));
+    return float(exponent) + series;
+}
+
+// 2^x. Relative error below 3e-7; returns 0 below 2^-126 and saturates near 2^128.
+// The integer part of x becomes the exponent bits, the fraction a degree 6 Taylor polynomial.
+inline float exp2(float x) {
+    if (x < -126.0f) {
+        return 0.0f;
+    }
+    x = std::min(x, 127.99f);
+    int xi = int(x);
+    xi -= float(xi) > x; // Truncation rounds negative x up
+    float g = (x - float(xi) - 0.5f) * 0.693147181f;
+    float p = 1.0f + g * (1.0f + g * (0.5f + g * (0.166666667f + g * (0.0416666667f + g * (0.00833333333f + g * 0.00138888889f)))));
+    return 1.41421356f * p * bitsFloat(std::uint32_t(xi + 127) << 23);
+}
+
+// x^y for x >= 0, as exp2(y * log2(x)). Relative error below 2e-6 when |y * log2(x)| <= 8,
+// which covers every result that is still visible at 8 bits per channel.
+inline float pow(float x, float y) {
+    if (x <= 0.0f) {
+        return y == 0.0f ? 1.0f : 0.0f;
+    }
+    return exp2(y * log2(x));
+}
+
+// acos(x) for x in [-1, 1]. Absolute error below 5e-7 radians.
+// Abramowitz & Stegun 4.4.46, mirrored for negative x.
+inline float acos(float x) {
+    float a = std::fabs(x);
+    float p = 1.5707963050f + a * (-0.2145988016f + a * (0.0889789874f + a * (-0.0501743046f + a * (0.0308918810f
+              + a * (-0.0170881256f + a * (0.0066700901f + a * -0.0012624911f))))));
+    float r = std::sqrt(std::max(1.0f - a, 0.0f)) * p;
+    return x < 0.0f ? kPi - r : r;
+}
+
+// asin(x) for x in [-1, 1]. Absolute error below 5e-7 radians.
+inline float asin(float x) {
+    return kHalfPi - acos(x);
+}
+
+// atan2(y, x). Absolute error below 4e-7 radians; atan2(0, 0) is 0.
+// Abramowitz & Stegun 4.4.49 on min / max of |x| and |y|, then moved to the right octant.
+inline float atan2(float y, float x) {
+    float ax = std::fabs(x);
+    float ay = std::fabs(y);
+    float hi = std::max(ax, ay);
+    if (hi == 0.0f) {
+        return 0.0f;
+    }
+    float a = std::min(ax, ay) / hi;
+    float a2 = a * a;
+    float r = a * (1.0f + a2 * (-0.3333314528f + a2 * (0.1999355085f + a2 * (-0.1420889944f + a2 * (0.1065626393f
+              + a2 * (-0.0752896400f + a2 * (0.0429096138f + a2 * (-0.0161657367f + a2 * 0.0028662257f))))))));
+    if (ay > ax) {
+        r = kHalfPi - r;
+    }
+    if (x < 0.0f) {
+        r = kPi - r;
+    }
+    return y < 0.0f ? -r : r;
+}
+
+// cos(x) for x in [-pi, pi]. Absolute error below 3e-7.
+// Folded onto [0, pi / 2], where a degree 12 Taylor polynomial is accurate to 7e-9.
+inline float cos(float x) {
+    float a = std::fabs(x);
+    float sign = 1.0f;
+    if (a > kHalfPi) {
+        a = kPi - a;
+        sign = -1.0f;
+    }
+    float a2 = a * a;
+    float p = 1.0f + a2 * (-0.5f + a2 * (0.0416666667f + a2 * (-0.00138888889f + a2 * (2.48015873e-5f
+              + a2 * (-2.75573192e-7f + a2 * 2.08767570e-9f)))));
+    return sign * p;
+}
+
+}
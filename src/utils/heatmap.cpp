@@ -0,0 +1,70 @@
+#include "heatmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "rgba.h"
+
+namespace {
+
+// Evenly spaced stops of the colour ramp, from no cost to the top of the scale
+const RGBA kRamp[] = {
+    {0, 0, 0, 255},
+    {40, 11, 84, 255},
+    {101, 21, 110, 255},
+    {159, 42, 99, 255},
+    {212, 72, 66, 255},
+    {245, 125, 21, 255},
+    {250, 193, 39, 255},
+    {252, 255, 164, 255},
+    {255, 255, 255, 255},
+};
+constexpr int kRampStops = sizeof(kRamp) / sizeof(kRamp[0]);
+
+RGBA rampColor(float x) {
+    float position = std::clamp(x, 0.0f, 1.0f) * (kRampStops - 1);
+    int stop = std::min(int(position), kRampStops - 2);
+    float f = position - stop;
+    const RGBA &a = kRamp[stop];
+    const RGBA &b = kRamp[stop + 1];
+    auto mix = [f](std::uint8_t p, std::uint8_t q) { return std::uint8_t(std::lround(p + f * (q - p))); };
+    return RGBA{mix(a.r, b.r), mix(a.g, b.g), mix(a.b, b.b), 255};
+}
+
+}
+
+QImage heatmapImage(const std::vector<float> &costs, int width, int height) {
+    QImage image(width, height, QImage::Format_RGBX8888);
+    image.fill(Qt::black);
+    if (costs.size() != size_t(width) * height || costs.empty()) {
+        return image;
+    }
+
+    std::vector<float> sorted = costs;
+    auto percentile = sorted.begin() + std::min(sorted.size() - 1, size_t(sorted.size() * 0.995));
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    float scale = *percentile > 0.0f ? 1.0f / *percentile : 0.0f;
+
+    RGBA *data = reinterpret_cast<RGBA *>(image.bits());
+    for (size_t i = 0; i < costs.size(); i++) {
+        data[i] = rampColor(costs[i] * scale);
+    }
+    return image;
+}
+
+bool savePfm(const std::vector<float> &costs, int width, int height, const std::string &path) {
+    if (costs.size() != size_t(width) * height) {
+        return false;
+    }
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        return false;
+    }
+    // A negative scale marks little-endian floats, which is what every platform we build on uses
+    out << "Pf\n" << width << " " << height << "\n-1.0\n";
+    for (int y = height - 1; y >= 0; y--) {
+        out.write(reinterpret_cast<const char *>(&costs[size_t(y) * width]), std::streamsize(sizeof(float)) * width);
+    }
+    return bool(out);
+}
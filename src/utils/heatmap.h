@@ -0,0 +1,17 @@
+#pragma once
+
+#include <QImage>
+
+#include <string>
+#include <vector>
+
+// Per-pixel render costs (see RayTracer::costMap()) as images
+
+// Maps `costs`, one per pixel in row-major order, to colours from black through purple, red
+// and yellow to white. The scale ends at the 99.5th percentile so that a few very expensive
+// pixels do not leave the rest of the image dark; costlier pixels are white.
+QImage heatmapImage(const std::vector<float> &costs, int width, int height);
+
+// Writes `costs` unscaled as a greyscale PFM (portable float map), which most HDR viewers and
+// image libraries read. Rows are stored bottom to top, as the format requires.
+bool savePfm(const std::vector<float> &costs, int width, int height, const std::string &path);
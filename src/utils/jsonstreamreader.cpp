@@ -0,0 +1,427 @@
+#include "jsonstreamreader.h"
+
+#include <charconv>
+#include <cstdio>
+
+#include <QJsonArray>
+#include <QJsonObject>
+
+namespace {
+
+const size_t kChunkSize = 1 << 16;
+
+void appendUtf8(std::string &out, unsigned int codepoint) {
+    if (codepoint < 0x80) {
+        out += char(codepoint);
+    } else if (codepoint < 0x800) {
+        out += char(0xC0 | (codepoint >> 6));
+        out += char(0x80 | (codepoint & 0x3F));
+    } else if (codepoint < 0x10000) {
+        out += char(0xE0 | (codepoint >> 12));
+        out += char(0x80 | ((codepoint >> 6) & 0x3F));
+        out += char(0x80 | (codepoint & 0x3F));
+    } else {
+        out += char(0xF0 | (codepoint >> 18));
+        out += char(0x80 | ((codepoint >> 12) & 0x3F));
+        out += char(0x80 | ((codepoint >> 6) & 0x3F));
+        out += char(0x80 | (codepoint & 0x3F));
+    }
+}
+
+}
+
+JsonStreamReader::JsonStreamReader(QFile &file) :
+    m_file(file),
+    m_buffer(kChunkSize)
+{}
+
+const std::string &JsonStreamReader::string() const {
+    return m_string;
+}
+
+double JsonStreamReader::number() const {
+    return m_number;
+}
+
+qint64 JsonStreamReader::offset() const {
+    return m_tokenOffset;
+}
+
+const std::string &JsonStreamReader::errorString() const {
+    return m_error;
+}
+
+bool JsonStreamReader::fill() {
+    if (m_eof) {
+        return false;
+    }
+    m_bufferOffset += m_size;
+    m_position = 0;
+    qint64 bytesRead = m_file.read(m_buffer.data(), m_buffer.size());
+    if (bytesRead <= 0) {
+        m_size = 0;
+        m_eof = true;
+        return false;
+    }
+    m_size = bytesRead;
+    return true;
+}
+
+int JsonStreamReader::peek() {
+    if (m_position == m_size && !fill()) {
+        return EOF;
+    }
+    return (unsigned char)m_buffer[m_position];
+}
+
+int JsonStreamReader::get() {
+    int c = peek();
+    if (c != EOF) {
+        m_position++;
+    }
+    return c;
+}
+
+void JsonStreamReader::skipWhitespace() {
+    for (int c = peek(); c == ' ' || c == '\t' || c == '\n' || c == '\r'; c = peek()) {
+        m_position++;
+    }
+}
+
+JsonStreamReader::Token JsonStreamReader::fail(const std::string &message) {
+    if (!m_failed) {
+        m_failed = true;
+        m_error = message;
+    }
+    return Token::TOKEN_ERROR;
+}
+
+// Marks the value that just ended as complete in its enclosing container.
+void JsonStreamReader::valueDone() {
+    if (m_stack.empty()) {
+        m_rootDone = true;
+        return;
+    }
+    Container &top = m_stack.back();
+    top.hasValue = true;
+    top.hasKey = false;
+    top.hasComma = false;
+}
+
+JsonStreamReader::Token JsonStreamReader::next() {
+    if (m_failed) {
+        return Token::TOKEN_ERROR;
+    }
+
+    skipWhitespace();
+    m_tokenOffset = m_bufferOffset + m_position;
+    int c = peek();
+
+    if (m_stack.empty()) {
+        if (m_rootDone) {
+            return c == EOF ? Token::TOKEN_END : fail("garbage at the end of the document");
+        }
+        if (c == EOF) {
+            return fail("illegal value");
+        }
+    } else {
+        Container &top = m_stack.back();
+        char close = top.isObject ? '}' : ']';
+        if (c == EOF) {
+            return fail(top.isObject ? "unterminated object" : "unterminated array");
+        }
+
+        if (top.hasValue) {
+            if (c == close) {
+                m_position++;
+                bool isObject = top.isObject;
+                m_stack.pop_back();
+                valueDone();
+                return isObject ? Token::TOKEN_END_OBJECT : Token::TOKEN_END_ARRAY;
+            }
+            if (c != ',') {
+                return fail("missing value separator");
+            }
+            m_position++;
+            top.hasValue = false;
+            top.hasComma = true;
+            skipWhitespace();
+            m_tokenOffset = m_bufferOffset + m_position;
+            c = peek();
+        } else if (c == close && !top.hasKey && !top.hasComma) {
+            // Empty container
+            m_position++;
+            bool isObject = top.isObject;
+            m_stack.pop_back();
+            valueDone();
+            return isObject ? Token::TOKEN_END_OBJECT : Token::TOKEN_END_ARRAY;
+        }
+
+        if (top.isObject && !top.hasKey) {
+            if (c != '"') {
+                return fail(top.hasComma ? "object is missing after a comma" : "unterminated object");
+            }
+            m_position++;
+            if (!readString(m_string)) {
+                return Token::TOKEN_ERROR;
+            }
+            skipWhitespace();
+            if (get() != ':') {
+                return fail("missing name separator");
+            }
+            top.hasKey = true;
+            top.hasComma = false;
+            return Token::TOKEN_KEY;
+        }
+    }
+
+    // A value is expected
+    switch (c) {
+    case '{':
+        m_position++;
+        m_stack.push_back(Container{true, false, false, false});
+        return Token::TOKEN_BEGIN_OBJECT;
+    case '[':
+        m_position++;
+        m_stack.push_back(Container{false, false, false, false});
+        return Token::TOKEN_BEGIN_ARRAY;
+    case '"':
+        m_position++;
+        if (!readString(m_string)) {
+            return Token::TOKEN_ERROR;
+        }
+        valueDone();
+        return Token::TOKEN_STRING;
+    case 't':
+        if (!readLiteral("true")) {
+            return Token::TOKEN_ERROR;
+        }
+        valueDone();
+        return Token::TOKEN_TRUE;
+    case 'f':
+        if (!readLiteral("false")) {
+            return Token::TOKEN_ERROR;
+        }
+        valueDone();
+        return Token::TOKEN_FALSE;
+    case 'n':
+        if (!readLiteral("null")) {
+            return Token::TOKEN_ERROR;
+        }
+        valueDone();
+        return Token::TOKEN_NULL;
+    default:
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            if (!readNumber()) {
+                return Token::TOKEN_ERROR;
+            }
+            valueDone();
+            return Token::TOKEN_NUMBER;
+        }
+        return fail("illegal value");
+    }
+}
+
+// Reads the rest of a string whose opening quote was consumed.
+bool JsonStreamReader::readString(std::string &out) {
+    out.clear();
+    for (;;) {
+        int c = get();
+        if (c == EOF) {
+            fail("unterminated string");
+            return false;
+        }
+        if (c == '"') {
+            return true;
+        }
+        if (c != '\\') {
+            out += char(c);
+            continue;
+        }
+
+        c = get();
+        switch (c) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            auto readHex = [this](unsigned int &value) {
+                value = 0;
+                for (int i = 0; i < 4; i++) {
+                    int h = get();
+                    value <<= 4;
+                    if (h >= '0' && h <= '9') value |= h - '0';
+                    else if (h >= 'a' && h <= 'f') value |= h - 'a' + 10;
+                    else if (h >= 'A' && h <= 'F') value |= h - 'A' + 10;
+                    else return false;
+                }
+                return true;
+            };
+            unsigned int codepoint;
+            if (!readHex(codepoint)) {
+                fail("invalid escape sequence");
+                return false;
+            }
+            // Combine UTF-16 surrogate pairs
+            if (codepoint >= 0xD800 && codepoint < 0xDC00) {
+                unsigned int low;
+                if (get() != '\\' || get() != 'u' || !readHex(low) || low < 0xDC00 || low >= 0xE000) {
+                    fail("invalid escape sequence");
+                    return false;
+                }
+                codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+            }
+            appendUtf8(out, codepoint);
+            break;
+        }
+        default:
+            fail("invalid escape sequence");
+            return false;
+        }
+    }
+}
+
+// Reads a number following the JSON grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+bool JsonStreamReader::readNumber() {
+    char text[64];
+    size_t length = 0;
+    auto take = [&]() {
+        int c = get();
+        if (length < sizeof(text) - 1) {
+            text[length] = char(c);
+        }
+        length++;
+    };
+    auto isDigit = [](int c) { return c >= '0' && c <= '9'; };
+
+    if (peek() == '-') {
+        take();
+    }
+    if (!isDigit(peek())) {
+        fail("illegal number");
+        return false;
+    }
+    if (peek() == '0') {
+        take();
+    } else {
+        while (isDigit(peek())) take();
+    }
+    if (peek() == '.') {
+        take();
+        if (!isDigit(peek())) {
+            fail("illegal number");
+            return false;
+        }
+        while (isDigit(peek())) take();
+    }
+    if (peek() == 'e' || peek() == 'E') {
+        take();
+        if (peek() == '+' || peek() == '-') take();
+        if (!isDigit(peek())) {
+            fail("illegal number");
+            return false;
+        }
+        while (isDigit(peek())) take();
+    }
+    if (length >= sizeof(text)) {
+        fail("illegal number");
+        return false;
+    }
+
+    auto result = std::from_chars(text, text + length, m_number);
+    if (result.ec != std::errc()) {
+        fail("illegal number");
+        return false;
+    }
+    return true;
+}
+
+bool JsonStreamReader::readLiteral(const char *literal) {
+    for (const char *p = literal; *p; p++) {
+        if (get() != *p) {
+            fail("illegal value");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool JsonStreamReader::readValue(Token first, QJsonValue &value) {
+    switch (first) {
+    case Token::TOKEN_BEGIN_OBJECT: {
+        QJsonObject object;
+        for (Token token = next(); token != Token::TOKEN_END_OBJECT; token = next()) {
+            if (token != Token::TOKEN_KEY) {
+                return false;
+            }
+            QString key = QString::fromStdString(m_string);
+            QJsonValue member;
+            if (!readValue(next(), member)) {
+                return false;
+            }
+            object.insert(key, member);
+        }
+        value = object;
+        return true;
+    }
+    case Token::TOKEN_BEGIN_ARRAY: {
+        QJsonArray array;
+        for (Token token = next(); token != Token::TOKEN_END_ARRAY; token = next()) {
+            QJsonValue element;
+            if (!readValue(token, element)) {
+                return false;
+            }
+            array.append(element);
+        }
+        value = array;
+        return true;
+    }
+    case Token::TOKEN_STRING:
+        value = QString::fromStdString(m_string);
+        return true;
+    case Token::TOKEN_NUMBER:
+        value = m_number;
+        return true;
+    case Token::TOKEN_TRUE:
+        value = true;
+        return true;
+    case Token::TOKEN_FALSE:
+        value = false;
+        return true;
+    case Token::TOKEN_NULL:
+        value = QJsonValue();
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool JsonStreamReader::skipValue(Token first) {
+    if (first != Token::TOKEN_BEGIN_OBJECT && first != Token::TOKEN_BEGIN_ARRAY) {
+        return first != Token::TOKEN_ERROR && first != Token::TOKEN_END;
+    }
+    int depth = 1;
+    while (depth > 0) {
+        switch (next()) {
+        case Token::TOKEN_BEGIN_OBJECT:
+        case Token::TOKEN_BEGIN_ARRAY:
+            depth++;
+            break;
+        case Token::TOKEN_END_OBJECT:
+        case Token::TOKEN_END_ARRAY:
+            depth--;
+            break;
+        case Token::TOKEN_ERROR:
+        case Token::TOKEN_END:
+            return false;
+        default:
+            break;
+        }
+    }
+    return true;
+}
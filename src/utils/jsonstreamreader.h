@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <QFile>
+#include <QJsonValue>
+
+// A pull-style (SAX-like) JSON tokenizer reading a file in fixed-size chunks.
+// Unlike QJsonDocument it never holds the whole document, so memory use is independent
+// of the file size; small sub-trees can still be materialized with readValue().
+class JsonStreamReader {
+public:
+    enum class Token {
+        TOKEN_BEGIN_OBJECT,
+        TOKEN_END_OBJECT,
+        TOKEN_BEGIN_ARRAY,
+        TOKEN_END_ARRAY,
+        TOKEN_KEY,    // An object member name; string() holds the name
+        TOKEN_STRING, // string() holds the value
+        TOKEN_NUMBER, // number() holds the value
+        TOKEN_TRUE,
+        TOKEN_FALSE,
+        TOKEN_NULL,
+        TOKEN_END,    // End of the document
+        TOKEN_ERROR   // Malformed JSON; see errorString() and offset()
+    };
+
+    // The file must already be open for reading.
+    explicit JsonStreamReader(QFile &file);
+
+    // Reads the next token.
+    Token next();
+
+    const std::string &string() const;
+    double number() const;
+
+    // Materializes the value whose first token was just returned by next()
+    // (a scalar, or the TOKEN_BEGIN_* of a container) and consumes the rest of it.
+    bool readValue(Token first, QJsonValue &value);
+
+    // Consumes the rest of the value whose first token was just returned by next().
+    bool skipValue(Token first);
+
+    // Number of objects and arrays the last token read is inside, counting one it opened.
+    int depth() const { return int(m_stack.size()); }
+
+    // Byte offset of the last token read; used for error messages.
+    qint64 offset() const;
+    const std::string &errorString() const;
+
+private:
+    struct Container {
+        bool isObject;
+        bool hasKey;   // Object only: a key was read and its value is pending
+        bool hasValue; // A value was read; a separator or the closing bracket must follow
+        bool hasComma; // A separator was read; another element must follow
+    };
+
+    int peek();
+    int get();
+    void skipWhitespace();
+    bool fill();
+    bool readString(std::string &out);
+    bool readNumber();
+    bool readLiteral(const char *literal);
+    void valueDone();
+    Token fail(const std::string &message);
+
+    QFile &m_file;
+    std::vector<char> m_buffer;
+    size_t m_position = 0;
+    size_t m_size = 0;
+    qint64 m_bufferOffset = 0;
+    qint64 m_tokenOffset = 0;
+    bool m_eof = false;
+
+    std::vector<Container> m_stack;
+    bool m_rootDone = false;
+    bool m_failed = false;
+
+    std::string m_string;
+    double m_number = 0;
+    std::string m_error;
+};
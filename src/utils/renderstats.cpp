@@ -0,0 +1,98 @@
+#include "renderstats.h"
+
+#include <iomanip>
+#include <string>
+
+namespace {
+
+const char *kPrimitiveNames[RenderCounters::kPrimitiveTypes] = {"cube", "cone", "cylinder", "sphere", "mesh"};
+
+std::uint64_t totalIntersectionTests(const RenderCounters &counters) {
+    std::uint64_t total = 0;
+    for (std::uint64_t tests : counters.intersectionTests) {
+        total += tests;
+    }
+    return total;
+}
+
+}
+
+RenderCounters &RenderCounters::operator+=(const RenderCounters &other) {
+    primaryRays += other.primaryRays;
+    reflectionRays += other.reflectionRays;
+    shadowRays += other.shadowRays;
+    for (int i = 0; i < kPrimitiveTypes; i++) {
+        intersectionTests[i] += other.intersectionTests[i];
+    }
+    lightBvhNodes += other.lightBvhNodes;
+    accelerationNodes += other.accelerationNodes;
+    textureFetches += other.textureFetches;
+    closerHits += other.closerHits;
+    shadedHits += other.shadedHits;
+    return *this;
+}
+
+void printStatsTable(std::ostream &out, const RenderCounters &counters, const RenderTimings &timings,
+                     const AccelerationStats &acceleration) {
+    auto row = [&out](const std::string &name, auto value) {
+        out << "  " << std::left << std::setw(28) << name << std::right << std::setw(16) << value << "\n";
+    };
+    out << "Rays\n";
+    row("primary", counters.primaryRays);
+    row("reflection", counters.reflectionRays);
+    row("shadow", counters.shadowRays);
+    out << "Intersection tests\n";
+    for (int i = 0; i < RenderCounters::kPrimitiveTypes; i++) {
+        row(kPrimitiveNames[i], counters.intersectionTests[i]);
+    }
+    row("total", totalIntersectionTests(counters));
+    row("acceleration nodes visited", counters.accelerationNodes);
+    out << "Shading\n";
+    row("light BVH nodes visited", counters.lightBvhNodes);
+    row("texture fetches", counters.textureFetches);
+    row("closest-hit updates", counters.closerHits);
+    row("shaded hits", counters.shadedHits);
+    out << "Time (s)\n";
+    out << std::fixed << std::setprecision(3);
+    row("parse", timings.parse);
+    row("compile", timings.compile);
+    row("render", timings.render);
+    row("save", timings.save);
+    if (acceleration.structure != nullptr) {
+        out << "Acceleration structure (" << acceleration.structure << ")\n";
+        row("build", acceleration.buildSeconds);
+        row("SAH cost", acceleration.sahCost);
+        row("nodes", acceleration.nodes);
+        row("shape references", acceleration.references);
+    }
+    out << std::defaultfloat << std::flush;
+}
+
+void printStatsJson(std::ostream &out, const RenderCounters &counters, const RenderTimings &timings,
+                    const AccelerationStats &acceleration) {
+    out << "{\"rays\": {\"primary\": " << counters.primaryRays
+        << ", \"reflection\": " << counters.reflectionRays
+        << ", \"shadow\": " << counters.shadowRays << "}"
+        << ", \"intersection_tests\": {";
+    for (int i = 0; i < RenderCounters::kPrimitiveTypes; i++) {
+        out << "\"" << kPrimitiveNames[i] << "\": " << counters.intersectionTests[i] << ", ";
+    }
+    out << "\"total\": " << totalIntersectionTests(counters) << "}"
+        << ", \"acceleration_nodes\": " << counters.accelerationNodes
+        << ", \"light_bvh_nodes\": " << counters.lightBvhNodes
+        << ", \"texture_fetches\": " << counters.textureFetches
+        << ", \"closer_hits\": " << counters.closerHits
+        << ", \"shaded_hits\": " << counters.shadedHits
+        << ", \"seconds\": {\"parse\": " << timings.parse
+        << ", \"compile\": " << timings.compile
+        << ", \"render\": " << timings.render
+        << ", \"save\": " << timings.save << "}";
+    if (acceleration.structure != nullptr) {
+        out << ", \"acceleration\": {\"structure\": \"" << acceleration.structure << "\""
+            << ", \"build_seconds\": " << acceleration.buildSeconds
+            << ", \"nodes\": " << acceleration.nodes
+            << ", \"references\": " << acceleration.references
+            << ", \"sah_cost\": " << acceleration.sahCost << "}";
+    }
+    out << "}" << std::endl;
+}
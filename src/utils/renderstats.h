@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include "utils/scenedata.h"
+
+// Work done while rendering. Each thread counts into its own RenderCounters (see
+// threadCounters()), which the renderer adds to its totals at the end of every tile, so
+// counting costs one increment of a thread-local integer.
+struct RenderCounters {
+    static constexpr int kPrimitiveTypes = int(PrimitiveType::PRIMITIVE_MESH) + 1;
+
+    std::uint64_t primaryRays = 0;
+    std::uint64_t reflectionRays = 0;
+    std::uint64_t shadowRays = 0;                           // Tested against every shape; see ShadowMode
+    std::uint64_t intersectionTests[kPrimitiveTypes] = {}; // By PrimitiveType, for all rays
+    std::uint64_t lightBvhNodes = 0;                        // LightBVH nodes visited
+    std::uint64_t accelerationNodes = 0;                    // Acceleration structure cells or nodes visited
+    std::uint64_t textureFetches = 0;
+    std::uint64_t closerHits = 0;                           // Times intersection found a closer hit
+    std::uint64_t shadedHits = 0;                           // Hits whose normal and texture were evaluated
+
+    RenderCounters &operator+=(const RenderCounters &other);
+};
+
+// The calling thread's counters. Inline, and constant-initialized so it needs no guard, so
+// counting in the innermost loops is a single add to thread-local storage.
+inline RenderCounters &threadCounters() {
+    thread_local constinit RenderCounters counters;
+    return counters;
+}
+
+// Wall-clock time of each phase of a run, in seconds
+struct RenderTimings {
+    double parse = 0.0;
+    double compile = 0.0;
+    double render = 0.0;
+    double save = 0.0;
+};
+
+// The acceleration structure a render traced against
+struct AccelerationStats {
+    const char *structure = nullptr; // Its name in config files, or null when none was built
+    double buildSeconds = 0.0;       // Part of RenderTimings::compile
+    std::uint64_t nodes = 0;         // BVH nodes or grid cells
+    std::uint64_t references = 0;    // Shape indices stored in leaves or cells
+    double sahCost = 0.0;            // Expected cost of a ray by the surface area heuristic; BVHs only
+};
+
+// Writes the counters, timings and acceleration structure as an aligned table, or as one
+// JSON object
+void printStatsTable(std::ostream &out, const RenderCounters &counters, const RenderTimings &timings,
+                     const AccelerationStats &acceleration = AccelerationStats());
+void printStatsJson(std::ostream &out, const RenderCounters &counters, const RenderTimings &timings,
+                    const AccelerationStats &acceleration = AccelerationStats());
@@ -0,0 +1,370 @@
+#include "scenecache.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+namespace {
+
+// Bump whenever the layout of any of the structs below changes
+const std::uint32_t kCacheVersion = 2;
+const char kCacheMagic[8] = {'R', 'A', 'Y', 'S', 'C', 'E', 'N', 'E'};
+const std::uint32_t kByteOrderMark = 0x01020304;
+
+static_assert(std::is_trivially_copyable_v<SceneGlobalData>);
+static_assert(std::is_trivially_copyable_v<SceneCameraData>);
+static_assert(std::is_trivially_copyable_v<SceneLightData>);
+
+// SceneFileMap with its filename stored as an offset into the string table
+struct CachedFileMap {
+    std::uint32_t isUsed;
+    std::uint32_t filename;
+    float repeatU;
+    float repeatV;
+};
+
+// SceneMaterial without any heap-allocated members
+struct CachedMaterial {
+    SceneColor cAmbient;
+    SceneColor cDiffuse;
+    SceneColor cSpecular;
+    SceneColor cReflective;
+    SceneColor cTransparent;
+    SceneColor cEmissive;
+    float shininess;
+    float ior;
+    float blend;
+    std::uint32_t padding;
+    CachedFileMap textureMap;
+    CachedFileMap bumpMap;
+};
+
+struct CachedShape {
+    glm::mat4 ctm;
+    std::uint32_t type;
+    std::uint32_t material;
+    std::uint32_t mesh;
+    std::uint32_t padding;
+};
+
+struct CacheHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+
+    // Identity of the scene file this cache was compiled from
+    std::uint64_t sourceSize;
+    std::int64_t sourceModified;
+    std::uint64_t sourceHash;
+
+    SceneGlobalData globalData;
+    SceneCameraData cameraData;
+
+    // Sections, as byte offsets from the start of the file
+    std::uint64_t lightCount;
+    std::uint64_t lightOffset;
+    std::uint64_t materialCount;
+    std::uint64_t materialOffset;
+    std::uint64_t meshCount;    // Mesh file names, as offsets into the string table
+    std::uint64_t meshOffset;
+    std::uint64_t shapeCount;
+    std::uint64_t shapeOffset;
+    std::uint64_t stringsSize;
+    std::uint64_t stringsOffset;
+    std::uint64_t bvhNodeCount; // Reserved for a cached acceleration structure
+    std::uint64_t bvhOffset;
+};
+
+std::uint64_t alignOffset(std::uint64_t offset) {
+    return (offset + 15) & ~std::uint64_t(15);
+}
+
+// 64-bit FNV-1a hash of the scene file's contents
+bool hashFile(const std::string &filepath, std::uint64_t &hash) {
+    QFile file(QString::fromStdString(filepath));
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+    hash = 14695981039346656037ull;
+    if (file.size() == 0) {
+        return true;
+    }
+    const uchar *bytes = file.map(0, file.size());
+    if (bytes == nullptr) {
+        return false;
+    }
+    for (qint64 i = 0; i < file.size(); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    file.unmap(const_cast<uchar *>(bytes));
+    return true;
+}
+
+// Appends strings to a NUL-separated table; offset 0 is the empty string.
+class StringTable {
+public:
+    StringTable() : m_data(1, '\0') {}
+
+    std::uint32_t add(const std::string &s) {
+        if (s.empty()) {
+            return 0;
+        }
+        std::uint32_t offset = m_data.size();
+        m_data.insert(m_data.end(), s.begin(), s.end());
+        m_data.push_back('\0');
+        return offset;
+    }
+
+    const std::vector<char> &data() const { return m_data; }
+
+private:
+    std::vector<char> m_data;
+};
+
+CachedFileMap packFileMap(const SceneFileMap &map, StringTable &strings) {
+    CachedFileMap packed{};
+    packed.isUsed = map.isUsed;
+    packed.filename = map.isUsed ? strings.add(map.filename) : 0;
+    packed.repeatU = map.repeatU;
+    packed.repeatV = map.repeatV;
+    return packed;
+}
+
+SceneFileMap unpackFileMap(const CachedFileMap &packed, const char *strings) {
+    SceneFileMap map;
+    map.isUsed = packed.isUsed;
+    map.filename = strings + packed.filename;
+    map.repeatU = packed.repeatU;
+    map.repeatV = packed.repeatV;
+    return map;
+}
+
+}
+
+bool SceneCache::load(const std::string &cachepath, const std::string &scenepath, RenderData &renderData) {
+    TraceScope scope("io", "SceneCache::load");
+    QFile file(QString::fromStdString(cachepath));
+    if (!file.open(QFile::ReadOnly) || file.size() < (qint64)sizeof(CacheHeader)) {
+        return false;
+    }
+    const uchar *bytes = file.map(0, file.size());
+    if (bytes == nullptr) {
+        return false;
+    }
+    std::uint64_t fileSize = file.size();
+
+    CacheHeader header;
+    std::memcpy(&header, bytes, sizeof(CacheHeader));
+    if (std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+        header.version != kCacheVersion || header.byteOrder != kByteOrderMark) {
+        std::cout << "scene cache " << cachepath << " is from another version, rebuilding" << std::endl;
+        return false;
+    }
+
+    // Trust an unchanged size and mtime; otherwise fall back to comparing content hashes,
+    // so that touching or re-checking-out the scene file does not force a rebuild.
+    QFileInfo source(QString::fromStdString(scenepath));
+    bool fresh = source.exists() && (std::uint64_t)source.size() == header.sourceSize &&
+                 source.lastModified().toMSecsSinceEpoch() == header.sourceModified;
+    bool rehashed = !fresh;
+    if (!fresh) {
+        std::uint64_t hash;
+        fresh = hashFile(scenepath, hash) && hash == header.sourceHash;
+    }
+    if (!fresh) {
+        std::cout << "scene cache " << cachepath << " is out of date, rebuilding" << std::endl;
+        return false;
+    }
+
+    auto corrupt = [&cachepath]() {
+        std::cout << "scene cache " << cachepath << " is corrupt, rebuilding" << std::endl;
+        return false;
+    };
+    // Every section must lie within the file. Counts are checked before they are multiplied
+    // by the element size, so a huge count cannot wrap around to a small section.
+    auto inBounds = [fileSize](std::uint64_t offset, std::uint64_t count, std::uint64_t elementSize) {
+        return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+    };
+    if (!inBounds(header.lightOffset, header.lightCount, sizeof(SceneLightData)) ||
+        !inBounds(header.materialOffset, header.materialCount, sizeof(CachedMaterial)) ||
+        !inBounds(header.meshOffset, header.meshCount, sizeof(std::uint32_t)) ||
+        !inBounds(header.shapeOffset, header.shapeCount, sizeof(CachedShape)) ||
+        !inBounds(header.stringsOffset, header.stringsSize, 1) || header.stringsSize == 0 ||
+        bytes[header.stringsOffset + header.stringsSize - 1] != '\0') {
+        return corrupt();
+    }
+    // So must every string; the table ends in a NUL, so each one is terminated within it
+    auto validString = [&header](std::uint32_t offset) {
+        return offset < header.stringsSize;
+    };
+
+    renderData.globalData = header.globalData;
+    renderData.cameraData = header.cameraData;
+
+    const SceneLightData *lights = reinterpret_cast<const SceneLightData *>(bytes + header.lightOffset);
+    renderData.lights.assign(lights, lights + header.lightCount);
+
+    const char *strings = reinterpret_cast<const char *>(bytes + header.stringsOffset);
+    const CachedMaterial *materials = reinterpret_cast<const CachedMaterial *>(bytes + header.materialOffset);
+    renderData.materials.resize(header.materialCount);
+    for (std::uint64_t i = 0; i < header.materialCount; i++) {
+        const CachedMaterial &cached = materials[i];
+        if (!validString(cached.textureMap.filename) || !validString(cached.bumpMap.filename)) {
+            return corrupt();
+        }
+        SceneMaterial &mat = renderData.materials[i];
+        mat.cAmbient = cached.cAmbient;
+        mat.cDiffuse = cached.cDiffuse;
+        mat.cSpecular = cached.cSpecular;
+        mat.shininess = cached.shininess;
+        mat.cReflective = cached.cReflective;
+        mat.cTransparent = cached.cTransparent;
+        mat.ior = cached.ior;
+        mat.textureMap = unpackFileMap(cached.textureMap, strings);
+        mat.blend = cached.blend;
+        mat.cEmissive = cached.cEmissive;
+        mat.bumpMap = unpackFileMap(cached.bumpMap, strings);
+    }
+
+    const std::uint32_t *meshfiles = reinterpret_cast<const std::uint32_t *>(bytes + header.meshOffset);
+    renderData.meshfiles.resize(header.meshCount);
+    for (std::uint64_t i = 0; i < header.meshCount; i++) {
+        if (!validString(meshfiles[i])) {
+            return corrupt();
+        }
+        renderData.meshfiles[i] = strings + meshfiles[i];
+    }
+
+    const CachedShape *shapes = reinterpret_cast<const CachedShape *>(bytes + header.shapeOffset);
+    renderData.shapes.resize(header.shapeCount);
+    for (std::uint64_t i = 0; i < header.shapeCount; i++) {
+        const CachedShape &cached = shapes[i];
+        // The renderer indexes tables by type and material, so these must be in range too
+        if (cached.material >= header.materialCount || cached.type > std::uint32_t(PrimitiveType::PRIMITIVE_MESH) ||
+            (cached.type == std::uint32_t(PrimitiveType::PRIMITIVE_MESH) && cached.mesh >= header.meshCount)) {
+            return corrupt();
+        }
+        RenderShapeData &shape = renderData.shapes[i];
+        shape.type = static_cast<PrimitiveType>(cached.type);
+        shape.material = cached.material;
+        shape.mesh = cached.mesh;
+        shape.ctm = cached.ctm;
+    }
+
+    file.unmap(const_cast<uchar *>(bytes));
+    file.close();
+
+    // Record the size and mtime the hash matched, so later runs take the cheap check again.
+    // If this fails, the next run only hashes the scene file once more.
+    if (rehashed) {
+        header.sourceSize = source.size();
+        header.sourceModified = source.lastModified().toMSecsSinceEpoch();
+        QFile update(QString::fromStdString(cachepath));
+        if (update.open(QFile::ReadWrite)) {
+            update.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+        }
+    }
+    std::cout << "Loaded compiled scene from " << cachepath << std::endl;
+    return true;
+}
+
+bool SceneCache::save(const std::string &cachepath, const std::string &scenepath, const RenderData &renderData) {
+    TraceScope scope("io", "SceneCache::save");
+    CacheHeader header{};
+    std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+    header.version = kCacheVersion;
+    header.byteOrder = kByteOrderMark;
+
+    QFileInfo source(QString::fromStdString(scenepath));
+    header.sourceSize = source.size();
+    header.sourceModified = source.lastModified().toMSecsSinceEpoch();
+    if (!hashFile(scenepath, header.sourceHash)) {
+        return false;
+    }
+
+    header.globalData = renderData.globalData;
+    header.cameraData = renderData.cameraData;
+
+    StringTable strings;
+    std::vector<CachedMaterial> materials(renderData.materials.size());
+    for (size_t i = 0; i < renderData.materials.size(); i++) {
+        const SceneMaterial &mat = renderData.materials[i];
+        CachedMaterial &cached = materials[i];
+        cached = CachedMaterial{};
+        cached.cAmbient = mat.cAmbient;
+        cached.cDiffuse = mat.cDiffuse;
+        cached.cSpecular = mat.cSpecular;
+        cached.shininess = mat.shininess;
+        cached.cReflective = mat.cReflective;
+        cached.cTransparent = mat.cTransparent;
+        cached.ior = mat.ior;
+        cached.textureMap = packFileMap(mat.textureMap, strings);
+        cached.blend = mat.blend;
+        cached.cEmissive = mat.cEmissive;
+        cached.bumpMap = packFileMap(mat.bumpMap, strings);
+    }
+
+    std::vector<std::uint32_t> meshfiles(renderData.meshfiles.size());
+    for (size_t i = 0; i < renderData.meshfiles.size(); i++) {
+        meshfiles[i] = strings.add(renderData.meshfiles[i]);
+    }
+
+    std::vector<CachedShape> shapes(renderData.shapes.size());
+    for (size_t i = 0; i < renderData.shapes.size(); i++) {
+        const RenderShapeData &shape = renderData.shapes[i];
+        shapes[i] = CachedShape{shape.ctm, static_cast<std::uint32_t>(shape.type), shape.material, shape.mesh, 0};
+    }
+
+    header.lightCount = renderData.lights.size();
+    header.lightOffset = alignOffset(sizeof(CacheHeader));
+    header.materialCount = materials.size();
+    header.materialOffset = alignOffset(header.lightOffset + header.lightCount * sizeof(SceneLightData));
+    header.meshCount = meshfiles.size();
+    header.meshOffset = alignOffset(header.materialOffset + header.materialCount * sizeof(CachedMaterial));
+    header.shapeCount = shapes.size();
+    header.shapeOffset = alignOffset(header.meshOffset + header.meshCount * sizeof(std::uint32_t));
+    header.stringsSize = strings.data().size();
+    header.stringsOffset = alignOffset(header.shapeOffset + header.shapeCount * sizeof(CachedShape));
+
+    // Write to a temporary file and swap it in, so a crash never leaves a truncated cache behind
+    QString finalPath = QString::fromStdString(cachepath);
+    QFile file(finalPath + ".tmp");
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        std::cout << "could not write scene cache " << cachepath << std::endl;
+        return false;
+    }
+    auto writeAt = [&file](std::uint64_t offset, const void *data, std::uint64_t size) {
+        static const char zeros[16] = {};
+        while ((std::uint64_t)file.pos() < offset) {
+            file.write(zeros, std::min<std::uint64_t>(sizeof(zeros), offset - file.pos()));
+        }
+        return size == 0 || file.write(static_cast<const char *>(data), size) == (qint64)size;
+    };
+    bool success = writeAt(0, &header, sizeof(CacheHeader)) &&
+                   writeAt(header.lightOffset, renderData.lights.data(), header.lightCount * sizeof(SceneLightData)) &&
+                   writeAt(header.materialOffset, materials.data(), header.materialCount * sizeof(CachedMaterial)) &&
+                   writeAt(header.meshOffset, meshfiles.data(), header.meshCount * sizeof(std::uint32_t)) &&
+                   writeAt(header.shapeOffset, shapes.data(), header.shapeCount * sizeof(CachedShape)) &&
+                   writeAt(header.stringsOffset, strings.data().data(), header.stringsSize);
+    file.close();
+
+    if (!success) {
+        std::cout << "could not write scene cache " << cachepath << std::endl;
+        QFile::remove(finalPath + ".tmp");
+        return false;
+    }
+    QFile::remove(finalPath);
+    if (!QFile::rename(finalPath + ".tmp", finalPath)) {
+        std::cout << "could not write scene cache " << cachepath << std::endl;
+        return false;
+    }
+    std::cout << "Saved compiled scene to " << cachepath << std::endl;
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "sceneparser.h"
+
+#include <string>
+
+// A versioned binary file holding a compiled scene (the flattened RenderData), so that
+// later runs can skip JSON parsing and scene graph flattening. The file is memory-mapped
+// and its flat arrays are copied straight into RenderData.
+class SceneCache {
+public:
+    // Loads the compiled scene from `cachepath` if it was built from the current contents
+    // of the scene file at `scenepath` (same size and modification time, or same hash).
+    // When only the hash matched, the cache's header is updated to the file's size and time.
+    // @return False if the cache is missing, from another version, or out of date.
+    static bool load(const std::string &cachepath, const std::string &scenepath, RenderData &renderData);
+
+    // Writes `renderData`, compiled from `scenepath`, to `cachepath`.
+    static bool save(const std::string &cachepath, const std::string &scenepath, const RenderData &renderData);
+};
@@ -8,51 +8,65 @@
 #include <cstring>
 #include <iostream>
 #include <filesystem>
+#include <sstream>
 
 #include <QFile>
 #include <QJsonArray>
 
 #include "utils/rgba.h"
+#include "utils/tracing.h"
 
 #define ERROR_AT(e) "error at line " << e.lineNumber() << " col " << e.columnNumber() << ": "
-#define PARSE_ERROR(e) std::cout << ERROR_AT(e) << "could not parse <" << e.tagName().toStdString() \
+#define PARSE_ERROR(e) *m_messages << ERROR_AT(e) << "could not parse <" << e.tagName().toStdString() \
                                  << ">" << std::endl
-#define UNSUPPORTED_ELEMENT(e) std::cout << ERROR_AT(e) << "unsupported element <" \
+#define UNSUPPORTED_ELEMENT(e) *m_messages << ERROR_AT(e) << "unsupported element <" \
                                          << e.tagName().toStdString() << ">" << std::endl;
 
+namespace {
+
+// Consumes the rest of a group object whose body failed to parse, picking up its name if that
+// comes after the point of failure. `depth` is the reader's depth inside the group.
+bool finishGroup(JsonStreamReader &json, int depth, bool &hasName, std::string &name, bool &invalidName) {
+    using Token = JsonStreamReader::Token;
+    while (json.depth() >= depth) {
+        Token token = json.next();
+        if (token == Token::TOKEN_ERROR || token == Token::TOKEN_END) {
+            return false;
+        }
+        if (token == Token::TOKEN_KEY && json.depth() == depth && json.string() == "name") {
+            Token value = json.next();
+            if (value == Token::TOKEN_STRING) {
+                hasName = true;
+                name = json.string();
+            }
+            else {
+                invalidName = true;
+                if (!json.skipValue(value)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+}
+
 // Students, please ignore this file.
-ScenefileReader::ScenefileReader(const std::string &name) {
+ScenefileReader::ScenefileReader(const std::string &name, std::ostream &messages) {
     file_name = name;
+    m_messages = &messages;
 
     memset(&m_cameraData, 0, sizeof(SceneCameraData));
     memset(&m_globalData, 0, sizeof(SceneGlobalData));
 
-    m_root = new SceneNode;
+    m_root = m_arena.create<SceneNode>();
 
     m_templates.clear();
-    m_nodes.clear();
-
-    m_nodes.push_back(m_root);
 }
 
 ScenefileReader::~ScenefileReader() {
-    // Delete all Scene Nodes
-    for (unsigned int node = 0; node < m_nodes.size(); node++) {
-        for (size_t i = 0; i < (m_nodes[node])->transformations.size(); i++)
-        {
-            delete (m_nodes[node])->transformations[i];
-        }
-        for (size_t i = 0; i < (m_nodes[node])->primitives.size(); i++)
-        {
-            delete (m_nodes[node])->primitives[i];
-        }
-        (m_nodes[node])->transformations.clear();
-        (m_nodes[node])->primitives.clear();
-        (m_nodes[node])->children.clear();
-        delete m_nodes[node];
-    }
-
-    m_nodes.clear();
+    // The scene graph lives in m_arena, which frees it all at once
     m_templates.clear();
 }
 
@@ -70,10 +84,13 @@ SceneNode *ScenefileReader::getRootNode() const {
 
 // This is where it all goes down...
 bool ScenefileReader::readJSON() {
+    TraceScope scope("io", "ScenefileReader::readJSON");
+    scope.addArg("file", file_name);
+
     // Read the file
     QFile file(file_name.c_str());
     if (!file.open(QFile::ReadOnly)) {
-        std::cout << "could not open " << file_name << std::endl;
+        *m_messages << "could not open " << file_name << std::endl;
         return false;
     }
 
@@ -82,15 +99,15 @@ bool ScenefileReader::readJSON() {
     QJsonParseError jsonError;
     QJsonDocument doc = QJsonDocument::fromJson(fileContents, &jsonError);
     if (doc.isNull()) {
-        std::cout << "could not parse " << file_name << std::endl;
-        std::cout << "parse error at line " << jsonError.offset << ": "
+        *m_messages << "could not parse " << file_name << std::endl;
+        *m_messages << "parse error at line " << jsonError.offset << ": "
                   << jsonError.errorString().toStdString() << std::endl;
         return false;
     }
     file.close();
 
     if (!doc.isObject()) {
-        std::cout << "document is not an object" << std::endl;
+        *m_messages << "document is not an object" << std::endl;
         return false;
     }
 
@@ -98,11 +115,11 @@ bool ScenefileReader::readJSON() {
     QJsonObject scenefile = doc.object();
 
     if (!scenefile.contains("globalData")) {
-        std::cout << "missing required field \"globalData\" on root object" << std::endl;
+        *m_messages << "missing required field \"globalData\" on root object" << std::endl;
         return false;
     }
     if (!scenefile.contains("cameraData")) {
-        std::cout << "missing required field \"cameraData\" on root object" << std::endl;
+        *m_messages << "missing required field \"cameraData\" on root object" << std::endl;
         return false;
     }
 
@@ -112,20 +129,20 @@ bool ScenefileReader::readJSON() {
     QStringList allFields = requiredFields + optionalFields;
     for (auto &field : scenefile.keys()) {
         if (!allFields.contains(field)) {
-            std::cout << "unknown field \"" << field.toStdString() << "\" on root object" << std::endl;
+            *m_messages << "unknown field \"" << field.toStdString() << "\" on root object" << std::endl;
             return false;
         }
     }
 
     // Parse the global data
     if (!parseGlobalData(scenefile["globalData"].toObject())) {
-        std::cout << "could not parse \"globalData\"" << std::endl;
+        *m_messages << "could not parse \"globalData\"" << std::endl;
         return false;
     }
 
     // Parse the camera data
     if (!parseCameraData(scenefile["cameraData"].toObject())) {
-        std::cout << "could not parse \"cameraData\"" << std::endl;
+        *m_messages << "could not parse \"cameraData\"" << std::endl;
         return false;
     }
 
@@ -143,7 +160,7 @@ bool ScenefileReader::readJSON() {
         }
     }
 
-    std::cout << "Finished reading " << file_name << std::endl;
+    *m_messages << "Finished reading " << file_name << std::endl;
     return true;
 }
 
@@ -156,13 +173,13 @@ bool ScenefileReader::parseGlobalData(const QJsonObject &globalData) {
     QStringList allFields = requiredFields + optionalFields;
     for (auto field : globalData.keys()) {
         if (!allFields.contains(field)) {
-            std::cout << "unknown field \"" << field.toStdString() << "\" on globalData object" << std::endl;
+            *m_messages << "unknown field \"" << field.toStdString() << "\" on globalData object" << std::endl;
             return false;
         }
     }
     for (auto field : requiredFields) {
         if (!globalData.contains(field)) {
-            std::cout << "missing required field \"" << field.toStdString() << "\" on globalData object" << std::endl;
+            *m_messages << "missing required field \"" << field.toStdString() << "\" on globalData object" << std::endl;
             return false;
         }
     }
@@ -172,21 +189,21 @@ bool ScenefileReader::parseGlobalData(const QJsonObject &globalData) {
         m_globalData.ka = globalData["ambientCoeff"].toDouble();
     }
     else {
-        std::cout << "globalData ambientCoeff must be a floating-point value" << std::endl;
+        *m_messages << "globalData ambientCoeff must be a floating-point value" << std::endl;
         return false;
     }
     if (globalData["diffuseCoeff"].isDouble()) {
         m_globalData.kd = globalData["diffuseCoeff"].toDouble();
     }
     else {
-        std::cout << "globalData diffuseCoeff must be a floating-point value" << std::endl;
+        *m_messages << "globalData diffuseCoeff must be a floating-point value" << std::endl;
         return false;
     }
     if (globalData["specularCoeff"].isDouble()) {
         m_globalData.ks = globalData["specularCoeff"].toDouble();
     }
     else {
-        std::cout << "globalData specularCoeff must be a floating-point value" << std::endl;
+        *m_messages << "globalData specularCoeff must be a floating-point value" << std::endl;
         return false;
     }
     if (globalData.contains("transparentCoeff")) {
@@ -194,7 +211,7 @@ bool ScenefileReader::parseGlobalData(const QJsonObject &globalData) {
             m_globalData.kt = globalData["transparentCoeff"].toDouble();
         }
         else {
-            std::cout << "globalData transparentCoeff must be a floating-point value" << std::endl;
+            *m_messages << "globalData transparentCoeff must be a floating-point value" << std::endl;
             return false;
         }
     }
@@ -211,19 +228,19 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
     QStringList allFields = requiredFields + optionalFields;
     for (auto &field : lightData.keys()) {
         if (!allFields.contains(field)) {
-            std::cout << "unknown field \"" << field.toStdString() << "\" on light object" << std::endl;
+            *m_messages << "unknown field \"" << field.toStdString() << "\" on light object" << std::endl;
             return false;
         }
     }
     for (auto &field : requiredFields) {
         if (!lightData.contains(field)) {
-            std::cout << "missing required field \"" << field.toStdString() << "\" on light object" << std::endl;
+            *m_messages << "missing required field \"" << field.toStdString() << "\" on light object" << std::endl;
             return false;
         }
     }
 
     // Create a default light
-    SceneLight *light = new SceneLight();
+    SceneLight *light = m_arena.create<SceneLight>();
     memset(light, 0, sizeof(SceneLight));
     node->lights.push_back(light);
 
@@ -232,16 +249,16 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
 
     // parse the color
     if (!lightData["color"].isArray()) {
-        std::cout << "light color must be of type array" << std::endl;
+        *m_messages << "light color must be of type array" << std::endl;
         return false;
     }
     QJsonArray colorArray = lightData["color"].toArray();
     if (colorArray.size() != 3) {
-        std::cout << "light color must be of size 3" << std::endl;
+        *m_messages << "light color must be of size 3" << std::endl;
         return false;
     }
     if (!colorArray[0].isDouble() || !colorArray[1].isDouble() || !colorArray[2].isDouble()) {
-        std::cout << "light color must contain floating-point values" << std::endl;
+        *m_messages << "light color must contain floating-point values" << std::endl;
         return false;
     }
     light->color.r = colorArray[0].toDouble();
@@ -250,7 +267,7 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
 
     // parse the type
     if (!lightData["type"].isString()) {
-        std::cout << "light type must be of type string" << std::endl;
+        *m_messages << "light type must be of type string" << std::endl;
         return false;
     }
     std::string lightType = lightData["type"].toString().toStdString();
@@ -261,20 +278,20 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
 
         // parse direction
         if (!lightData.contains("direction")) {
-            std::cout << "directional light must contain field \"direction\"" << std::endl;
+            *m_messages << "directional light must contain field \"direction\"" << std::endl;
             return false;
         }
         if (!lightData["direction"].isArray()) {
-            std::cout << "directional light direction must be of type array" << std::endl;
+            *m_messages << "directional light direction must be of type array" << std::endl;
             return false;
         }
         QJsonArray directionArray = lightData["direction"].toArray();
         if (directionArray.size() != 3) {
-            std::cout << "directional light direction must be of size 3" << std::endl;
+            *m_messages << "directional light direction must be of size 3" << std::endl;
             return false;
         }
         if (!directionArray[0].isDouble() || !directionArray[1].isDouble() || !directionArray[2].isDouble()) {
-            std::cout << "directional light direction must contain floating-point values" << std::endl;
+            *m_messages << "directional light direction must contain floating-point values" << std::endl;
             return false;
         }
         light->dir.x = directionArray[0].toDouble();
@@ -286,20 +303,20 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
 
         // parse the attenuation coefficient
         if (!lightData.contains("attenuationCoeff")) {
-            std::cout << "point light must contain field \"attenuationCoeff\"" << std::endl;
+            *m_messages << "point light must contain field \"attenuationCoeff\"" << std::endl;
             return false;
         }
         if (!lightData["attenuationCoeff"].isArray()) {
-            std::cout << "point light attenuationCoeff must be of type array" << std::endl;
+            *m_messages << "point light attenuationCoeff must be of type array" << std::endl;
             return false;
         }
         QJsonArray attenuationArray = lightData["attenuationCoeff"].toArray();
         if (attenuationArray.size() != 3) {
-            std::cout << "point light attenuationCoeff must be of size 3" << std::endl;
+            *m_messages << "point light attenuationCoeff must be of size 3" << std::endl;
             return false;
         }
         if (!attenuationArray[0].isDouble() || !attenuationArray[1].isDouble() || !attenuationArray[2].isDouble()) {
-            std::cout << "ppoint light attenuationCoeff must contain floating-point values" << std::endl;
+            *m_messages << "ppoint light attenuationCoeff must contain floating-point values" << std::endl;
             return false;
         }
         light->function.x = attenuationArray[0].toDouble();
@@ -310,7 +327,7 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
         QStringList pointRequiredFields = {"direction", "penumbra", "angle", "attenuationCoeff"};
         for (auto &field : pointRequiredFields) {
             if (!lightData.contains(field)) {
-                std::cout << "missing required field \"" << field.toStdString() << "\" on spotlight object" << std::endl;
+                *m_messages << "missing required field \"" << field.toStdString() << "\" on spotlight object" << std::endl;
                 return false;
             }
         }
@@ -318,16 +335,16 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
 
         // parse direction
         if (!lightData["direction"].isArray()) {
-            std::cout << "spotlight direction must be of type array" << std::endl;
+            *m_messages << "spotlight direction must be of type array" << std::endl;
             return false;
         }
         QJsonArray directionArray = lightData["direction"].toArray();
         if (directionArray.size() != 3) {
-            std::cout << "spotlight direction must be of size 3" << std::endl;
+            *m_messages << "spotlight direction must be of size 3" << std::endl;
             return false;
         }
         if (!directionArray[0].isDouble() || !directionArray[1].isDouble() || !directionArray[2].isDouble()) {
-            std::cout << "spotlight direction must contain floating-point values" << std::endl;
+            *m_messages << "spotlight direction must contain floating-point values" << std::endl;
             return false;
         }
         light->dir.x = directionArray[0].toDouble();
@@ -336,16 +353,16 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
 
         // parse attenuation coefficient
         if (!lightData["attenuationCoeff"].isArray()) {
-            std::cout << "spotlight attenuationCoeff must be of type array" << std::endl;
+            *m_messages << "spotlight attenuationCoeff must be of type array" << std::endl;
             return false;
         }
         QJsonArray attenuationArray = lightData["attenuationCoeff"].toArray();
         if (attenuationArray.size() != 3) {
-            std::cout << "spotlight attenuationCoeff must be of size 3" << std::endl;
+            *m_messages << "spotlight attenuationCoeff must be of size 3" << std::endl;
             return false;
         }
         if (!attenuationArray[0].isDouble() || !attenuationArray[1].isDouble() || !attenuationArray[2].isDouble()) {
-            std::cout << "spotlight direction must contain floating-point values" << std::endl;
+            *m_messages << "spotlight direction must contain floating-point values" << std::endl;
             return false;
         }
         light->function.x = attenuationArray[0].toDouble();
@@ -354,20 +371,20 @@ bool ScenefileReader::parseLightData(const QJsonObject &lightData, SceneNode *no
 
         // parse penumbra
         if (!lightData["penumbra"].isDouble()) {
-            std::cout << "spotlight penumbra must be of type float" << std::endl;
+            *m_messages << "spotlight penumbra must be of type float" << std::endl;
             return false;
         }
         light->penumbra = lightData["penumbra"].toDouble() * M_PI / 180.f;
 
         // parse angle
         if (!lightData["angle"].isDouble()) {
-            std::cout << "spotlight angle must be of type float" << std::endl;
+            *m_messages << "spotlight angle must be of type float" << std::endl;
             return false;
         }
         light->angle = lightData["angle"].toDouble() * M_PI / 180.f;
     }
     else {
-        std::cout << "unknown light type \"" << lightType << "\"" << std::endl;
+        *m_messages << "unknown light type \"" << lightType << "\"" << std::endl;
         return false;
     }
 
@@ -383,20 +400,20 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
     QStringList allFields = requiredFields + optionalFields;
     for (auto &field : cameradata.keys()) {
         if (!allFields.contains(field)) {
-            std::cout << "unknown field \"" << field.toStdString() << "\" on cameraData object" << std::endl;
+            *m_messages << "unknown field \"" << field.toStdString() << "\" on cameraData object" << std::endl;
             return false;
         }
     }
     for (auto &field : requiredFields) {
         if (!cameradata.contains(field)) {
-            std::cout << "missing required field \"" << field.toStdString() << "\" on cameraData object" << std::endl;
+            *m_messages << "missing required field \"" << field.toStdString() << "\" on cameraData object" << std::endl;
             return false;
         }
     }
 
     // Must have either look or focus, but not both
     if (cameradata.contains("look") && cameradata.contains("focus")) {
-        std::cout << "cameraData cannot contain both \"look\" and \"focus\"" << std::endl;
+        *m_messages << "cameraData cannot contain both \"look\" and \"focus\"" << std::endl;
         return false;
     }
 
@@ -404,11 +421,11 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
     if (cameradata["position"].isArray()) {
         QJsonArray position = cameradata["position"].toArray();
         if (position.size() != 3) {
-            std::cout << "cameraData position must have 3 elements" << std::endl;
+            *m_messages << "cameraData position must have 3 elements" << std::endl;
             return false;
         }
         if (!position[0].isDouble() || !position[1].isDouble() || !position[2].isDouble()) {
-            std::cout << "cameraData position must be a floating-point value" << std::endl;
+            *m_messages << "cameraData position must be a floating-point value" << std::endl;
             return false;
         }
         m_cameraData.pos.x = position[0].toDouble();
@@ -416,18 +433,18 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
         m_cameraData.pos.z = position[2].toDouble();
     }
     else {
-        std::cout << "cameraData position must be an array" << std::endl;
+        *m_messages << "cameraData position must be an array" << std::endl;
         return false;
     }
 
     if (cameradata["up"].isArray()) {
         QJsonArray up = cameradata["up"].toArray();
         if (up.size() != 3) {
-            std::cout << "cameraData up must have 3 elements" << std::endl;
+            *m_messages << "cameraData up must have 3 elements" << std::endl;
             return false;
         }
         if (!up[0].isDouble() || !up[1].isDouble() || !up[2].isDouble()) {
-            std::cout << "cameraData up must be a floating-point value" << std::endl;
+            *m_messages << "cameraData up must be a floating-point value" << std::endl;
             return false;
         }
         m_cameraData.up.x = up[0].toDouble();
@@ -435,7 +452,7 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
         m_cameraData.up.z = up[2].toDouble();
     }
     else {
-        std::cout << "cameraData up must be an array" << std::endl;
+        *m_messages << "cameraData up must be an array" << std::endl;
         return false;
     }
 
@@ -443,7 +460,7 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
         m_cameraData.heightAngle = cameradata["heightAngle"].toDouble() * M_PI / 180.f;
     }
     else {
-        std::cout << "cameraData heightAngle must be a floating-point value" << std::endl;
+        *m_messages << "cameraData heightAngle must be a floating-point value" << std::endl;
         return false;
     }
 
@@ -452,7 +469,7 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
             m_cameraData.aperture = cameradata["aperture"].toDouble();
         }
         else {
-            std::cout << "cameraData aperture must be a floating-point value" << std::endl;
+            *m_messages << "cameraData aperture must be a floating-point value" << std::endl;
             return false;
         }
     }
@@ -462,7 +479,7 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
             m_cameraData.focalLength = cameradata["focalLength"].toDouble();
         }
         else {
-            std::cout << "cameraData focalLength must be a floating-point value" << std::endl;
+            *m_messages << "cameraData focalLength must be a floating-point value" << std::endl;
             return false;
         }
     }
@@ -473,11 +490,11 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
         if (cameradata["look"].isArray()) {
             QJsonArray look = cameradata["look"].toArray();
             if (look.size() != 3) {
-                std::cout << "cameraData look must have 3 elements" << std::endl;
+                *m_messages << "cameraData look must have 3 elements" << std::endl;
                 return false;
             }
             if (!look[0].isDouble() || !look[1].isDouble() || !look[2].isDouble()) {
-                std::cout << "cameraData look must be a floating-point value" << std::endl;
+                *m_messages << "cameraData look must be a floating-point value" << std::endl;
                 return false;
             }
             m_cameraData.look.x = look[0].toDouble();
@@ -485,7 +502,7 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
             m_cameraData.look.z = look[2].toDouble();
         }
         else {
-            std::cout << "cameraData look must be an array" << std::endl;
+            *m_messages << "cameraData look must be an array" << std::endl;
             return false;
         }
     }
@@ -493,11 +510,11 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
         if (cameradata["focus"].isArray()) {
             QJsonArray focus = cameradata["focus"].toArray();
             if (focus.size() != 3) {
-                std::cout << "cameraData focus must have 3 elements" << std::endl;
+                *m_messages << "cameraData focus must have 3 elements" << std::endl;
                 return false;
             }
             if (!focus[0].isDouble() || !focus[1].isDouble() || !focus[2].isDouble()) {
-                std::cout << "cameraData focus must be a floating-point value" << std::endl;
+                *m_messages << "cameraData focus must be a floating-point value" << std::endl;
                 return false;
             }
             m_cameraData.look.x = focus[0].toDouble();
@@ -505,7 +522,7 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
             m_cameraData.look.z = focus[2].toDouble();
         }
         else {
-            std::cout << "cameraData focus must be an array" << std::endl;
+            *m_messages << "cameraData focus must be an array" << std::endl;
             return false;
         }
     }
@@ -521,14 +538,14 @@ bool ScenefileReader::parseCameraData(const QJsonObject &cameradata) {
 
 bool ScenefileReader::parseTemplateGroups(const QJsonValue &templateGroups) {
     if (!templateGroups.isArray()) {
-        std::cout << "templateGroups must be an array" << std::endl;
+        *m_messages << "templateGroups must be an array" << std::endl;
         return false;
     }
 
     QJsonArray templateGroupsArray = templateGroups.toArray();
     for (auto templateGroup : templateGroupsArray) {
         if (!templateGroup.isObject()) {
-            std::cout << "templateGroup items must be of type object" << std::endl;
+            *m_messages << "templateGroup items must be of type object" << std::endl;
             return false;
         }
 
@@ -546,34 +563,33 @@ bool ScenefileReader::parseTemplateGroupData(const QJsonObject &templateGroup) {
     QStringList allFields = requiredFields + optionalFields;
     for (auto &field : templateGroup.keys()) {
         if (!allFields.contains(field)) {
-            std::cout << "unknown field \"" << field.toStdString() << "\" on templateGroup object" << std::endl;
+            *m_messages << "unknown field \"" << field.toStdString() << "\" on templateGroup object" << std::endl;
             return false;
         }
     }
 
     for (auto &field : requiredFields) {
         if (!templateGroup.contains(field)) {
-            std::cout << "missing required field \"" << field.toStdString() << "\" on templateGroup object" << std::endl;
+            *m_messages << "missing required field \"" << field.toStdString() << "\" on templateGroup object" << std::endl;
             return false;
         }
     }
 
     if (!templateGroup["name"].isString()) {
-        std::cout << "templateGroup name must be a string" << std::endl;
+        *m_messages << "templateGroup name must be a string" << std::endl;
     }
     if (m_templates.contains(templateGroup["name"].toString().toStdString())) {
-        std::cout << "templateGroups cannot have the same" << std::endl;
+        *m_messages << "templateGroups cannot have the same" << std::endl;
     }
 
-    SceneNode *templateNode = new SceneNode;
-    m_nodes.push_back(templateNode);
+    SceneNode *templateNode = m_arena.create<SceneNode>();
     m_templates[templateGroup["name"].toString().toStdString()] = templateNode;
 
     return parseGroupData(templateGroup, templateNode);
 }
 
 /**
- * Parse a group object and create a new CS123SceneNode in m_nodes.
+ * Parse a group object and create a new CS123SceneNode in m_arena.
  * NAME OF NODE CANNOT REFERENCE TEMPLATE NODE
  */
 bool ScenefileReader::parseGroupData(const QJsonObject &object, SceneNode *node) {
@@ -581,29 +597,85 @@ bool ScenefileReader::parseGroupData(const QJsonObject &object, SceneNode *node)
     QStringList allFields = optionalFields;
     for (auto &field : object.keys()) {
         if (!allFields.contains(field)) {
-            std::cout << "unknown field \"" << field.toStdString() << "\" on group object" << std::endl;
+            *m_messages << "unknown field \"" << field.toStdString() << "\" on group object" << std::endl;
+            return false;
+        }
+    }
+
+    if (!parseTransformations(object, node)) {
+        return false;
+    }
+
+    // parse lights if any
+    if (object.contains("lights")) {
+        if (!object["lights"].isArray()) {
+            *m_messages << "group lights must be of type array" << std::endl;
+            return false;
+        }
+        QJsonArray lightsArray = object["lights"].toArray();
+        for (auto light : lightsArray) {
+            if (!light.isObject()) {
+                *m_messages << "light must be of type object" << std::endl;
+                return false;
+            }
+
+            if (!parseLightData(light.toObject(), node)) {
+                return false;
+            }
+        }
+    }
+
+    // parse primitives if any
+    if (object.contains("primitives")) {
+        if (!object["primitives"].isArray()) {
+            *m_messages << "group primitives must be of type array" << std::endl;
+            return false;
+        }
+        QJsonArray primitivesArray = object["primitives"].toArray();
+        for (auto primitive : primitivesArray) {
+            if (!primitive.isObject()) {
+                *m_messages << "primitive must be of type object" << std::endl;
+                return false;
+            }
+
+            if (!parsePrimitive(primitive.toObject(), node)) {
+                return false;
+            }
+        }
+    }
+
+    // parse children groups if any
+    if (object.contains("groups")) {
+        if (!parseGroups(object["groups"], node)) {
             return false;
         }
     }
 
+    return true;
+}
+
+/**
+ * Parse the translate, rotate, scale and matrix fields of a group object, in that order.
+ */
+bool ScenefileReader::parseTransformations(const QJsonObject &object, SceneNode *node) {
     // parse translation if defined
     if (object.contains("translate")) {
         if (!object["translate"].isArray()) {
-            std::cout << "group translate must be of type array" << std::endl;
+            *m_messages << "group translate must be of type array" << std::endl;
             return false;
         }
 
         QJsonArray translateArray = object["translate"].toArray();
         if (translateArray.size() != 3) {
-            std::cout << "group translate must have 3 elements" << std::endl;
+            *m_messages << "group translate must have 3 elements" << std::endl;
             return false;
         }
         if (!translateArray[0].isDouble() || !translateArray[1].isDouble() || !translateArray[2].isDouble()) {
-            std::cout << "group translate must contain floating-point values" << std::endl;
+            *m_messages << "group translate must contain floating-point values" << std::endl;
             return false;
         }
 
-        SceneTransformation *translation = new SceneTransformation();
+        SceneTransformation *translation = m_arena.create<SceneTransformation>();
         translation->type = TransformationType::TRANSFORMATION_TRANSLATE;
         translation->translate.x = translateArray[0].toDouble();
         translation->translate.y = translateArray[1].toDouble();
@@ -615,21 +687,21 @@ bool ScenefileReader::parseGroupData(const QJsonObject &object, SceneNode *node)
     // parse rotation if defined
     if (object.contains("rotate")) {
         if (!object["rotate"].isArray()) {
-            std::cout << "group rotate must be of type array" << std::endl;
+            *m_messages << "group rotate must be of type array" << std::endl;
             return false;
         }
 
         QJsonArray rotateArray = object["rotate"].toArray();
         if (rotateArray.size() != 4) {
-            std::cout << "group rotate must have 4 elements" << std::endl;
+            *m_messages << "group rotate must have 4 elements" << std::endl;
             return false;
         }
         if (!rotateArray[0].isDouble() || !rotateArray[1].isDouble() || !rotateArray[2].isDouble() || !rotateArray[3].isDouble()) {
-            std::cout << "group rotate must contain floating-point values" << std::endl;
+            *m_messages << "group rotate must contain floating-point values" << std::endl;
             return false;
         }
 
-        SceneTransformation *rotation = new SceneTransformation();
+        SceneTransformation *rotation = m_arena.create<SceneTransformation>();
         rotation->type = TransformationType::TRANSFORMATION_ROTATE;
         rotation->rotate.x = rotateArray[0].toDouble();
         rotation->rotate.y = rotateArray[1].toDouble();
@@ -642,21 +714,21 @@ bool ScenefileReader::parseGroupData(const QJsonObject &object, SceneNode *node)
     // parse scale if defined
     if (object.contains("scale")) {
         if (!object["scale"].isArray()) {
-            std::cout << "group scale must be of type array" << std::endl;
+            *m_messages << "group scale must be of type array" << std::endl;
             return false;
         }
 
         QJsonArray scaleArray = object["scale"].toArray();
         if (scaleArray.size() != 3) {
-            std::cout << "group scale must have 3 elements" << std::endl;
+            *m_messages << "group scale must have 3 elements" << std::endl;
             return false;
         }
         if (!scaleArray[0].isDouble() || !scaleArray[1].isDouble() || !scaleArray[2].isDouble()) {
-            std::cout << "group scale must contain floating-point values" << std::endl;
+            *m_messages << "group scale must contain floating-point values" << std::endl;
             return false;
         }
 
-        SceneTransformation *scale = new SceneTransformation();
+        SceneTransformation *scale = m_arena.create<SceneTransformation>();
         scale->type = TransformationType::TRANSFORMATION_SCALE;
         scale->scale.x = scaleArray[0].toDouble();
         scale->scale.y = scaleArray[1].toDouble();
@@ -668,37 +740,37 @@ bool ScenefileReader::parseGroupData(const QJsonObject &object, SceneNode *node)
     // parse matrix if defined
     if (object.contains("matrix")) {
         if (!object["matrix"].isArray()) {
-            std::cout << "group matrix must be of type array of array" << std::endl;
+            *m_messages << "group matrix must be of type array of array" << std::endl;
             return false;
         }
 
         QJsonArray matrixArray = object["matrix"].toArray();
         if (matrixArray.size() != 4) {
-            std::cout << "group matrix must be 4x4" << std::endl;
+            *m_messages << "group matrix must be 4x4" << std::endl;
             return false;
         }
 
-        SceneTransformation *matrixTransformation = new SceneTransformation();
+        SceneTransformation *matrixTransformation = m_arena.create<SceneTransformation>();
         matrixTransformation->type = TransformationType::TRANSFORMATION_MATRIX;
 
         float *matrixPtr = glm::value_ptr(matrixTransformation->matrix);
         int rowIndex = 0;
         for (auto row : matrixArray) {
             if (!row.isArray()) {
-                std::cout << "group matrix must be of type array of array" << std::endl;
+                *m_messages << "group matrix must be of type array of array" << std::endl;
                 return false;
             }
 
             QJsonArray rowArray = row.toArray();
             if (rowArray.size() != 4) {
-                std::cout << "group matrix must be 4x4" << std::endl;
+                *m_messages << "group matrix must be 4x4" << std::endl;
                 return false;
             }
 
             int colIndex = 0;
             for (auto val : rowArray) {
                 if (!val.isDouble()) {
-                    std::cout << "group matrix must contain all floating-point values" << std::endl;
+                    *m_messages << "group matrix must contain all floating-point values" << std::endl;
                     return false;
                 }
 
@@ -712,71 +784,26 @@ bool ScenefileReader::parseGroupData(const QJsonObject &object, SceneNode *node)
         node->transformations.push_back(matrixTransformation);
     }
 
-    // parse lights if any
-    if (object.contains("lights")) {
-        if (!object["lights"].isArray()) {
-            std::cout << "group lights must be of type array" << std::endl;
-            return false;
-        }
-        QJsonArray lightsArray = object["lights"].toArray();
-        for (auto light : lightsArray) {
-            if (!light.isObject()) {
-                std::cout << "light must be of type object" << std::endl;
-                return false;
-            }
-
-            if (!parseLightData(light.toObject(), node)) {
-                return false;
-            }
-        }
-    }
-
-    // parse primitives if any
-    if (object.contains("primitives")) {
-        if (!object["primitives"].isArray()) {
-            std::cout << "group primitives must be of type array" << std::endl;
-            return false;
-        }
-        QJsonArray primitivesArray = object["primitives"].toArray();
-        for (auto primitive : primitivesArray) {
-            if (!primitive.isObject()) {
-                std::cout << "primitive must be of type object" << std::endl;
-                return false;
-            }
-
-            if (!parsePrimitive(primitive.toObject(), node)) {
-                return false;
-            }
-        }
-    }
-
-    // parse children groups if any
-    if (object.contains("groups")) {
-        if (!parseGroups(object["groups"], node)) {
-            return false;
-        }
-    }
-
     return true;
 }
 
 bool ScenefileReader::parseGroups(const QJsonValue &groups, SceneNode *parent) {
     if (!groups.isArray()) {
-        std::cout << "groups must be of type array" << std::endl;
+        *m_messages << "groups must be of type array" << std::endl;
         return false;
     }
 
     QJsonArray groupsArray = groups.toArray();
     for (auto group : groupsArray) {
         if (!group.isObject()) {
-            std::cout << "group items must be of type object" << std::endl;
+            *m_messages << "group items must be of type object" << std::endl;
             return false;
         }
 
         QJsonObject groupData = group.toObject();
         if (groupData.contains("name")) {
             if (!groupData["name"].isString()) {
-                std::cout << "group name must be of type string" << std::endl;
+                *m_messages << "group name must be of type string" << std::endl;
                 return false;
             }
 
@@ -788,8 +815,7 @@ bool ScenefileReader::parseGroups(const QJsonValue &groups, SceneNode *parent) {
             }
         }
 
-        SceneNode *node = new SceneNode;
-        m_nodes.push_back(node);
+        SceneNode *node = m_arena.create<SceneNode>();
         parent->children.push_back(node);
 
         if (!parseGroupData(group.toObject(), node)) {
@@ -812,25 +838,25 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
     QStringList allFields = requiredFields + optionalFields;
     for (auto field : prim.keys()) {
         if (!allFields.contains(field)) {
-            std::cout << "unknown field \"" << field.toStdString() << "\" on primitive object" << std::endl;
+            *m_messages << "unknown field \"" << field.toStdString() << "\" on primitive object" << std::endl;
             return false;
         }
     }
     for (auto field : requiredFields) {
         if (!prim.contains(field)) {
-            std::cout << "missing required field \"" << field.toStdString() << "\" on primitive object" << std::endl;
+            *m_messages << "missing required field \"" << field.toStdString() << "\" on primitive object" << std::endl;
             return false;
         }
     }
 
     if (!prim["type"].isString()) {
-        std::cout << "primitive type must be of type string" << std::endl;
+        *m_messages << "primitive type must be of type string" << std::endl;
         return false;
     }
     std::string primType = prim["type"].toString().toStdString();
 
     // Default primitive
-    ScenePrimitive *primitive = new ScenePrimitive();
+    ScenePrimitive *primitive = m_arena.create<ScenePrimitive>();
     SceneMaterial &mat = primitive->material;
     mat.clear();
     primitive->type = PrimitiveType::PRIMITIVE_CUBE;
@@ -851,11 +877,11 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
     else if (primType == "mesh") {
         primitive->type = PrimitiveType::PRIMITIVE_MESH;
         if (!prim.contains("meshFile")) {
-            std::cout << "primitive type mesh must contain field meshFile" << std::endl;
+            *m_messages << "primitive type mesh must contain field meshFile" << std::endl;
             return false;
         }
         if (!prim["meshFile"].isString()) {
-            std::cout << "primitive meshFile must be of type string" << std::endl;
+            *m_messages << "primitive meshFile must be of type string" << std::endl;
             return false;
         }
 
@@ -863,24 +889,24 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
         primitive->meshfile = (basepath / relativePath).string();
     }
     else {
-        std::cout << "unknown primitive type \"" << primType << "\"" << std::endl;
+        *m_messages << "unknown primitive type \"" << primType << "\"" << std::endl;
         return false;
     }
 
     if (prim.contains("ambient")) {
         if (!prim["ambient"].isArray()) {
-            std::cout << "primitive ambient must be of type array" << std::endl;
+            *m_messages << "primitive ambient must be of type array" << std::endl;
             return false;
         }
         QJsonArray ambientArray = prim["ambient"].toArray();
         if (ambientArray.size() != 3) {
-            std::cout << "primitive ambient array must be of size 3" << std::endl;
+            *m_messages << "primitive ambient array must be of size 3" << std::endl;
             return false;
         }
 
         for (int i = 0; i < 3; i++) {
             if (!ambientArray[i].isDouble()) {
-                std::cout << "primitive ambient must contain floating-point values" << std::endl;
+                *m_messages << "primitive ambient must contain floating-point values" << std::endl;
                 return false;
             }
 
@@ -890,18 +916,18 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("diffuse")) {
         if (!prim["diffuse"].isArray()) {
-            std::cout << "primitive diffuse must be of type array" << std::endl;
+            *m_messages << "primitive diffuse must be of type array" << std::endl;
             return false;
         }
         QJsonArray diffuseArray = prim["diffuse"].toArray();
         if (diffuseArray.size() != 3) {
-            std::cout << "primitive diffuse array must be of size 3" << std::endl;
+            *m_messages << "primitive diffuse array must be of size 3" << std::endl;
             return false;
         }
 
         for (int i = 0; i < 3; i++) {
             if (!diffuseArray[i].isDouble()) {
-                std::cout << "primitive diffuse must contain floating-point values" << std::endl;
+                *m_messages << "primitive diffuse must contain floating-point values" << std::endl;
                 return false;
             }
 
@@ -911,18 +937,18 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("specular")) {
         if (!prim["specular"].isArray()) {
-            std::cout << "primitive specular must be of type array" << std::endl;
+            *m_messages << "primitive specular must be of type array" << std::endl;
             return false;
         }
         QJsonArray specularArray = prim["specular"].toArray();
         if (specularArray.size() != 3) {
-            std::cout << "primitive specular array must be of size 3" << std::endl;
+            *m_messages << "primitive specular array must be of size 3" << std::endl;
             return false;
         }
 
         for (int i = 0; i < 3; i++) {
             if (!specularArray[i].isDouble()) {
-                std::cout << "primitive specular must contain floating-point values" << std::endl;
+                *m_messages << "primitive specular must contain floating-point values" << std::endl;
                 return false;
             }
 
@@ -932,18 +958,18 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("reflective")) {
         if (!prim["reflective"].isArray()) {
-            std::cout << "primitive reflective must be of type array" << std::endl;
+            *m_messages << "primitive reflective must be of type array" << std::endl;
             return false;
         }
         QJsonArray reflectiveArray = prim["reflective"].toArray();
         if (reflectiveArray.size() != 3) {
-            std::cout << "primitive reflective array must be of size 3" << std::endl;
+            *m_messages << "primitive reflective array must be of size 3" << std::endl;
             return false;
         }
 
         for (int i = 0; i < 3; i++) {
             if (!reflectiveArray[i].isDouble()) {
-                std::cout << "primitive reflective must contain floating-point values" << std::endl;
+                *m_messages << "primitive reflective must contain floating-point values" << std::endl;
                 return false;
             }
 
@@ -953,18 +979,18 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("transparent")) {
         if (!prim["transparent"].isArray()) {
-            std::cout << "primitive transparent must be of type array" << std::endl;
+            *m_messages << "primitive transparent must be of type array" << std::endl;
             return false;
         }
         QJsonArray transparentArray = prim["transparent"].toArray();
         if (transparentArray.size() != 3) {
-            std::cout << "primitive transparent array must be of size 3" << std::endl;
+            *m_messages << "primitive transparent array must be of size 3" << std::endl;
             return false;
         }
 
         for (int i = 0; i < 3; i++) {
             if (!transparentArray[i].isDouble()) {
-                std::cout << "primitive transparent must contain floating-point values" << std::endl;
+                *m_messages << "primitive transparent must contain floating-point values" << std::endl;
                 return false;
             }
 
@@ -974,7 +1000,7 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("shininess")) {
         if (!prim["shininess"].isDouble()) {
-            std::cout << "primitive shininess must be of type float" << std::endl;
+            *m_messages << "primitive shininess must be of type float" << std::endl;
             return false;
         }
 
@@ -983,7 +1009,7 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("ior")) {
         if (!prim["ior"].isDouble()) {
-            std::cout << "primitive ior must be of type float" << std::endl;
+            *m_messages << "primitive ior must be of type float" << std::endl;
             return false;
         }
 
@@ -992,7 +1018,7 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("blend")) {
         if (!prim["blend"].isDouble()) {
-            std::cout << "primitive blend must be of type float" << std::endl;
+            *m_messages << "primitive blend must be of type float" << std::endl;
             return false;
         }
 
@@ -1001,7 +1027,7 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("textureFile")) {
         if (!prim["textureFile"].isString()) {
-            std::cout << "primitive textureFile must be of type string" << std::endl;
+            *m_messages << "primitive textureFile must be of type string" << std::endl;
             return false;
         }
         std::filesystem::path fileRelativePath(prim["textureFile"].toString().toStdString());
@@ -1014,7 +1040,7 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     if (prim.contains("bumpMapFile")) {
         if (!prim["bumpMapFile"].isString()) {
-            std::cout << "primitive bumpMapFile must be of type string" << std::endl;
+            *m_messages << "primitive bumpMapFile must be of type string" << std::endl;
             return false;
         }
         std::filesystem::path fileRelativePath(prim["bumpMapFile"].toString().toStdString());
@@ -1027,3 +1053,386 @@ bool ScenefileReader::parsePrimitive(const QJsonObject &prim, SceneNode *node) {
 
     return true;
 }
+
+/**
+ * Streaming counterpart of readJSON(). The root object, groups and template groups are
+ * walked token by token; only small leaf objects (global data, camera data, lights,
+ * primitives and transformations) are materialized, one at a time, and handed to the
+ * same parse* functions as the DOM path.
+ *
+ * readJSON() only validates a document that parsed, so the file is read twice: the first
+ * pass checks the syntax and the root object, and the second streams the groups. As in a
+ * QJsonObject, the last of several fields with the same name is the one that is read.
+ */
+bool ScenefileReader::readJSONStream() {
+    using Token = JsonStreamReader::Token;
+    TraceScope scope("io", "ScenefileReader::readJSONStream");
+    scope.addArg("file", file_name);
+
+    QFile file(file_name.c_str());
+    if (!file.open(QFile::ReadOnly)) {
+        *m_messages << "could not open " << file_name << std::endl;
+        return false;
+    }
+
+    QStringList allFields = {"globalData", "cameraData", "name", "groups", "templateGroups"};
+    bool isObject = false;
+    bool hasGlobalData = false;
+    bool hasCameraData = false;
+    QJsonValue globalData;
+    QJsonValue cameraData;
+    bool hasUnknownField = false;
+    QString unknownField; // The first in the order readJSON() checks them, which is sorted
+    int templateGroupsCount = 0;
+    int groupsCount = 0;
+    {
+        JsonStreamReader json(file);
+        Token token = json.next();
+        isObject = token == Token::TOKEN_BEGIN_OBJECT;
+        if (!isObject && !json.skipValue(token)) {
+            return streamError(json);
+        }
+        while (isObject && (token = json.next()) != Token::TOKEN_END_OBJECT) {
+            if (token == Token::TOKEN_ERROR) {
+                return streamError(json);
+            }
+
+            QString field = QString::fromStdString(json.string());
+            Token value = json.next();
+            bool read;
+            if (field == "globalData") {
+                hasGlobalData = true;
+                read = json.readValue(value, globalData);
+            }
+            else if (field == "cameraData") {
+                hasCameraData = true;
+                read = json.readValue(value, cameraData);
+            }
+            else {
+                templateGroupsCount += field == "templateGroups";
+                groupsCount += field == "groups";
+                if (!allFields.contains(field) && (!hasUnknownField || field < unknownField)) {
+                    hasUnknownField = true;
+                    unknownField = field;
+                }
+                read = json.skipValue(value);
+            }
+            if (!read) {
+                return streamError(json);
+            }
+        }
+        if (json.next() != Token::TOKEN_END) {
+            return streamError(json);
+        }
+    }
+
+    if (!isObject) {
+        *m_messages << "document is not an object" << std::endl;
+        return false;
+    }
+    if (!hasGlobalData) {
+        *m_messages << "missing required field \"globalData\" on root object" << std::endl;
+        return false;
+    }
+    if (!hasCameraData) {
+        *m_messages << "missing required field \"cameraData\" on root object" << std::endl;
+        return false;
+    }
+    if (hasUnknownField) {
+        *m_messages << "unknown field \"" << unknownField.toStdString() << "\" on root object" << std::endl;
+        return false;
+    }
+    if (!parseGlobalData(globalData.toObject())) {
+        *m_messages << "could not parse \"globalData\"" << std::endl;
+        return false;
+    }
+    if (!parseCameraData(cameraData.toObject())) {
+        *m_messages << "could not parse \"cameraData\"" << std::endl;
+        return false;
+    }
+
+    // Only the syntax was checked so far; the last templateGroups and groups are streamed now
+    m_templateReferences.clear();
+    m_templatesStreamed = false;
+    file.seek(0);
+    JsonStreamReader json(file);
+    json.next();
+    for (Token token = json.next(); token != Token::TOKEN_END_OBJECT; token = json.next()) {
+        if (token == Token::TOKEN_ERROR) {
+            return streamError(json);
+        }
+
+        std::string field = json.string();
+        Token value = json.next();
+        if (field == "templateGroups" && --templateGroupsCount == 0) {
+            if (!streamTemplateGroups(json, value)) {
+                return false;
+            }
+            m_templatesStreamed = true;
+        }
+        else if (field == "groups" && --groupsCount == 0) {
+            if (!streamGroups(json, value, m_root, false)) {
+                return false;
+            }
+        }
+        else if (!json.skipValue(value)) {
+            return streamError(json);
+        }
+    }
+    file.close();
+
+    // The DOM path parses every template before any group; in a stream the templates may
+    // come after the groups naming them, so those groups are resolved here, in file order.
+    // A group naming a template is replaced by it, with the groups nested in it, and the first
+    // other group with an error fails the file. A group's own error comes after any in the
+    // groups nested in it, which are resolved first.
+    std::vector<size_t> failed;
+    for (size_t i = 0; i < m_templateReferences.size() || !failed.empty();) {
+        if (!failed.empty() && i >= m_templateReferences[failed.back()].end) {
+            *m_messages << m_templateReferences[failed.back()].error << std::flush;
+            return false;
+        }
+        const TemplateReference &reference = m_templateReferences[i];
+        if (reference.hasName && m_templates.contains(reference.name)) {
+            reference.parent->children[reference.child] = m_templates[reference.name];
+            i = reference.end;
+            continue;
+        }
+        if (!reference.error.empty()) {
+            failed.push_back(i);
+        }
+        i++;
+    }
+    m_templateReferences.clear();
+
+    *m_messages << "Finished reading " << file_name << std::endl;
+    return true;
+}
+
+bool ScenefileReader::streamError(const JsonStreamReader &json) {
+    *m_messages << "could not parse " << file_name << std::endl;
+    *m_messages << "parse error at line " << json.offset() << ": " << json.errorString() << std::endl;
+    return false;
+}
+
+bool ScenefileReader::streamTemplateGroups(JsonStreamReader &json, JsonStreamReader::Token first) {
+    using Token = JsonStreamReader::Token;
+
+    if (first == Token::TOKEN_ERROR) {
+        return streamError(json);
+    }
+    if (first != Token::TOKEN_BEGIN_ARRAY) {
+        *m_messages << "templateGroups must be an array" << std::endl;
+        return false;
+    }
+
+    for (Token token = json.next(); token != Token::TOKEN_END_ARRAY; token = json.next()) {
+        if (token == Token::TOKEN_ERROR) {
+            return streamError(json);
+        }
+        if (token != Token::TOKEN_BEGIN_OBJECT) {
+            *m_messages << "templateGroup items must be of type object" << std::endl;
+            return false;
+        }
+
+        SceneNode *templateNode = m_arena.create<SceneNode>();
+
+        bool hasName = false;
+        std::string name;
+        if (!streamGroupData(json, templateNode, true, true, hasName, name)) {
+            return false;
+        }
+        if (!hasName) {
+            *m_messages << "missing required field \"name\" on templateGroup object" << std::endl;
+            return false;
+        }
+        if (m_templates.contains(name)) {
+            *m_messages << "templateGroups cannot have the same" << std::endl;
+        }
+        m_templates[name] = templateNode;
+    }
+
+    return true;
+}
+
+bool ScenefileReader::streamGroups(JsonStreamReader &json, JsonStreamReader::Token first, SceneNode *parent, bool inTemplate) {
+    using Token = JsonStreamReader::Token;
+
+    if (first == Token::TOKEN_ERROR) {
+        return streamError(json);
+    }
+    if (first != Token::TOKEN_BEGIN_ARRAY) {
+        *m_messages << "groups must be of type array" << std::endl;
+        return false;
+    }
+
+    for (Token token = json.next(); token != Token::TOKEN_END_ARRAY; token = json.next()) {
+        if (token == Token::TOKEN_ERROR) {
+            return streamError(json);
+        }
+        if (token != Token::TOKEN_BEGIN_OBJECT) {
+            *m_messages << "group items must be of type object" << std::endl;
+            return false;
+        }
+
+        // A group naming a template is replaced by it, and its body is neither validated nor
+        // kept, as in the DOM path. The name may come after the body, so the body is parsed
+        // first, with its error messages held back until the name is known. Inside a template,
+        // only the templates defined before it can be referenced; elsewhere, templates that
+        // come after the groups are only known at the end of the file.
+        bool templatesKnown = inTemplate || m_templatesStreamed;
+        size_t reference = m_templateReferences.size();
+        if (!templatesKnown) {
+            m_templateReferences.push_back(TemplateReference{parent, parent->children.size(), false, "", "", 0});
+        }
+        int depth = json.depth();
+        Arena::Mark mark = m_arena.mark();
+        SceneNode *node = m_arena.create<SceneNode>();
+        parent->children.push_back(node);
+
+        bool hasName = false;
+        std::string name;
+        std::ostringstream errors;
+        std::ostream *messages = m_messages;
+        m_messages = &errors;
+        bool valid = streamGroupData(json, node, false, inTemplate, hasName, name);
+        m_messages = messages;
+        std::string error = errors.str();
+        if (!valid) {
+            bool invalidName = false;
+            if (!finishGroup(json, depth, hasName, name, invalidName)) {
+                return streamError(json);
+            }
+            if (invalidName) {
+                // The DOM path checks the name before the body
+                error = "group name must be of type string\n";
+            }
+        }
+
+        if (!templatesKnown) {
+            TemplateReference &entry = m_templateReferences[reference];
+            entry.hasName = hasName;
+            entry.name = name;
+            entry.error = valid ? "" : error;
+            entry.end = m_templateReferences.size();
+            if (!hasName && valid && entry.end == reference + 1) {
+                m_templateReferences.pop_back();
+            }
+            continue;
+        }
+        if (hasName && m_templates.contains(name)) {
+            m_arena.rollback(mark);
+            parent->children.back() = m_templates[name];
+            continue;
+        }
+        if (!valid) {
+            *m_messages << error << std::flush;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ScenefileReader::streamGroupData(JsonStreamReader &json, SceneNode *node, bool isTemplate, bool inTemplate,
+                                      bool &hasName, std::string &name) {
+    using Token = JsonStreamReader::Token;
+
+    QStringList allFields = {"name", "translate", "rotate", "scale", "matrix", "lights", "primitives", "groups"};
+    QJsonObject transformations;
+
+    for (Token token = json.next(); token != Token::TOKEN_END_OBJECT; token = json.next()) {
+        if (token == Token::TOKEN_ERROR) {
+            return streamError(json);
+        }
+
+        std::string field = json.string();
+        if (!allFields.contains(QString::fromStdString(field))) {
+            *m_messages << "unknown field \"" << field << "\" on " << (isTemplate ? "templateGroup" : "group") << " object" << std::endl;
+            return false;
+        }
+
+        Token value = json.next();
+        if (value == Token::TOKEN_ERROR) {
+            return streamError(json);
+        }
+
+        if (field == "name") {
+            hasName = true;
+            if (value == Token::TOKEN_STRING) {
+                name = json.string();
+            }
+            else if (isTemplate) {
+                *m_messages << "templateGroup name must be a string" << std::endl;
+                if (!json.skipValue(value)) {
+                    return streamError(json);
+                }
+            }
+            else {
+                // Not a name to look up as a template; streamGroups reports the error
+                hasName = false;
+                *m_messages << "group name must be of type string" << std::endl;
+                return false;
+            }
+        }
+        else if (field == "lights") {
+            if (value != Token::TOKEN_BEGIN_ARRAY) {
+                *m_messages << "group lights must be of type array" << std::endl;
+                return false;
+            }
+            for (Token light = json.next(); light != Token::TOKEN_END_ARRAY; light = json.next()) {
+                if (light == Token::TOKEN_ERROR) {
+                    return streamError(json);
+                }
+                if (light != Token::TOKEN_BEGIN_OBJECT) {
+                    *m_messages << "light must be of type object" << std::endl;
+                    return false;
+                }
+                QJsonValue lightData;
+                if (!json.readValue(light, lightData)) {
+                    return streamError(json);
+                }
+                if (!parseLightData(lightData.toObject(), node)) {
+                    return false;
+                }
+            }
+        }
+        else if (field == "primitives") {
+            if (value != Token::TOKEN_BEGIN_ARRAY) {
+                *m_messages << "group primitives must be of type array" << std::endl;
+                return false;
+            }
+            for (Token primitive = json.next(); primitive != Token::TOKEN_END_ARRAY; primitive = json.next()) {
+                if (primitive == Token::TOKEN_ERROR) {
+                    return streamError(json);
+                }
+                if (primitive != Token::TOKEN_BEGIN_OBJECT) {
+                    *m_messages << "primitive must be of type object" << std::endl;
+                    return false;
+                }
+                QJsonValue primitiveData;
+                if (!json.readValue(primitive, primitiveData)) {
+                    return streamError(json);
+                }
+                if (!parsePrimitive(primitiveData.toObject(), node)) {
+                    return false;
+                }
+            }
+        }
+        else if (field == "groups") {
+            if (!streamGroups(json, value, node, inTemplate)) {
+                return false;
+            }
+        }
+        else {
+            // translate, rotate, scale or matrix: applied in a fixed order once the group ends
+            QJsonValue transformation;
+            if (!json.readValue(value, transformation)) {
+                return streamError(json);
+            }
+            transformations.insert(QString::fromStdString(field), transformation);
+        }
+    }
+
+    return parseTransformations(transformations, node);
+}
@@ -2,20 +2,24 @@
 
 #include "scenedata.h"
 
+#include <iostream>
 #include <vector>
 #include <map>
 
 #include <QJsonDocument>
 #include <QJsonObject>
 
+#include "utils/arena.h"
 #include "utils/rgba.h"
+#include "utils/jsonstreamreader.h"
 
 // This class parses the scene graph specified by the CS123 Xml file format.
 class ScenefileReader {
 public:
 
-    // Create a ScenefileReader, passing it the scene file.
-    ScenefileReader(const std::string &filename);
+    // Create a ScenefileReader, passing it the scene file. Error messages, and the line
+    // reporting a successful read, are written to `messages`.
+    ScenefileReader(const std::string &filename, std::ostream &messages = std::cout);
 
     // Clean up all data for the scene
     ~ScenefileReader();
@@ -23,6 +27,11 @@ public:
     // Parse the XML scene file. Returns false if scene is invalid.
     bool readJSON();
 
+    // Parse the scene file with a streaming reader instead of building a QJsonDocument, so
+    // peak memory does not grow with the file size. Applies the same validation, with the
+    // same error messages in the same order, as readJSON(). Returns false if scene is invalid.
+    bool readJSONStream();
+
     SceneGlobalData getGlobalData() const;
 
     SceneCameraData getCameraData() const;
@@ -38,16 +47,41 @@ private:
     bool parseTemplateGroupData(const QJsonObject &templateGroup);
     bool parseGroups(const QJsonValue &groups, SceneNode *parent);
     bool parseGroupData(const QJsonObject &object, SceneNode *node);
+    bool parseTransformations(const QJsonObject &object, SceneNode *node);
     bool parsePrimitive(const QJsonObject &prim, SceneNode *node);
     bool parseLightData(const QJsonObject &lightData, SceneNode *node);
 
+    // Streaming counterparts of the functions above; `first` is the value's first token.
+    bool streamTemplateGroups(JsonStreamReader &json, JsonStreamReader::Token first);
+    bool streamGroups(JsonStreamReader &json, JsonStreamReader::Token first, SceneNode *parent, bool inTemplate);
+    bool streamGroupData(JsonStreamReader &json, SceneNode *node, bool isTemplate, bool inTemplate,
+                         bool &hasName, std::string &name);
+    bool streamError(const JsonStreamReader &json);
+
     std::string file_name;
 
+    // Where messages are written; streamGroups points it elsewhere to hold a group's errors back
+    std::ostream *m_messages;
+
     mutable std::map<std::string, SceneNode *> m_templates;
 
     SceneGlobalData m_globalData;
     SceneCameraData m_cameraData;
 
+    // Owns every node, primitive, light and transformation of the scene graph
+    Arena m_arena;
     SceneNode *m_root;
-    std::vector<SceneNode *> m_nodes;
+
+    // Whether the streamed file's templateGroups have been read, so every template is known
+    bool m_templatesStreamed = false;
+    // Groups read before the templates that may name one of them, in file order
+    struct TemplateReference {
+        SceneNode *parent;
+        size_t child;
+        bool hasName;
+        std::string name;
+        std::string error; // Messages from the group's body, held back until its name is resolved
+        size_t end;        // Index just past the references nested in this group
+    };
+    std::vector<TemplateReference> m_templateReferences;
 };
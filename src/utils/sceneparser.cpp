@@ -1,82 +1,241 @@
 #include "sceneparser.h"
 #include "scenefilereader.h"
+#include "scenecache.h"
+#include "tracing.h"
 #include <glm/gtx/transform.hpp>
 
+#include <QtConcurrent>
+#include <QThread>
+
+#include <algorithm>
 #include <chrono>
 #include <iostream>
-void helper(SceneNode* node, glm::mat4 ctm, RenderData &renderData){
-    std::vector<SceneTransformation *> transformation = node->transformations;
+#include <unordered_map>
+
+namespace {
 
-    for (int i = 0; i < transformation.size(); i++) {
-        SceneTransformation trans = *transformation[i];
+// Below this many shapes and lights, flattening on one thread beats spawning tasks
+const size_t kParallelThreshold = 1 << 14;
 
-        switch (trans.type) {
+glm::mat4 applyTransformations(const SceneNode *node, glm::mat4 ctm) {
+    for (const SceneTransformation *trans : node->transformations) {
+        switch (trans->type) {
         case TransformationType::TRANSFORMATION_TRANSLATE:
-            ctm = glm::translate(ctm, glm::vec3(trans.translate.x, trans.translate.y, trans.translate.z));
+            ctm = glm::translate(ctm, glm::vec3(trans->translate.x, trans->translate.y, trans->translate.z));
             break;
         case TransformationType::TRANSFORMATION_SCALE:
-            ctm = glm::scale(ctm, glm::vec3(trans.scale.x, trans.scale.y, trans.scale.z));
+            ctm = glm::scale(ctm, glm::vec3(trans->scale.x, trans->scale.y, trans->scale.z));
             break;
         case TransformationType::TRANSFORMATION_ROTATE:
-            ctm = glm::rotate(ctm, trans.angle, glm::vec3(trans.rotate.x, trans.rotate.y, trans.rotate.z));
+            ctm = glm::rotate(ctm, trans->angle, glm::vec3(trans->rotate.x, trans->rotate.y, trans->rotate.z));
             break;
         case TransformationType::TRANSFORMATION_MATRIX:
-            ctm = ctm * trans.matrix;
+            ctm = ctm * trans->matrix;
             break;
         }
     }
+    return ctm;
+}
 
+SceneLightData transformLight(const SceneLight &light, const glm::mat4 &ctm) {
+    SceneLightData transformedLightData{};
+    transformedLightData.id = light.id;
+    transformedLightData.type = light.type;
+    transformedLightData.color = light.color;
+    transformedLightData.function = light.function;
+    transformedLightData.penumbra = light.penumbra;
+    transformedLightData.angle = light.angle;
+    transformedLightData.width = light.width;
+    transformedLightData.height = light.height;
 
-    std::vector<ScenePrimitive *> primtype = node->primitives;
+    switch(light.type) {
+    case LightType::LIGHT_POINT:
+        transformedLightData.pos = ctm * glm::vec4(0, 0, 0, 1.0f);
+        break;
+    case LightType::LIGHT_DIRECTIONAL:
+        transformedLightData.dir = ctm * light.dir;
+        break;
+    case LightType::LIGHT_SPOT:
+        transformedLightData.pos = ctm * glm::vec4(0, 0, 0, 1.0f);
+        transformedLightData.dir = ctm * light.dir;
+        break;
+    }
+    return transformedLightData;
+}
 
-    for (int i = 0; i < primtype.size(); i++) {
-        ScenePrimitive primitive = *primtype[i];
-        RenderShapeData object;
-        object.primitive = primitive;
-        object.ctm = ctm;
-        renderData.shapes.push_back(object);
+// Identifies materials by value, so shapes with identical materials share one table entry
+struct MaterialHash {
+    size_t operator()(const SceneMaterial &mat) const {
+        size_t hash = 0;
+        auto combine = [&hash](size_t value) {
+            hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+        };
+        for (const SceneColor &color : {mat.cAmbient, mat.cDiffuse, mat.cSpecular, mat.cReflective,
+                                        mat.cTransparent, mat.cEmissive}) {
+            for (int i = 0; i < 4; i++) {
+                combine(std::hash<float>()(color[i]));
+            }
+        }
+        for (float value : {mat.shininess, mat.ior, mat.blend}) {
+            combine(std::hash<float>()(value));
+        }
+        for (const SceneFileMap *map : {&mat.textureMap, &mat.bumpMap}) {
+            combine(map->isUsed);
+            if (map->isUsed) {
+                combine(std::hash<std::string>()(map->filename));
+                combine(std::hash<float>()(map->repeatU));
+                combine(std::hash<float>()(map->repeatV));
+            }
+        }
+        return hash;
+    }
+};
 
+struct MaterialEqual {
+    static bool sameFileMap(const SceneFileMap &a, const SceneFileMap &b) {
+        return a.isUsed == b.isUsed &&
+               (!a.isUsed || (a.filename == b.filename && a.repeatU == b.repeatU && a.repeatV == b.repeatV));
     }
 
-    std::vector<SceneLight *> lightdata = node->lights;
+    bool operator()(const SceneMaterial &a, const SceneMaterial &b) const {
+        return a.cAmbient == b.cAmbient && a.cDiffuse == b.cDiffuse && a.cSpecular == b.cSpecular &&
+               a.cReflective == b.cReflective && a.cTransparent == b.cTransparent && a.cEmissive == b.cEmissive &&
+               a.shininess == b.shininess && a.ior == b.ior && a.blend == b.blend &&
+               sameFileMap(a.textureMap, b.textureMap) && sameFileMap(a.bumpMap, b.bumpMap);
+    }
+};
 
-    for (int i = 0; i < lightdata.size(); i++) {
-        SceneLight light = *lightdata[i];
+// Flattens the scene graph into RenderData in two passes. The first counts the shapes and
+// lights below every node, which fixes where each subtree lands in the output arrays; the
+// second sizes the arrays once and fills disjoint subtrees in parallel. The output order is
+// the same as a sequential depth-first traversal.
+class Flattener {
+public:
+    explicit Flattener(RenderData &renderData) : m_renderData(renderData) {}
 
-        SceneLightData transformedLightData;
-        transformedLightData.id = light.id;
-        transformedLightData.type = light.type;
-        transformedLightData.color = light.color;
-        transformedLightData.function = light.function;
-        transformedLightData.penumbra = light.penumbra;
-        transformedLightData.angle = light.angle;
-        transformedLightData.width = light.width;
-        transformedLightData.height = light.height;
+    void flatten(const SceneNode *root) {
+        const NodeInfo &total = count(root);
+        m_renderData.shapes.resize(total.shapes);
+        m_renderData.lights.resize(total.lights);
 
-        switch(light.type) {
-        case LightType::LIGHT_POINT:
-            transformedLightData.pos = ctm * glm::vec4(0, 0, 0, 1.0f);
-            break;
-        case LightType::LIGHT_DIRECTIONAL:
-            transformedLightData.dir = glm::mat4(ctm) * glm::vec4(light.dir);
-            break;
-        case LightType::LIGHT_SPOT:
-            transformedLightData.pos = ctm * glm::vec4(0, 0, 0, 1.0f);
-            transformedLightData.dir = glm::mat4(ctm) * glm::vec4(light.dir);
-            break;
+        std::vector<Task> tasks{Task{root, glm::mat4(1.0f), 0, 0}};
+        size_t items = total.shapes + total.lights;
+        if (items < kParallelThreshold) {
+            fill(tasks[0]);
+            return;
         }
-        renderData.lights.push_back(transformedLightData);
 
+        // Split off subtrees until each holds at most `grain` items, writing the split nodes'
+        // own shapes and lights on the way down
+        size_t grain = std::max<size_t>(items / (4 * QThread::idealThreadCount()), 1);
+        for (bool split = true; split;) {
+            split = false;
+            std::vector<Task> next;
+            for (const Task &task : tasks) {
+                const NodeInfo &info = m_nodes.find(task.node)->second;
+                if (info.shapes + info.lights <= grain || task.node->children.empty()) {
+                    next.push_back(task);
+                    continue;
+                }
+                Task own = task;
+                own.ctm = applyTransformations(task.node, task.ctm);
+                emit(own);
+                for (const SceneNode *child : task.node->children) {
+                    next.push_back(Task{child, own.ctm, own.shapeOffset, own.lightOffset});
+                    const NodeInfo &childInfo = m_nodes.find(child)->second;
+                    own.shapeOffset += childInfo.shapes;
+                    own.lightOffset += childInfo.lights;
+                }
+                split = true;
+            }
+            tasks.swap(next);
+        }
+        QtConcurrent::blockingMap(tasks, [this](const Task &task) { fill(task); });
     }
-    for (SceneNode* child : node->children) {
-        helper(child, ctm, renderData);
+
+private:
+    struct NodeInfo {
+        size_t shapes; // Shapes and lights in the subtree, counting every instance of shared templates
+        size_t lights;
+        size_t firstPrimitive; // The node's own primitives start here in m_primitives
+    };
+
+    // A subtree, and where its shapes and lights go in the output arrays
+    struct Task {
+        const SceneNode *node;
+        glm::mat4 ctm; // The parent's cumulative transformation matrix; the node's own when emitting
+        size_t shapeOffset;
+        size_t lightOffset;
+    };
+
+    // Counts the subtree below `node`. Templates make the scene graph a DAG, so every node is
+    // only visited once; this is also where each primitive gets its material ID.
+    const NodeInfo &count(const SceneNode *node) {
+        auto it = m_nodes.find(node);
+        if (it != m_nodes.end()) {
+            return it->second;
+        }
+
+        NodeInfo info{node->primitives.size(), node->lights.size(), m_primitives.size()};
+        for (const ScenePrimitive *primitive : node->primitives) {
+            RenderShapeData shape{};
+            shape.type = primitive->type;
+            auto material = m_materialIds.try_emplace(primitive->material, m_renderData.materials.size());
+            if (material.second) {
+                m_renderData.materials.push_back(primitive->material);
+            }
+            shape.material = material.first->second;
+            if (primitive->type == PrimitiveType::PRIMITIVE_MESH) {
+                shape.mesh = m_renderData.meshfiles.size();
+                m_renderData.meshfiles.push_back(primitive->meshfile);
+            }
+            m_primitives.push_back(shape);
+        }
+        for (const SceneNode *child : node->children) {
+            const NodeInfo &childInfo = count(child);
+            info.shapes += childInfo.shapes;
+            info.lights += childInfo.lights;
+        }
+        return m_nodes.emplace(node, info).first->second;
     }
 
+    // Writes the node's own shapes and lights, advancing the task's offsets past them
+    void emit(Task &task) const {
+        const NodeInfo &info = m_nodes.find(task.node)->second;
+        for (size_t i = 0; i < task.node->primitives.size(); i++) {
+            RenderShapeData &shape = m_renderData.shapes[task.shapeOffset++];
+            shape = m_primitives[info.firstPrimitive + i];
+            shape.ctm = task.ctm;
+        }
+        for (const SceneLight *light : task.node->lights) {
+            m_renderData.lights[task.lightOffset++] = transformLight(*light, task.ctm);
+        }
+    }
+
+    void fill(const Task &task) const {
+        Task own = task;
+        own.ctm = applyTransformations(task.node, task.ctm);
+        emit(own);
+        for (const SceneNode *child : task.node->children) {
+            fill(Task{child, own.ctm, own.shapeOffset, own.lightOffset});
+            const NodeInfo &childInfo = m_nodes.find(child)->second;
+            own.shapeOffset += childInfo.shapes;
+            own.lightOffset += childInfo.lights;
+        }
+    }
+
+    RenderData &m_renderData;
+    std::unordered_map<const SceneNode *, NodeInfo> m_nodes;
+    std::vector<RenderShapeData> m_primitives; // Every primitive in the graph, without a CTM
+    std::unordered_map<SceneMaterial, std::uint32_t, MaterialHash, MaterialEqual> m_materialIds;
+};
+
 }
 
-bool SceneParser::parse(std::string filepath, RenderData &renderData) {
-    ScenefileReader fileReader = ScenefileReader(filepath);
-    bool success = fileReader.readJSON();
+bool SceneParser::parse(std::string filepath, RenderData &renderData, bool streaming, std::ostream &messages) {
+    TraceScope scope("parse", "SceneParser::parse");
+    ScenefileReader fileReader = ScenefileReader(filepath, messages);
+    bool success = streaming ? fileReader.readJSONStream() : fileReader.readJSON();
     if (!success) {
         return false;
     }
@@ -91,11 +250,25 @@ bool SceneParser::parse(std::string filepath, RenderData &renderData) {
     //         create a helper function to do so!
     SceneNode* root = fileReader.getRootNode();
     renderData.shapes.clear();
+    renderData.lights.clear();
+    renderData.materials.clear();
+    renderData.meshfiles.clear();
 
-    glm::mat4 ctm = glm::mat4(1.0f);
-    helper(root, ctm, renderData);
+    Flattener(renderData).flatten(root);
 
     return true;
 }
 
 
+
+bool SceneParser::parse(std::string filepath, std::string cachepath, RenderData &renderData, bool streaming) {
+    if (SceneCache::load(cachepath, filepath, renderData)) {
+        return true;
+    }
+    if (!parse(filepath, renderData, streaming)) {
+        return false;
+    }
+    // A failed cache write only costs the next run a re-parse
+    SceneCache::save(cachepath, filepath, renderData);
+    return true;
+}
@@ -1,12 +1,16 @@
 #pragma once
 
 #include "scenedata.h"
+#include <cstdint>
+#include <iostream>
 #include <vector>
 #include <string>
 
 // Struct which contains data for a single primitive, to be used for rendering
 struct RenderShapeData {
-    ScenePrimitive primitive;
+    PrimitiveType type;
+    std::uint32_t material; // Material ID: index into RenderData::materials
+    std::uint32_t mesh;     // Index into RenderData::meshfiles; only applicable to meshes
     glm::mat4 ctm; // the cumulative transformation matrix
 };
 
@@ -16,6 +20,8 @@ struct RenderData {
     SceneCameraData cameraData;
 
     std::vector<SceneLightData> lights;
+    std::vector<SceneMaterial> materials; // Deduplicated; shapes refer to them by index
+    std::vector<std::string> meshfiles;
     std::vector<RenderShapeData> shapes;
 };
 
@@ -24,6 +30,14 @@ public:
     // Parse the scene and store the results in renderData.
     // @param filepath    The path of the scene file to load.
     // @param renderData  On return, this will contain the metadata of the loaded scene.
+    // @param streaming   Read the file with the streaming parser instead of a QJsonDocument.
+    // @param messages    Where the scene file reader writes its errors and progress.
     // @return            A boolean value indicating whether the parse was successful.
-    static bool parse(std::string filepath, RenderData &renderData);
+    static bool parse(std::string filepath, RenderData &renderData, bool streaming = false,
+                      std::ostream &messages = std::cout);
+
+    // Same as above, but loads the compiled scene from the binary cache at `cachepath` when it is
+    // up to date with the scene file, and (re)builds the cache otherwise.
+    // @param cachepath   The path of the compiled scene cache, see SceneCache.
+    static bool parse(std::string filepath, std::string cachepath, RenderData &renderData, bool streaming = false);
 };
@@ -0,0 +1,116 @@
+#include "tracing.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    const char *category;
+    const char *name;
+    int thread;
+    double start;    // Microseconds
+    double duration; // Microseconds
+    std::string args;
+};
+
+std::atomic<bool> g_enabled{false};
+std::chrono::steady_clock::time_point g_epoch;
+std::mutex g_mutex;
+std::vector<TraceEvent> g_events;
+std::atomic<int> g_nextThread{0};
+
+// Small, stable IDs read better in the viewer than native thread IDs
+int currentThread() {
+    thread_local int thread = g_nextThread++;
+    return thread;
+}
+
+double microsecondsSinceStart() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+std::string escape(const std::string &text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        if (c >= 0 && c < 0x20) {
+            continue;
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+}
+
+void Tracer::start() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_events.clear();
+    g_epoch = std::chrono::steady_clock::now();
+    currentThread();
+    g_enabled.store(true, std::memory_order_relaxed);
+}
+
+bool Tracer::enabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+bool Tracer::save(const std::string &path) {
+    std::ofstream out(path);
+    if (!out) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    // Name every thread that recorded an event; thread 0 called start()
+    int threads = g_nextThread.load();
+    for (int thread = 0; thread < threads; thread++) {
+        out << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << thread
+            << ", \"args\": {\"name\": \"" << (thread == 0 ? std::string("main") : "worker " + std::to_string(thread))
+            << "\"}},\n";
+    }
+    for (size_t i = 0; i < g_events.size(); i++) {
+        const TraceEvent &event = g_events[i];
+        out << "{\"ph\": \"X\", \"cat\": \"" << event.category << "\", \"name\": \"" << event.name
+            << "\", \"pid\": 1, \"tid\": " << event.thread
+            << ", \"ts\": " << event.start << ", \"dur\": " << event.duration
+            << ", \"args\": {" << event.args << "}}" << (i + 1 < g_events.size() ? ",\n" : "\n");
+    }
+    out << "]}" << std::endl;
+    return bool(out);
+}
+
+TraceScope::TraceScope(const char *category, const char *name)
+    : m_category(category), m_name(name), m_active(Tracer::enabled()), m_start(0.0) {
+    if (m_active) {
+        m_start = microsecondsSinceStart();
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (!m_active) {
+        return;
+    }
+    double end = microsecondsSinceStart();
+    int thread = currentThread();
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_events.push_back(TraceEvent{m_category, m_name, thread, m_start, end - m_start, std::move(m_args)});
+}
+
+void TraceScope::addArg(const char *key, const std::string &value) {
+    if (m_active) {
+        m_args += (m_args.empty() ? "\"" : ", \"") + escape(key) + "\": \"" + escape(value) + "\"";
+    }
+}
+
+void TraceScope::addArg(const char *key, long long value) {
+    if (m_active) {
+        m_args += (m_args.empty() ? "\"" : ", \"") + escape(key) + "\": " + std::to_string(value);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+
+// Timeline recording in the Chrome Trace Event format, for chrome://tracing and Perfetto
+// (ui.perfetto.dev). Recording is off until Tracer::start(); until then a TraceScope costs one
+// relaxed atomic load.
+class Tracer {
+public:
+    // Starts recording events, timed from now. The calling thread is named "main".
+    static void start();
+    static bool enabled();
+    // Writes the events recorded so far as a JSON trace.
+    // @return False if the file could not be written.
+    static bool save(const std::string &path);
+};
+
+// Records the time from its construction to its destruction as one event on the calling
+// thread, when Tracer is recording
+class TraceScope {
+public:
+    // @param category Groups related events, e.g. "io" or "render"; must outlive the trace
+    // @param name     The event's label; must outlive the trace
+    TraceScope(const char *category, const char *name);
+    ~TraceScope();
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+    // Whether this event is being recorded. Check it before computing arguments.
+    bool active() const { return m_active; }
+    // Attaches an argument, shown with the event in the viewer
+    void addArg(const char *key, const std::string &value);
+    void addArg(const char *key, long long value);
+
+private:
+    const char *m_category;
+    const char *m_name;
+    bool m_active;
+    double m_start; // Microseconds since Tracer::start()
+    std::string m_args; // JSON members, comma separated
+};